@@ -14,33 +14,227 @@
 // This file was created in part with generative AI
 
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory_resource>
 #include <optional>
 #include <set>
+#include <unordered_map>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 #include "deck.hpp"
+#include "evaluator.hpp"
+#include "expression.hpp"
+#include "fd_streambuf.hpp"
+#include "probes.hpp"
 #include "rummy_utils.hpp"
 #include <pips/vm.hpp>
 
 namespace Rummy {
 
+namespace {
+// compiler global used to evaluate loop bounds; never stored in the deck
+constexpr char kEvalName[] = "__rummy_eval__";
+// bytes read at a time while filling a scan window
+constexpr std::size_t kScanReadSize = std::size_t(1) << 16;
+
+// inverse of GlobalName, e.g. gas.eos.gamma -> gas/eos + gamma
+std::pair<std::string, std::string> SplitGlobalName(const std::string &global_name) {
+  const auto last_dot = global_name.find_last_of('.');
+  if (last_dot == std::string::npos) return {"/", global_name};
+  std::string suit = global_name.substr(0, last_dot);
+  std::replace(suit.begin(), suit.end(), '.', '/');
+  return {suit, global_name.substr(last_dot + 1)};
+}
+
+// name of a card in the compiler, e.g. gas/eos + gamma -> gas.eos.gamma
+std::string GlobalName(const std::string &suit, const std::string &name) {
+  if (suit == "/" || suit.empty()) return name;
+  std::string prefix = suit;
+  std::replace(prefix.begin(), prefix.end(), '/', '.');
+  return prefix + "." + name;
+}
+// "suit/name", or "name" for a global
+std::string CardPath(const std::string &suit, const std::string &name) {
+  return (suit == "/" || suit.empty()) ? name : suit + "/" + name;
+}
+// shell style match with '*' and '?'
+bool GlobMatch(const std::string &pattern, const std::string &text) {
+  std::size_t p = 0, t = 0;
+  std::size_t star = std::string::npos, resume = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      p++;
+      t++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = t;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      t = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+  return p == pattern.size();
+}
+// subscription pattern: card path, suit prefix ending in '/', or glob
+bool MatchesCard(const std::string &pattern, const std::string &path) {
+  if (pattern.find_first_of("*?") != std::string::npos) return GlobMatch(pattern, path);
+  if (!pattern.empty() && pattern.back() == '/') {
+    return path.compare(0, pattern.size(), pattern) == 0;
+  }
+  return path == pattern ||
+         (path.size() > pattern.size() && path.compare(0, pattern.size(), pattern) == 0 &&
+          path[pattern.size()] == '[');
+}
+
+// One deck line with whitespace other than spaces removed and its trailing comment
+// split off. Blank and comment-only lines are dropped. The views point into the
+// scanned buffer, which is compacted in place.
+struct ScannedLine {
+  std::string_view text;
+  std::string_view comment; // without '&', leading and trailing whitespace
+  int line_num = 0;
+  bool has_comment = false;
+};
+
+// Scan the lines of chunk, numbering them from line_num + 1. Each line is handled on
+// its own (quotes never span lines), so chunks split at line starts scan independently.
+// Lines are compacted within their own bytes, so no text is copied. Returns the number
+// of lines in the chunk.
+int ScanLines(char *chunk, std::size_t size, int line_num,
+              std::vector<ScannedLine> &lines) {
+  const int first_line = line_num;
+  std::size_t pos = 0;
+  while (pos < size) {
+    auto *eol = static_cast<char *>(std::memchr(chunk + pos, '\n', size - pos));
+    const std::size_t end = (eol == nullptr) ? size : eol - chunk;
+    char *const line = chunk + pos;
+    // remove all \t\f\n\r\v but leave pure spaces in case of a string containing spaces
+    std::size_t length = 0;
+    for (std::size_t i = pos; i < end; i++) {
+      const char c = chunk[i];
+      if (!std::isspace(static_cast<unsigned char>(c)) || c == ' ') line[length++] = c;
+    }
+    pos = end + 1;
+    line_num++;
+    std::string_view text(line, length);
+    auto first_char = text.find_first_not_of(" ");    // skip white space
+    if (first_char == std::string_view::npos) continue; // line is blank
+    if (text[first_char] == '#') continue;             // skip comments
+    ScannedLine scanned;
+    // remove trailing comments — skip '#' that appears inside a quoted string
+    bool in_quotes = false;
+    for (std::size_t ci = first_char; ci < text.size(); ++ci) {
+      if (text[ci] == '"') {
+        in_quotes = !in_quotes;
+      } else if (text[ci] == '#' && !in_quotes) {
+        // preserve the comment
+        char *comment = line + ci + 1;
+        char *comment_end = std::remove(comment, line + length, '&');
+        while (comment != comment_end && *comment == ' ') comment++;
+        while (comment_end != comment && comment_end[-1] == ' ') comment_end--;
+        scanned.comment = std::string_view(comment, comment_end - comment);
+        scanned.has_comment = true;
+        text = text.substr(0, ci);
+        break;
+      }
+    }
+    scanned.text = text;
+    scanned.line_num = line_num;
+    lines.push_back(scanned);
+  }
+  return line_num - first_line;
+}
+
+// Scan size bytes of whole lines, numbering them after line_num, which is advanced
+// past them. Inputs larger than chunk_size bytes are split at line starts into at most
+// nthreads chunks of at least that size, scanned on separate threads and stitched back
+// in order with their line numbers shifted, so the result matches a sequential scan.
+std::vector<ScannedLine> ScanBuffer(char *data, std::size_t size, std::size_t chunk_size,
+                                    unsigned nthreads, int &line_num) {
+  const std::string_view buffer(data, size);
+  std::size_t nchunks = 1;
+  if (chunk_size > 0 && buffer.size() > chunk_size) {
+    nchunks = std::min<std::size_t>(nthreads, buffer.size() / chunk_size);
+  }
+  std::vector<ScannedLine> lines;
+  if (nchunks <= 1) {
+    line_num += ScanLines(data, size, line_num, lines);
+    return lines;
+  }
+
+  std::vector<std::pair<char *, std::size_t>> chunks; // first byte and size
+  std::size_t start = 0;
+  for (std::size_t i = 1; i <= nchunks && start < buffer.size(); i++) {
+    std::size_t stop = buffer.size();
+    if (i < nchunks) {
+      stop = buffer.find('\n', std::max(start, i * buffer.size() / nchunks));
+      stop = (stop == std::string_view::npos) ? buffer.size() : stop + 1;
+    }
+    chunks.emplace_back(data + start, stop - start);
+    start = stop;
+  }
+  std::vector<std::vector<ScannedLine>> chunk_lines(chunks.size());
+  std::vector<int> chunk_counts(chunks.size(), 0);
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < chunks.size(); i++) {
+    workers.emplace_back([&, i]() {
+      chunk_counts[i] = ScanLines(chunks[i].first, chunks[i].second, 0, chunk_lines[i]);
+    });
+  }
+  chunk_counts[0] = ScanLines(chunks[0].first, chunks[0].second, 0, chunk_lines[0]);
+  for (auto &worker : workers) worker.join();
+
+  std::size_t total = 0;
+  for (const auto &chunk : chunk_lines) total += chunk.size();
+  lines.reserve(total);
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    for (auto &line : chunk_lines[i]) {
+      line.line_num += line_num;
+      lines.push_back(line);
+    }
+    line_num += chunk_counts[i];
+  }
+  return lines;
+}
+} // namespace
+
 void Deck::Build(std::string fname, std::string prepends) {
   std::stringstream pss;
   pss << prepends;
   Build(pss);
+  if (fname == "-") {
+    BuildStreaming(STDIN_FILENO);
+    return;
+  }
   std::ifstream input(fname);
   if (input.is_open()) {
     std::string base_dir = std::filesystem::path(fname).parent_path().string();
-    std::stringstream ss;
-    ss << input.rdbuf();
-    BuildInternal(ss, base_dir);
+    BuildInternal(input, base_dir);
   } else {
     std::stringstream msg;
     msg << "Could not open file '" << fname << "'";
@@ -60,583 +254,1828 @@ void Deck::Build(std::istream &ss, std::istream &prepends) {
   Build(ss);
 }
 
-void Deck::CompileStream(std::istream &ss, std::map<std::string, CardMeta> &meta,
-                         const std::string &base_dir,
-                         std::set<std::string> &include_stack, pips::VTable &locals,
-                         std::string &curr_suit, std::string &prev_suit) {
-  std::string line;
+void Deck::CompileStream(std::istream &ss, CompileContext &ctx,
+                         const std::string &base_dir) {
+  // joining continuations and carrying comments between statements is sequential
   std::string comment;
   std::string multiline;
   bool line_continue = false;
+  bool sets_comment = false;
+  std::optional<StatementBlock> block;
 
-  int line_num = 0;
-  while (std::getline(ss, line)) {
-    line_num++;
-    // remove all \t\f\n\r\v but leave pure spaces in case of a string containing spaces
-    line.erase(std::remove_if(line.begin(), line.end(),
-                              [](char c) { return std::isspace(c) && c != ' '; }),
-               line.end());
-
-    if (line.empty()) continue;                          // skip blank line
-    auto first_char = line.find_first_not_of(" ");       // skip white space
-    if (first_char == std::string::npos) continue;       // line is all white space
-    if (line.compare(first_char, 1, "#") == 0) continue; // skip comments
-    // remove trailing comments — skip '#' that appears inside a quoted string
-    std::string this_comment;
-    {
-      bool in_quotes = false;
-      size_t last_comment = std::string::npos;
-      for (size_t ci = 0; ci < line.size(); ++ci) {
-        if (line[ci] == '"') {
-          in_quotes = !in_quotes;
-        } else if (line[ci] == '#' && !in_quotes) {
-          last_comment = ci;
-          break;
-        }
-      }
-      if (last_comment != std::string::npos) {
-        // preserve the comment
-        this_comment = line.substr(last_comment + 1);
-        line = line.substr(0, last_comment);
-        this_comment.erase(std::remove(this_comment.begin(), this_comment.end(), '&'),
-                           this_comment.end());
-        RemoveLeadingWhitespace(this_comment);
-        RemoveTrailingWhitespace(this_comment);
-        if (line_continue && !this_comment.empty()) {
-          comment += " " + this_comment;
-        } else if (!line_continue) {
-          comment = this_comment;
-        }
+  auto assemble = [&](const ScannedLine &scanned) {
+    if (!line_continue) sets_comment = false;
+    std::string_view line = scanned.text;
+    const int line_num = scanned.line_num;
+    auto first_char = line.find_first_not_of(" ");
+    // comments are not kept without metadata, so they are not copied either
+    if (scanned.has_comment && metadata != CardMetadata::NONE) {
+      const auto &this_comment = scanned.comment;
+      if (line_continue && !this_comment.empty()) {
+        comment.append(" ").append(this_comment);
+        sets_comment = true;
+      } else if (!line_continue) {
+        comment = this_comment;
+        sets_comment = true;
       }
-    } // end quote-aware comment search
+    }
     // the multiline character has to be the last character of the line
     // once comments and whitespace are removed
     auto last_char = line.find_last_not_of(" ");
-    if ((last_char == std::string::npos) || (last_char < first_char)) continue;
+    if ((last_char == std::string_view::npos) || (last_char < first_char)) return;
     if (line[last_char] == '&') {
       // if we have a multiline character, then we need to continue the line
       if (line_continue) {
         // if we are continuing a multiline, then we need to add the line to the
         // multiline
-        multiline += " " + line.substr(first_char, last_char - first_char);
+        multiline.append(" ").append(line, first_char, last_char - first_char);
       } else {
         // start a new multiline
-        multiline = line.substr(first_char, last_char - first_char);
+        multiline.assign(line, first_char, last_char - first_char);
         line_continue = true;
       }
-      continue;
-    } else {
-      // if we have a multiline character, then we need to add it to the multiline
-      // string
-      if (line_continue) {
-        // close out the multiline
-        multiline += " " + line.substr(first_char, last_char - first_char + 1);
-
-        // move multiline into line and reset the first character of line
-        line = multiline;
-        first_char = line.find_first_not_of(" ");
+      return;
+    }
+    // if we have a multiline character, then we need to add it to the multiline string
+    const bool joined = line_continue;
+    if (joined) {
+      // close out the multiline; the statement is then a view of it
+      multiline.append(" ").append(line, first_char, last_char - first_char + 1);
+      line = multiline;
+      line_continue = false;
+    }
+    CompileStatement({line, line_num, sets_comment, comment}, ctx, base_dir, comment, block);
+    if (joined) multiline.clear();
+  };
 
-        multiline.clear();
-        line_continue = false;
+  if (ctx.streaming || scan_chunk_size == 0) {
+    // one line at a time, compiling each statement as soon as it is complete
+    std::string raw;
+    std::vector<ScannedLine> lines;
+    int line_num = 0;
+    while (std::getline(ss, raw)) {
+      lines.clear();
+      ScanLines(raw.data(), raw.size(), line_num++, lines);
+      for (const auto &scanned : lines) assemble(scanned);
+    }
+  } else {
+    // A window of one chunk per thread is read, its whole lines are scanned in parallel
+    // and compiled, and the partial last line is carried over to the next window. The
+    // input is never held whole; the lines are views into the window.
+    const unsigned nthreads =
+        scan_threads ? scan_threads : std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t window = scan_chunk_size * nthreads;
+    const std::size_t piece = std::min(window, kScanReadSize);
+    std::string buffer;
+    std::size_t filled = 0;
+    std::size_t wanted = window;
+    int line_num = 0;
+    for (;;) {
+      while (filled < wanted && ss) {
+        if (buffer.size() < filled + piece) buffer.resize(filled + piece);
+        ss.read(buffer.data() + filled, piece);
+        filled += ss.gcount();
+      }
+      const bool at_end = !ss;
+      std::size_t stop = filled;
+      if (!at_end) {
+        const auto last = std::string_view(buffer.data(), filled).rfind('\n');
+        if (last == std::string_view::npos) {
+          wanted = filled + window; // a line longer than the window
+          continue;
+        }
+        stop = last + 1;
+      }
+      for (const auto &scanned :
+           ScanBuffer(buffer.data(), stop, scan_chunk_size, nthreads, line_num)) {
+        assemble(scanned);
       }
+      if (at_end) break;
+      std::memmove(buffer.data(), buffer.data() + stop, filled - stop);
+      filled -= stop;
+      wanted = window;
     }
+  }
+  if (block) {
+    std::stringstream msg;
+    msg << "Missing 'end' for the block starting at line " << block->line_num;
+    fatal(msg);
+  }
+}
 
-    // include statement
-    if (line.compare(first_char, 7, "include") == 0) {
-      const size_t after_kw = first_char + 7;
-      const size_t quote_open = line.find_first_not_of(" ", after_kw);
-      if (quote_open != std::string::npos && line[quote_open] == '"') {
-        auto quote_close = line.find('"', quote_open + 1);
-        if (quote_close == std::string::npos) {
-          std::stringstream msg;
-          msg << "Malformed include statement at line " << line_num;
-          fatal(msg);
-        }
-        std::string inc_path = line.substr(quote_open + 1, quote_close - quote_open - 1);
-        if (inc_path.empty()) {
-          std::stringstream msg;
-          msg << "Empty filename in include statement at line " << line_num;
-          fatal(msg);
-        }
-        std::filesystem::path resolved(inc_path);
-        if (resolved.is_relative() && !base_dir.empty()) {
-          resolved = std::filesystem::path(base_dir) / resolved;
-        }
-        std::error_code ec;
-        auto canonical = std::filesystem::canonical(resolved, ec);
-        if (ec) {
-          std::stringstream msg;
-          msg << "Cannot resolve include file '" << inc_path << "' at line " << line_num;
-          fatal(msg);
-        }
-        const std::string canonical_str = canonical.string();
-        if (include_stack.count(canonical_str)) {
-          std::stringstream msg;
-          msg << "Circular include detected: '" << inc_path << "' at line " << line_num;
-          fatal(msg);
-        }
-        std::ifstream inc_stream(canonical_str);
-        if (!inc_stream.is_open()) {
-          std::stringstream msg;
-          msg << "Cannot open include file '" << inc_path << "' at line " << line_num;
-          fatal(msg);
-        }
-        include_stack.insert(canonical_str);
-        const std::string inc_base_dir = canonical.parent_path().string();
-        CompileStream(inc_stream, meta, inc_base_dir, include_stack, locals, curr_suit,
-                      prev_suit);
-        include_stack.erase(canonical_str);
-        continue;
+namespace {
+// first word of a statement, e.g. "for" in "for i in 0..4:"
+std::string_view Keyword(std::string_view line) {
+  auto first = line.find_first_not_of(" ");
+  if (first == std::string_view::npos) return {};
+  auto last = line.find_first_of(" (:", first);
+  return line.substr(first, (last == std::string_view::npos) ? std::string_view::npos
+                                                              : last - first);
+}
+bool IsBlockHeader(std::string_view line) {
+  const auto keyword = Keyword(line);
+  if (keyword != "for" && keyword != "template" && keyword != "if") return false;
+  auto last = line.find_last_not_of(" ");
+  // conditions may compare with ==, loops and templates never contain '='
+  return line[last] == ':' &&
+         (keyword == "if" || line.find('=') == std::string_view::npos);
+}
+// line is word once whitespace is removed
+bool IsWord(std::string_view line, std::string_view word) {
+  std::size_t matched = 0;
+  for (const char c : line) {
+    if (std::isspace(static_cast<unsigned char>(c))) continue;
+    if (matched == word.size() || c != word[matched]) return false;
+    matched++;
+  }
+  return matched == word.size();
+}
+bool IsElse(std::string_view line) { return IsWord(line, "else:"); }
+bool IsExpand(std::string_view line) {
+  if (Keyword(line) != "expand") return false;
+  auto next = line.find_first_not_of(" ", line.find("expand") + 6);
+  return next != std::string_view::npos &&
+         (std::isalpha(line[next]) || line[next] == '_');
+}
+bool IsBlockEnd(std::string_view line) { return IsWord(line, "end"); }
+// Replace every {name} placeholder in text
+std::string Substitute(std::string text, const std::map<std::string, std::string> &subs) {
+  if (subs.empty() || text.find('{') == std::string::npos) return text;
+  for (const auto &[name, value] : subs) {
+    const std::string key = "{" + name + "}";
+    for (auto pos = text.find(key); pos != std::string::npos;
+         pos = text.find(key, pos + value.size())) {
+      text.replace(pos, key.size(), value);
+    }
+  }
+  return text;
+}
+// Split "a, f(b, c), d" on the top level commas
+std::vector<std::string> SplitArguments(const std::string &args) {
+  std::vector<std::string> out;
+  std::string current;
+  bool in_quotes = false;
+  int depth = 0;
+  for (char c : args) {
+    if (c == '"') in_quotes = !in_quotes;
+    if (!in_quotes && (c == '(' || c == '[')) depth++;
+    if (!in_quotes && (c == ')' || c == ']')) depth--;
+    if (c == ',' && !in_quotes && depth == 0) {
+      RemoveLeadingWhitespace(current);
+      RemoveTrailingWhitespace(current);
+      out.push_back(current);
+      current.clear();
+    } else {
+      current += c;
+    }
+  }
+  RemoveLeadingWhitespace(current);
+  RemoveTrailingWhitespace(current);
+  if (!current.empty() || !out.empty()) out.push_back(current);
+  return out;
+}
+// Split "name(a, b)" into name and arguments
+std::pair<std::string, std::vector<std::string>> SplitCall(std::string call,
+                                                           const int line_num) {
+  auto open = call.find('(');
+  auto close = call.find_last_of(')');
+  if (open == std::string::npos || close == std::string::npos || close < open) {
+    std::stringstream msg;
+    msg << "Expected name(arguments) at line " << line_num;
+    fatal(msg);
+  }
+  std::string name = call.substr(0, open);
+  RemoveWhitespace(name);
+  EmptyCheck(name, line_num);
+  return {name, SplitArguments(call.substr(open + 1, close - open - 1))};
+}
+long long AsInteger(const pips::Value &value, const std::string &expr, const int line_num) {
+  // range first: casting NaN, inf or a value outside long long is undefined
+  constexpr double kTwo63 = 9223372036854775808.0;
+  if (value.type != pips::ValueType::NUMBER || !(value.as.number >= -kTwo63) ||
+      !(value.as.number < kTwo63) || value.as.number != std::trunc(value.as.number)) {
+    std::stringstream msg;
+    msg << "Expected an integer for '" << expr << "' at line " << line_num;
+    fatal(msg);
+  }
+  return static_cast<long long>(value.as.number);
+}
+// A number, bool or plain quoted string: cards set to one have no expression to replay
+bool IsLiteral(std::string_view value) {
+  while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+  while (!value.empty() && value.back() == ' ') value.remove_suffix(1);
+  double number = 0.0;
+  if (ParseNumber(value.data(), value.data() + value.size(), number)) return true;
+  if (value == "true" || value == "false") return true;
+  return value.size() >= 2 && value.front() == '"' &&
+         value.find('"', 1) == value.size() - 1;
+}
+// "name ~ dist(" with a known distribution; any other '~' is the pips bitwise not
+bool IsSamplingDeclaration(std::string_view line, std::size_t tilde) {
+  auto is_word = [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  };
+  auto skip_space = [&](std::size_t pos) {
+    while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos]))) {
+      pos++;
+    }
+    return pos;
+  };
+  auto name = skip_space(0);
+  if (name == tilde || std::isdigit(static_cast<unsigned char>(line[name]))) return false;
+  auto pos = name;
+  while (pos < tilde && is_word(line[pos])) pos++;
+  if (skip_space(pos) != tilde) return false;
+  const auto dist = skip_space(tilde + 1);
+  pos = dist;
+  while (pos < line.size() && is_word(line[pos])) pos++;
+  const auto dist_name = line.substr(dist, pos - dist);
+  if (dist_name != "uniform" && dist_name != "loguniform" && dist_name != "normal") {
+    return false;
+  }
+  pos = skip_space(pos);
+  return pos < line.size() && line[pos] == '(';
+}
+bool AsCondition(const pips::Value &value, const std::string &expr, const int line_num) {
+  if (value.type != pips::ValueType::BOOL) {
+    std::stringstream msg;
+    msg << "Expected a boolean condition for '" << expr << "' at line " << line_num;
+    fatal(msg);
+  }
+  return value.as.boolean;
+}
+} // namespace
+
+void Deck::CompileStatement(const Statement &stmt, CompileContext &ctx,
+                            const std::string &base_dir, std::string &comment,
+                            std::optional<StatementBlock> &block) {
+  // collecting the body of a for loop, template or if block
+  if (block) {
+    if (IsBlockHeader(stmt.text)) {
+      block->depth++;
+    } else if (IsBlockEnd(stmt.text)) {
+      if (block->depth == 0) {
+        const StatementBlock done = std::move(*block);
+        block.reset();
+        if (!done.disabled) ExpandBlock(done, ctx, base_dir, comment);
+        return;
+      }
+      block->depth--;
+    } else if (block->is_if && block->depth == 0 && IsElse(stmt.text)) {
+      if (block->in_else) {
+        std::stringstream msg;
+        msg << "Duplicate 'else' at line " << stmt.line_num;
+        fatal(msg);
       }
-    } // include statement
+      block->in_else = true;
+      return;
+    }
+    if (block->Keeps()) {
+      block->body.push_back({std::string(stmt.text), stmt.line_num, stmt.sets_comment,
+                             std::string(stmt.comment)});
+    }
+    return;
+  }
+  if (IsBlockHeader(stmt.text)) {
+    block = StatementBlock{std::string(stmt.text), stmt.line_num};
+    // nothing in a disabled suit is evaluated, including conditions and loop bounds
+    block->disabled = ctx.suit_disabled;
+    block->is_if = Keyword(stmt.text) == "if";
+    if (block->is_if && !block->disabled) {
+      // the condition picks the branch to keep while the body is scanned
+      const auto header = stmt.text.substr(stmt.text.find_first_not_of(" "));
+      const std::string condition(header.substr(2, header.find_last_of(':') - 2));
+      block->condition =
+          AsCondition(EvalExpression(condition, ctx, stmt.line_num), condition,
+                      stmt.line_num);
+    }
+    return;
+  }
+  if (IsBlockEnd(stmt.text)) {
+    std::stringstream msg;
+    msg << "'end' without a matching for, if or template at line " << stmt.line_num;
+    fatal(msg);
+  }
+  if (IsElse(stmt.text)) {
+    std::stringstream msg;
+    msg << "'else' without a matching if at line " << stmt.line_num;
+    fatal(msg);
+  }
+  // Suit headers may carry a condition, <suit if cond>. A disabled suit and its
+  // relative children are skipped until the next enabled suit header.
+  const auto first_char = stmt.text.find_first_not_of(" ");
+  if (stmt.text[first_char] == '<') {
+    std::string_view header = stmt.text;
+    auto name_start = header.find_first_not_of(" ", first_char + 1);
+    const bool relative = (name_start != std::string_view::npos) &&
+                          (header.compare(name_start, 2, "..") == 0);
+    auto cond_pos = header.find(" if ");
+    std::string condition;
+    std::string unconditional; // the header without its condition
+    if (cond_pos != std::string_view::npos) {
+      auto close = header.find_last_of('>');
+      if (close == std::string_view::npos || close < cond_pos) {
+        std::stringstream msg;
+        msg << "Missing '>' in suit declaration at line " << stmt.line_num;
+        fatal(msg);
+      }
+      condition.assign(header.substr(cond_pos + 4, close - cond_pos - 4));
+      unconditional.assign(header.substr(0, cond_pos)).append(header.substr(close));
+      header = unconditional;
+    }
+    if (relative && ctx.absolute_disabled) {
+      ctx.suit_disabled = true;
+    } else {
+      ctx.suit_disabled =
+          !condition.empty() &&
+          !AsCondition(EvalExpression(condition, ctx, stmt.line_num), condition,
+                       stmt.line_num);
+      if (!relative) ctx.absolute_disabled = ctx.suit_disabled;
+    }
+    if (ctx.suit_disabled) return;
+    if (stmt.sets_comment) comment = stmt.comment;
+    ProcessStatement(header, stmt.line_num, ctx, base_dir, comment);
+    return;
+  }
+  if (ctx.suit_disabled) return;
+  if (stmt.sets_comment) comment = stmt.comment;
+  if (IsExpand(stmt.text)) {
+    auto first_char = stmt.text.find_first_not_of(" ");
+    auto [name, args] =
+        SplitCall(std::string(stmt.text.substr(first_char + 6)), stmt.line_num);
+    auto it = ctx.templates.find(name);
+    if (it == ctx.templates.end()) {
+      std::stringstream msg;
+      msg << "Unknown template '" << name << "' at line " << stmt.line_num;
+      fatal(msg);
+    }
+    if (args.size() != it->second.params.size()) {
+      std::stringstream msg;
+      msg << "Template '" << name << "' expects " << it->second.params.size()
+          << " arguments at line " << stmt.line_num;
+      fatal(msg);
+    }
+    std::map<std::string, std::string> subs;
+    for (std::size_t i = 0; i < args.size(); i++) {
+      subs[it->second.params[i]] = args[i];
+    }
+    CompileStatements(it->second.body, subs, ctx, base_dir, comment);
+    return;
+  }
+  ProcessStatement(stmt.text, stmt.line_num, ctx, base_dir, comment);
+}
 
-    // start of a new suit
-    // TODO define the start and end characters in cmake
-    if (line.compare(first_char, 1, "<") == 0) {
-      auto last_char = line.find_first_of(">");
-      if (last_char == std::string::npos) {
+void Deck::CompileStatements(const std::vector<StoredStatement> &body,
+                             const std::map<std::string, std::string> &subs,
+                             CompileContext &ctx, const std::string &base_dir,
+                             std::string &comment) {
+  std::optional<StatementBlock> block;
+  for (const auto &stmt : body) {
+    if (subs.empty()) {
+      CompileStatement({stmt.text, stmt.line_num, stmt.sets_comment, stmt.comment}, ctx,
+                       base_dir, comment, block);
+      continue;
+    }
+    const auto text = Substitute(stmt.text, subs);
+    const auto stmt_comment = Substitute(stmt.comment, subs);
+    CompileStatement({text, stmt.line_num, stmt.sets_comment, stmt_comment}, ctx,
+                     base_dir, comment, block);
+  }
+  if (block) {
+    std::stringstream msg;
+    msg << "Missing 'end' for the block starting at line " << block->line_num;
+    fatal(msg);
+  }
+}
+
+void Deck::ExpandBlock(const StatementBlock &block, CompileContext &ctx,
+                       const std::string &base_dir, std::string &comment) {
+  auto header = block.header.substr(block.header.find_first_not_of(" "));
+  header = header.substr(0, header.find_last_of(':'));
+  if (block.is_if) {
+    // if cond: ... [else: ...] end; the body holds only the selected branch
+    CompileStatements(block.body, {}, ctx, base_dir, comment);
+    return;
+  }
+  if (Keyword(header) == "template") {
+    // template name(a, b): ... end
+    auto [name, params] = SplitCall(header.substr(8), block.line_num);
+    if (ctx.templates.count(name)) {
+      std::stringstream msg;
+      msg << "Template '" << name << "' is already defined at line " << block.line_num;
+      fatal(msg);
+    }
+    ctx.templates[name] = {params, block.body};
+    return;
+  }
+  // for i in A..B: ... end
+  std::stringstream hs(header.substr(3));
+  std::string var, in_kw;
+  hs >> var >> in_kw;
+  std::string range;
+  std::getline(hs, range);
+  const auto dots = range.find("..");
+  if (var.empty() || in_kw != "in" || dots == std::string::npos) {
+    std::stringstream msg;
+    msg << "Malformed for loop '" << block.header << "' at line " << block.line_num
+        << "\nExpected 'for i in A..B:'";
+    fatal(msg);
+  }
+  const auto first_expr = range.substr(0, dots);
+  const auto last_expr = range.substr(dots + 2);
+  const auto first = AsInteger(EvalExpression(first_expr, ctx, block.line_num),
+                               first_expr, block.line_num);
+  const auto last = AsInteger(EvalExpression(last_expr, ctx, block.line_num),
+                              last_expr, block.line_num);
+  std::map<std::string, std::string> subs;
+  for (auto i = first; i < last; i++) {
+    subs[var] = std::to_string(i);
+    CompileStatements(block.body, subs, ctx, base_dir, comment);
+  }
+}
+
+pips::InterpretResult Deck::Interpret(const char *source, pips::VTable &locals) {
+  RUMMY_PROBE1(interpret__entry, source);
+  const auto result = vm.interpret(source, '\n', locals);
+  RUMMY_PROBE1(interpret__exit, static_cast<int>(result));
+  return result;
+}
+pips::InterpretResult Deck::Interpret(const char *source) {
+  RUMMY_PROBE1(interpret__entry, source);
+  const auto result = vm.interpret(source, '\n');
+  RUMMY_PROBE1(interpret__exit, static_cast<int>(result));
+  return result;
+}
+
+void Deck::ProcessSampling(std::string_view line, std::size_t tilde, const int line_num,
+                           CompileContext &ctx, const std::string &base_dir,
+                           std::string &comment) {
+  std::string card_name(line.substr(0, tilde));
+  RemoveWhitespace(card_name);
+  EmptyCheck(card_name, line_num);
+  std::string spec(line.substr(tilde + 1));
+  RemoveLeadingWhitespace(spec);
+  RemoveTrailingWhitespace(spec);
+  const auto open = spec.find('(');
+  auto malformed = [&]() {
+    std::stringstream msg;
+    msg << "Malformed sampling declaration '" << line << "' at line " << line_num
+        << "; expected e.g. 'rho ~ uniform(0.9, 1.1)'";
+    fatal(msg);
+  };
+  if (open == std::string::npos || spec.back() != ')') malformed();
+  std::string dist_name = spec.substr(0, open);
+  RemoveWhitespace(dist_name);
+  // arguments are expressions, split at the top level commas
+  std::vector<double> args;
+  int depth = 0;
+  std::size_t arg_start = open + 1;
+  for (std::size_t i = open + 1; i < spec.size(); i++) {
+    if (spec[i] == '(') depth++;
+    if ((spec[i] == ',' && depth == 0) || (spec[i] == ')' && depth-- == 0)) {
+      const auto expr = spec.substr(arg_start, i - arg_start);
+      const auto value = EvalExpression(expr, ctx, line_num);
+      if (value.type != pips::ValueType::NUMBER) malformed();
+      args.push_back(value.as.number);
+      arg_start = i + 1;
+    }
+  }
+  if (args.size() != 2) malformed();
+
+  SampledCard sample;
+  sample.a = args[0];
+  sample.b = args[1];
+  sample.line_num = line_num;
+  if (dist_name == "uniform") {
+    sample.dist = Distribution::UNIFORM;
+  } else if (dist_name == "loguniform") {
+    sample.dist = Distribution::LOGUNIFORM;
+  } else if (dist_name == "normal") {
+    sample.dist = Distribution::NORMAL;
+  } else {
+    std::stringstream msg;
+    msg << "Unknown distribution '" << dist_name << "' at line " << line_num
+        << " (uniform, loguniform or normal)";
+    fatal(msg);
+  }
+  const bool valid = (sample.dist == Distribution::NORMAL)
+                         ? sample.b > 0.0
+                         : sample.a < sample.b &&
+                               (sample.dist == Distribution::UNIFORM || sample.a > 0.0);
+  if (!valid) {
+    std::stringstream msg;
+    msg << "Invalid parameters for " << dist_name << "(" << sample.a << ", " << sample.b
+        << ") at line " << line_num;
+    fatal(msg);
+  }
+  // the suit the card lands in, as for "name = value"
+  const auto dot = card_name.find_last_of('.');
+  if (dot != std::string::npos) {
+    sample.suit = card_name.substr(0, dot);
+    std::replace(sample.suit.begin(), sample.suit.end(), '.', '/');
+    sample.name = card_name.substr(dot + 1);
+  } else {
+    sample.suit = ctx.curr_suit.empty() ? "/" : ctx.curr_suit;
+    sample.name = card_name;
+  }
+
+  std::stringstream card;
+  card << card_name << " = " << std::setprecision(17) << sample.Nominal();
+  ProcessStatement(card.str(), line_num, ctx, base_dir, comment);
+  auto same_card = [&](const SampledCard &s) {
+    return s.suit == sample.suit && s.name == sample.name;
+  };
+  sampled.erase(std::remove_if(sampled.begin(), sampled.end(), same_card), sampled.end());
+  sampled.push_back(std::move(sample));
+}
+
+pips::Value Deck::EvalExpression(const std::string &expr, CompileContext &ctx,
+                                 const int line_num) {
+  const std::string line = std::string("var ") + kEvalName + " = " + expr;
+  if (Interpret(line.c_str(), ctx.locals) != pips::InterpretResult::OK) {
+    std::stringstream msg;
+    msg << "Failed to evaluate '" << expr << "' at line " << line_num;
+    fatal(msg);
+  }
+  // cards read here shape the deck, so changing them later needs a new Build
+  std::string prefix = (ctx.curr_suit == "/") ? "" : ctx.curr_suit;
+  std::replace(prefix.begin(), prefix.end(), '/', '.');
+  if (!prefix.empty()) prefix += '.';
+  for (auto &name : Expression::References(expr)) {
+    // names of the current suit's cards resolve against the suit first
+    if (ctx.locals.find(name) != ctx.locals.end()) name.insert(0, prefix);
+    if (vm.globals.find(name) != vm.globals.end()) build_inputs.insert(std::move(name));
+  }
+  return vm.globals[kEvalName];
+}
+
+
+void Deck::ProcessStatement(std::string_view line, const int line_num,
+                            CompileContext &ctx, const std::string &base_dir,
+                            std::string &comment) {
+  // temporaries of this statement come from a stack arena released on return
+  std::array<std::byte, 2048> scratch_buffer;
+  std::pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+  const auto first_char = line.find_first_not_of(" ");
+
+  // include statement
+  if (line.compare(first_char, 7, "include") == 0) {
+    const size_t after_kw = first_char + 7;
+    const size_t quote_open = line.find_first_not_of(" ", after_kw);
+    if (quote_open != std::string::npos && line[quote_open] == '"') {
+      auto quote_close = line.find('"', quote_open + 1);
+      if (quote_close == std::string::npos) {
+        std::stringstream msg;
+        msg << "Malformed include statement at line " << line_num;
+        fatal(msg);
+      }
+      std::string inc_path(line.substr(quote_open + 1, quote_close - quote_open - 1));
+      if (inc_path.empty()) {
+        std::stringstream msg;
+        msg << "Empty filename in include statement at line " << line_num;
+        fatal(msg);
+      }
+      std::filesystem::path resolved(inc_path);
+      if (resolved.is_relative() && !base_dir.empty()) {
+        resolved = std::filesystem::path(base_dir) / resolved;
+      }
+      std::error_code ec;
+      auto canonical = std::filesystem::canonical(resolved, ec);
+      if (ec) {
+        std::stringstream msg;
+        msg << "Cannot resolve include file '" << inc_path << "' at line " << line_num;
+        fatal(msg);
+      }
+      const std::string canonical_str = canonical.string();
+      if (ctx.include_stack.count(canonical_str)) {
+        std::stringstream msg;
+        msg << "Circular include detected: '" << inc_path << "' at line " << line_num;
+        fatal(msg);
+      }
+      std::ifstream inc_stream(canonical_str);
+      if (!inc_stream.is_open()) {
         std::stringstream msg;
-        msg << "Missing '>' in suit declaration at line " << line_num;
+        msg << "Cannot open include file '" << inc_path << "' at line " << line_num;
         fatal(msg);
       }
-      std::string suit_name = line.substr(first_char + 1, last_char - first_char - 1);
-      RemoveWhitespace(suit_name);
-      if (suit_name.empty()) {
+      ctx.include_stack.insert(canonical_str);
+      const std::string inc_base_dir = canonical.parent_path().string();
+      RUMMY_PROBE1(include__open, canonical_str.c_str());
+      CompileStream(inc_stream, ctx, inc_base_dir);
+      RUMMY_PROBE1(include__close, canonical_str.c_str());
+      ctx.include_stack.erase(canonical_str);
+      return;
+    }
+  } // include statement
+
+  // start of a new suit
+  // TODO define the start and end characters in cmake
+  if (line.compare(first_char, 1, "<") == 0) {
+    auto last_char = line.find_first_of(">");
+    if (last_char == std::string::npos) {
+      std::stringstream msg;
+      msg << "Missing '>' in suit declaration at line " << line_num;
+      fatal(msg);
+    }
+    std::string suit_name(line.substr(first_char + 1, last_char - first_char - 1));
+    RemoveWhitespace(suit_name);
+    // suit inheritance: <child : parent>
+    std::string parent_name;
+    auto colon = suit_name.find(':');
+    if (colon != std::string::npos) {
+      parent_name = suit_name.substr(colon + 1);
+      suit_name = suit_name.substr(0, colon);
+      if (parent_name.empty()) {
         std::stringstream msg;
-        msg << "Empty suit name at line " << line_num;
+        msg << "Empty parent suit name at line " << line_num;
         fatal(msg);
-      } else if (suit_name.compare(0, 2, "..") == 0) {
-        // replace .. with current suit name
-        // don't update previous suit
-        if (prev_suit.empty()) {
+      }
+      if (parent_name.compare(0, 2, "..") == 0) {
+        if (ctx.prev_suit.empty()) {
           std::stringstream msg;
           msg << "Cannot use '..' in suit name at line " << line_num;
           fatal(msg);
         }
-        suit_name = prev_suit + suit_name.substr(2);
-        curr_suit = suit_name;
-      } else {
-        curr_suit = suit_name;
-        prev_suit = curr_suit;
+        parent_name = ctx.prev_suit + parent_name.substr(2);
       }
-      if (deck.find(curr_suit) == deck.end()) {
-        deck[curr_suit] = std::map<std::string, Card>();
-        suits.push_back(curr_suit);
-        card_map[curr_suit] = std::vector<std::string>();
+    }
+    if (!ctx.curr_suit.empty()) RUMMY_PROBE1(suit__end, ctx.curr_suit.c_str());
+    if (suit_name.empty()) {
+      std::stringstream msg;
+      msg << "Empty suit name at line " << line_num;
+      fatal(msg);
+    } else if (suit_name.compare(0, 2, "..") == 0) {
+      // replace .. with current suit name
+      // don't update previous suit
+      if (ctx.prev_suit.empty()) {
+        std::stringstream msg;
+        msg << "Cannot use '..' in suit name at line " << line_num;
+        fatal(msg);
       }
-      locals.clear();
-      continue;
+      suit_name = ctx.prev_suit + suit_name.substr(2);
+      ctx.curr_suit = suit_name;
+    } else {
+      ctx.curr_suit = suit_name;
+      ctx.prev_suit = ctx.curr_suit;
+    }
+    if (deck.find(ctx.curr_suit) == deck.end()) {
+      deck[ctx.curr_suit] = std::map<std::string, Card>();
+      suits.push_back(ctx.curr_suit);
+      card_map[ctx.curr_suit] = std::vector<std::string>();
     }
+    ctx.locals.clear();
+    RUMMY_PROBE1(suit__begin, ctx.curr_suit.c_str());
+    if (!parent_name.empty()) {
+      InheritSuit(ctx.curr_suit, parent_name, ctx.locals, line_num);
+    }
+    return;
+  }
 
-    // Actual card line
-    // split the line into card = val
-    // Find the first '=' that is not inside a quoted string
-    auto eq_char = std::string::npos;
-    {
-      bool in_quotes = false;
-      for (size_t i = first_char; i < line.size(); ++i) {
-        if (line[i] == '"')
-          in_quotes = !in_quotes;
-        else if (!in_quotes && line[i] == '=') {
-          eq_char = i;
-          break;
-        }
+  // Actual card line
+  // split the line into card = val
+  // Find the first '=' that is not inside a quoted string
+  auto eq_char = std::string::npos;
+  {
+    bool in_quotes = false;
+    for (size_t i = first_char; i < line.size(); ++i) {
+      if (line[i] == '"')
+        in_quotes = !in_quotes;
+      else if (!in_quotes && line[i] == '=') {
+        eq_char = i;
+        break;
       }
     }
-    if (eq_char == std::string::npos) {
-      // this is a pips statement
-      if (vm.interpret(line.c_str(), '\n', locals) != pips::InterpretResult::OK) {
-        std::stringstream msg;
-        msg << "Failed to compile expression '" << line << "' at line " << line_num;
-        msg << "\nPossibly missing '=' in card declaration.";
-        fatal(msg);
+  }
+  if (eq_char == std::string::npos) {
+    const auto tilde = line.find('~', first_char);
+    if (tilde != std::string::npos && IsSamplingDeclaration(line, tilde)) {
+      ProcessSampling(line, tilde, line_num, ctx, base_dir, comment);
+      return;
+    }
+    // this is a pips statement
+    const std::string source(line);
+    if (Interpret(source.c_str(), ctx.locals) != pips::InterpretResult::OK) {
+      std::stringstream msg;
+      msg << "Failed to compile expression '" << line << "' at line " << line_num;
+      msg << "\nPossibly missing '=' in card declaration.";
+      fatal(msg);
+    }
+    return;
+  }
+
+  const auto statement = line;
+  std::pmr::string local_name(statement.substr(first_char, eq_char - first_char),
+                              &scratch);
+  // remove whitespace from local_name
+  RemoveWhitespace(local_name);
+  EmptyCheck(local_name, line_num);
+
+  // add card name to suit list
+  // Strip any [...] suffix so that slice assignments like v[:3] are stored
+  // under the base name "v", matching the individual element cards v[0], v[1], ...
+  // Globals have an empty curr_suit but are stored under "/" in the deck.
+
+  std::pmr::string card_value(statement.substr(eq_char + 1), &scratch);
+  EmptyCheck(card_value, line_num);
+  // Trim leading/trailing whitespace only — preserve internal spacing
+  card_value.erase(0, card_value.find_first_not_of(" \t\r\n"));
+  card_value.erase(card_value.find_last_not_of(" \t\r\n") + 1);
+  // unit annotated literals are folded into numbers in the target unit system
+  std::pmr::vector<std::optional<Dimension>> card_dims(&scratch);
+  if (!dimensions.empty() || HasUnitAnnotation(card_value)) {
+    std::pmr::string prefix(ctx.curr_suit, &scratch);
+    std::replace(prefix.begin(), prefix.end(), '/', '.');
+    std::pmr::string qualified(&scratch);
+    auto lookup = [&](std::string_view name) -> std::optional<Dimension> {
+      auto it = dimensions.end();
+      if (!prefix.empty()) {
+        qualified.assign(prefix).append(1, '.').append(name);
+        it = dimensions.find(std::string_view(qualified));
       }
-      continue;
+      if (it == dimensions.end()) it = dimensions.find(name);
+      if (it == dimensions.end()) return std::nullopt;
+      return it->second;
+    };
+    auto converted = ConvertUnits(card_value, UnitSystem(line_num), lookup, line_num,
+                                  &scratch);
+    card_value.swap(converted.expr);
+    card_dims.swap(converted.dims);
+  }
+  // the known dimension of a card; keys are only allocated for new entries
+  auto set_dimension = [&](std::string_view name, const std::optional<Dimension> &dim) {
+    auto it = dimensions.find(name);
+    if (it == dimensions.end()) {
+      if (dim) dimensions.emplace(name, *dim);
+    } else if (dim) {
+      it->second = *dim;
+    } else {
+      dimensions.erase(it);
     }
+  };
+  // Strip whitespace only from the parts outside quoted strings for the
+  // string-value case; the raw card_value is kept for expressions.
+  std::pmr::string card_value_stripped(card_value, &scratch);
+  RemoveWhitespacePreserveQuotes(card_value_stripped, line_num);
+  EmptyCheck(card_value, line_num);
+  std::pmr::string global_name(&scratch);
+  std::pmr::string name_prefix(&scratch);
+  if (ctx.curr_suit.empty()) {
+    // no suit, use local name as global name
+    global_name = local_name;
 
-    std::string local_name = line.substr(first_char, eq_char - first_char);
-    // remove whitespace from local_name
-    RemoveWhitespace(local_name);
-    EmptyCheck(local_name, line_num);
-
-    // add card name to suit list
-    // Strip any [...] suffix so that slice assignments like v[:3] are stored
-    // under the base name "v", matching the individual element cards v[0], v[1], ...
-    // Globals have an empty curr_suit but are stored under "/" in the deck.
-
-    std::string card_value = line.substr(eq_char + 1);
-    EmptyCheck(card_value, line_num);
-    // Trim leading/trailing whitespace only — preserve internal spacing
-    card_value.erase(0, card_value.find_first_not_of(" \t\r\n"));
-    card_value.erase(card_value.find_last_not_of(" \t\r\n") + 1);
-    // Strip whitespace only from the parts outside quoted strings for the
-    // string-value case; the raw card_value is kept for expressions.
-    std::string card_value_stripped = card_value;
-    RemoveWhitespacePreserveQuotes(card_value_stripped, line_num);
-    EmptyCheck(card_value, line_num);
-    std::string global_name;
-    std::string name_prefix;
-    if (curr_suit.empty()) {
-      // no suit, use local name as global name
+    // standalone variable but need to identify suit
+    if (local_name.find('.') != std::string::npos) {
+      auto dot_pos = local_name.find_last_of('.');
+      ctx.curr_suit.assign(local_name, 0, dot_pos);
+      local_name.erase(0, dot_pos + 1);
+      std::replace(ctx.curr_suit.begin(), ctx.curr_suit.end(), '.', '/');
+      name_prefix = Concat(&scratch, {ctx.curr_suit, "."});
+      if (deck.find(ctx.curr_suit) == deck.end()) {
+        deck[ctx.curr_suit] = std::map<std::string, Card>();
+        suits.push_back(ctx.curr_suit);
+        card_map[ctx.curr_suit] = std::vector<std::string>();
+      }
+    }
+  } else {
+    // standalone variable needs to reset curr_suit
+    if (local_name.find('.') != std::string::npos) {
       global_name = local_name;
-
-      // standalone variable but need to identify suit
-      if (local_name.find('.') != std::string::npos) {
-        auto dot_pos = local_name.find_last_of('.');
-        std::string suit_name = local_name.substr(0, dot_pos);
-        local_name = local_name.substr(dot_pos + 1, std::string::npos);
-        std::replace(suit_name.begin(), suit_name.end(), '.', '/');
-        curr_suit = suit_name;
-        name_prefix = suit_name + ".";
-        if (deck.find(curr_suit) == deck.end()) {
-          deck[curr_suit] = std::map<std::string, Card>();
-          suits.push_back(curr_suit);
-          card_map[curr_suit] = std::vector<std::string>();
-        }
+      auto dot_pos = local_name.find_last_of('.');
+      name_prefix.assign(local_name, 0, dot_pos + 1);
+      ctx.curr_suit.assign(local_name, 0, dot_pos);
+      local_name.erase(0, dot_pos + 1);
+      std::replace(ctx.curr_suit.begin(), ctx.curr_suit.end(), '.', '/');
+      if (deck.find(ctx.curr_suit) == deck.end()) {
+        deck[ctx.curr_suit] = std::map<std::string, Card>();
+        suits.push_back(ctx.curr_suit);
+        card_map[ctx.curr_suit] = std::vector<std::string>();
       }
     } else {
-      // standalone variable needs to reset curr_suit
-      if (local_name.find('.') != std::string::npos) {
-        global_name = local_name;
-        auto dot_pos = local_name.find_last_of('.');
-        std::string suit_name = local_name.substr(0, dot_pos);
-        local_name = local_name.substr(dot_pos + 1, std::string::npos);
-        name_prefix = suit_name + ".";
-        std::replace(suit_name.begin(), suit_name.end(), '.', '/');
-        curr_suit = suit_name;
-        if (deck.find(curr_suit) == deck.end()) {
-          deck[curr_suit] = std::map<std::string, Card>();
-          suits.push_back(curr_suit);
-          card_map[curr_suit] = std::vector<std::string>();
+      // use suit name as prefix
+      name_prefix = Concat(&scratch, {ctx.curr_suit, "."});
+      std::replace(name_prefix.begin(), name_prefix.end(), '/', '.');
+      global_name = Concat(&scratch, {name_prefix, local_name});
+    }
+  }
+
+  // dotted suit that unqualified names in the expression resolve against
+  std::string_view source_prefix(name_prefix);
+  if (!source_prefix.empty()) source_prefix.remove_suffix(1);
+  // number of elements of a vector visible from this statement, -1 if there is none
+  auto vector_length = [&](std::string_view vec_name) -> long {
+    std::string element;
+    auto exists = [&](long n) {
+      element.assign(vec_name).append("[").append(std::to_string(n)).append("]");
+      return ctx.locals.find(element) != ctx.locals.end() ||
+             vm.globals.find(element) != vm.globals.end() ||
+             vm.globals.find(element.insert(0, name_prefix)) != vm.globals.end();
+    };
+    long n = 0;
+    while (exists(n)) {
+      n++;
+    }
+    return (n > 0) ? n : -1;
+  };
+
+  // Variable updates
+  {
+    auto lb = local_name.find('[');
+    bool is_dotted = (local_name.find('.') != std::string::npos);
+    bool is_slice = is_dotted && (lb != std::string::npos) &&
+                    (local_name.find(':', lb) != std::string::npos);
+    bool is_dotted_update =
+        is_dotted &&
+        (vm.globals.find(local_name.c_str()) != vm.globals.end() ||
+         (is_slice &&
+          vm.globals.find(Concat(&scratch, {std::string_view(local_name).substr(0, lb),
+                                            "[0]"})
+                              .c_str()) != vm.globals.end()));
+    if (is_dotted_update) {
+      if (is_slice) {
+        auto expanded_values =
+            SplitString(card_value_stripped, line_num, -1, vector_length, &scratch);
+        auto expanded_names = SplitString(local_name, line_num, expanded_values.size(),
+                                          vector_length, &scratch);
+        if (expanded_names.size() > expanded_values.size()) {
+          std::stringstream msg;
+          msg << "More slice targets than values in dotted assignment at line "
+              << line_num;
+          fatal(msg);
         }
-      } else {
-        std::string suit_card_name = curr_suit;
-        std::replace(suit_card_name.begin(), suit_card_name.end(), '/', '.');
-        // use suit name as prefix
-        name_prefix = suit_card_name + ".";
-        global_name = name_prefix + local_name;
-      }
-    }
-
-    // Variable updates
-    {
-      auto lb = local_name.find('[');
-      bool is_dotted = (local_name.find('.') != std::string::npos);
-      bool is_slice = is_dotted && (lb != std::string::npos) &&
-                      (local_name.find(':', lb) != std::string::npos);
-      std::string slice_base = is_slice ? local_name.substr(0, lb) : "";
-      bool is_dotted_update =
-          is_dotted &&
-          (vm.globals.find(local_name) != vm.globals.end() ||
-           (is_slice && vm.globals.find(slice_base + "[0]") != vm.globals.end()));
-      if (is_dotted_update) {
-        if (is_slice) {
-          auto expanded_names = SplitString(local_name, line_num);
-          auto expanded_values = SplitString(card_value_stripped, line_num);
-          if (expanded_names.size() > expanded_values.size()) {
+        for (size_t idx = 0; idx < expanded_names.size(); idx++) {
+          const auto &ename = expanded_names[idx];
+          const auto &evalue = expanded_values[idx];
+          const auto expr = Concat(&scratch, {ename, " = ", evalue});
+          if (Interpret(expr.c_str(), ctx.locals) != pips::InterpretResult::OK) {
             std::stringstream msg;
-            msg << "More slice targets than values in dotted assignment at line "
+            msg << "Failed to compile dotted slice assignment '" << expr << "' at line "
                 << line_num;
             fatal(msg);
           }
-          for (size_t idx = 0; idx < expanded_names.size(); idx++) {
-            const std::string &ename = expanded_names[idx];
-            const std::string &evalue = expanded_values[idx];
-            std::string expr = ename + " = " + evalue;
-            if (vm.interpret(expr.c_str(), '\n', locals) != pips::InterpretResult::OK) {
-              std::stringstream msg;
-              msg << "Failed to compile dotted slice assignment '" << expr << "' at line "
-                  << line_num;
-              fatal(msg);
-            }
-            locals[ename.c_str()] = vm.globals[ename.c_str()];
-            meta[ename.c_str()] = {line_num, comment};
-          }
-          comment.clear();
-          continue;
+          ctx.locals[ename.c_str()] = vm.globals[ename.c_str()];
+          ctx.meta[ename.c_str()] = {line_num, comment};
+          sources.push_back(
+              {std::string(ename), std::string(source_prefix), std::string(evalue)});
         }
-        std::string expr = local_name + " = " + card_value;
-        if (vm.interpret(expr.c_str(), '\n', locals) != pips::InterpretResult::OK) {
+        comment.clear();
+        return;
+      }
+      const auto expr = Concat(&scratch, {local_name, " = ", card_value});
+      if (Interpret(expr.c_str(), ctx.locals) != pips::InterpretResult::OK) {
+        std::stringstream msg;
+        msg << "Failed to compile dotted assignment '" << expr << "' at line "
+            << line_num;
+        fatal(msg);
+      }
+      ctx.locals[local_name.c_str()] = vm.globals[local_name.c_str()];
+      ctx.meta[local_name.c_str()] = {line_num, comment};
+      sources.push_back(
+          {std::string(local_name), std::string(source_prefix), std::string(card_value)});
+      comment.clear();
+      return;
+    }
+  }
+  // Add this card to the card map
+  {
+    auto bracket = local_name.find('[');
+    const auto base_name = std::string_view(local_name).substr(0, bracket);
+    auto &names = card_map[ctx.curr_suit.empty() ? "/" : ctx.curr_suit];
+    if (std::find(names.begin(), names.end(), base_name) == names.end()) {
+      names.emplace_back(base_name);
+    }
+  }
+
+  // Processing the card
+  // Four cases:
+  //  a = 2           # no vector
+  //  a = [1,2,3]     # assign a vector
+  //  a[:2] = [1,2]   # assign a slice of a vector
+  //  a[:2] = b[:2]   # vector operation
+
+  bool lhs_vec = false;
+  bool rhs_vec = false;
+  // check for [] in the local name
+  auto open_bracket = local_name.find_first_of('[');
+  if (open_bracket != std::string::npos) {
+    // we have a vector case
+    auto close_bracket = local_name.find_first_of(']', open_bracket);
+    if (close_bracket == std::string::npos) {
+      std::stringstream msg;
+      msg << "Missing closing ']' in vector declaration at line " << line_num;
+      fatal(msg);
+    }
+    lhs_vec = true;
+  }
+  open_bracket = card_value_stripped.find_first_of('[');
+  if (open_bracket != std::string::npos) {
+    // we have a vector case
+    auto close_bracket = card_value_stripped.find_first_of(']', open_bracket);
+    if (close_bracket == std::string::npos) {
+      std::stringstream msg;
+      msg << "Missing closing ']' in vector declaration at line " << line_num;
+      fatal(msg);
+    }
+    rhs_vec = true;
+  } else {
+    // allow vector without []. Look for comma separated values
+    // a = 1,2,3
+    // but ignore commas inside parentheses (e.g. atan2(a,b)) or quotes
+    if (card_value_stripped.find_first_of(',') != std::string::npos) {
+      auto comma_pos = card_value_stripped.find_first_of(',');
+      while (comma_pos != std::string::npos) {
+        bool in_quotes = false;
+        int paren_depth = 0;
+        for (size_t i = 0; i < comma_pos; i++) {
+          char c = card_value_stripped[i];
+          if (c == '"')
+            in_quotes = !in_quotes;
+          else if (!in_quotes && c == '(')
+            paren_depth++;
+          else if (!in_quotes && c == ')')
+            paren_depth--;
+        }
+        if (!in_quotes && paren_depth == 0) {
+          rhs_vec = true;
+          break;
+        }
+        comma_pos = card_value_stripped.find_first_of(',', comma_pos + 1);
+      }
+    }
+  }
+  const bool has_comma = card_value_stripped.find_first_of(',') != std::string::npos;
+  if (local_name.find_first_of(',') != std::string::npos) {
+    std::stringstream msg;
+    msg << "Cannot have comma in card name at line " << line_num;
+    fatal(msg);
+  }
+
+  // A colon is a slice separator only when it appears inside [...] on the
+  // LHS or RHS. A bare colon (e.g. from a ternary a ? b : c) is not a slice.
+  bool has_colon = (local_name.find_first_of(':') != std::string::npos);
+  if (!has_colon && rhs_vec) {
+    // Only look for a colon if we already know we're in a vector context. The
+    // colon must be in an index bracket (b[1:3]), not a vector literal ([c ? 1 : 2])
+    bool in_quotes = false;
+    bool in_brackets = false;
+    char prev = ' ';
+    for (char c : card_value_stripped) {
+      const char before = prev;
+      prev = c;
+      if (c == '"')
+        in_quotes = !in_quotes;
+      else if (!in_quotes && c == '[')
+        in_brackets = std::isalnum(static_cast<unsigned char>(before)) || before == '_' ||
+                      before == ']' || before == ')';
+      else if (!in_quotes && c == ']')
+        in_brackets = false;
+      else if (!in_quotes && in_brackets && c == ':') {
+        has_colon = true;
+        break;
+      }
+    }
+  }
+  if (!has_colon && ((!lhs_vec && !rhs_vec) || (lhs_vec && !rhs_vec) ||
+                     ((lhs_vec || rhs_vec) && !has_comma))) {
+    // a = 2
+    // a[0] = 2
+    // a = b[0]
+    const auto expr = Concat(&scratch, {"var ", global_name, " = ", card_value});
+    // literals are not recorded as sources, except to end an earlier expression
+    const bool literal = IsLiteral(card_value);
+    const bool redefined = literal && !sources.empty() &&
+                           vm.globals.find(global_name.c_str()) != vm.globals.end();
+    // add the local card to the locals table
+    if (!CompileString(global_name, card_value, ctx.locals) &&
+        Interpret(expr.c_str(), ctx.locals) != pips::InterpretResult::OK) {
+      std::stringstream msg;
+      msg << "Failed to compile expression '" << expr << "' at line " << line_num;
+      fatal(msg);
+    }
+    auto value = vm.globals[global_name.c_str()];
+    ctx.meta[global_name.c_str()] = {line_num, comment};
+    comment.clear();
+    if (!literal) {
+      sources.push_back({std::string(global_name), std::string(source_prefix),
+                         std::string(card_value)});
+    } else if (redefined) {
+      sources.push_back({std::string(global_name), "", ""});
+    }
+    set_dimension(global_name, card_dims.size() == 1 ? card_dims[0] : std::nullopt);
+    // Stash the local for this suit
+    ctx.locals[local_name.c_str()] = value;
+  } else if (!lhs_vec && rhs_vec && !has_colon) {
+    // a = [1,2,3]
+    // loop through comma separated values
+    auto open_bracket = card_value_stripped.find_first_of('[');
+    if (open_bracket != std::string::npos) {
+      auto close_bracket = card_value_stripped.find_first_of(']', open_bracket);
+      card_value_stripped.erase(close_bracket);
+      card_value_stripped.erase(0, open_bracket + 1);
+    }
+
+    // Literal numbers and strings are stored as scanned; only the remaining
+    // elements go through the VM
+    const auto values = ScanList(card_value_stripped, line_num, &scratch);
+    int index = 0;
+    for (const auto &element : values) {
+      // add the local card to the locals table
+      const auto suffix = "[" + std::to_string(index) + "]";
+      const auto vec_name = Concat(&scratch, {global_name, suffix});
+      std::pmr::string value(element.text, &scratch);
+      const bool literal = element.kind != ListElement::Kind::EXPRESSION;
+      const bool redefined = literal && !sources.empty() &&
+                             vm.globals.find(vec_name.c_str()) != vm.globals.end();
+      if (element.kind == ListElement::Kind::NUMBER) {
+        vm.globals[vec_name.c_str()] = pips::Value(element.number);
+      } else if (element.kind == ListElement::Kind::STRING && value.size() < STRING_MAX) {
+        vm.globals[vec_name.c_str()] = pips::Value(std::string(value));
+      } else {
+        if (element.kind == ListElement::Kind::STRING) {
+          value = Concat(&scratch, {"\"", value, "\""});
+        }
+        const auto expr = Concat(&scratch, {"var ", vec_name, " = ", value});
+        if (!CompileString(vec_name, value, ctx.locals) &&
+            Interpret(expr.c_str(), ctx.locals) != pips::InterpretResult::OK) {
           std::stringstream msg;
-          msg << "Failed to compile dotted assignment '" << expr << "' at line "
-              << line_num;
+          msg << "Failed to compile expression '" << expr << "' at line " << line_num;
           fatal(msg);
         }
-        locals[local_name.c_str()] = vm.globals[local_name.c_str()];
-        meta[local_name.c_str()] = {line_num, comment};
-        comment.clear();
-        continue;
       }
+      auto vec_value = vm.globals[vec_name.c_str()];
+      ctx.meta[vec_name.c_str()] = {line_num, comment};
+      comment.clear();
+      if (!literal) {
+        sources.push_back(
+            {std::string(vec_name), std::string(source_prefix), std::string(value)});
+      } else if (redefined) {
+        sources.push_back({std::string(vec_name), "", ""});
+      }
+      set_dimension(vec_name,
+                    card_dims.size() == values.size() ? card_dims[index] : std::nullopt);
+      // Stash the local for this suit
+      ctx.locals[Concat(&scratch, {local_name, suffix}).c_str()] = vec_value;
+      index++;
+    }
+  } else {
+    // a[1:2] = [1,2]
+    // a[:2] = b[:2]
+    // These are handled by replicating the line and substituting the indices
+    // a = b[::2] fills all of a
+    auto card_values =
+        SplitString(card_value_stripped, line_num, -1, vector_length, &scratch);
+    std::pmr::string targets(local_name, &scratch);
+    if (!lhs_vec) targets += "[:]";
+    auto card_names =
+        SplitString(targets, line_num, card_values.size(), vector_length, &scratch);
+
+    // the RHS is split up
+    // Now create each expression and evaluate it
+
+    if (card_names.size() > card_values.size()) {
+      std::stringstream msg;
+      msg << "More card names than values at line " << line_num;
+      fatal(msg);
+    }
+    for (size_t idx = 0; idx < card_names.size(); idx++) {
+      const auto &local_vec_name = card_names[idx];
+      const auto global_vec_name = Concat(&scratch, {name_prefix, local_vec_name});
+
+      const auto expr = Concat(&scratch, {"var ", global_vec_name, " = ", card_values[idx]});
+      if (Interpret(expr.c_str(), ctx.locals) != pips::InterpretResult::OK) {
+        std::stringstream msg;
+        msg << "Failed to compile expression '" << expr << "' at line " << line_num;
+        fatal(msg);
+      }
+      auto value = vm.globals[global_vec_name.c_str()];
+      ctx.meta[global_vec_name.c_str()] = {line_num, comment};
+      comment.clear();
+      sources.push_back({std::string(global_vec_name), std::string(source_prefix),
+                         std::string(card_values[idx])});
+      // Stash the local for this suit
+      ctx.locals[local_vec_name.c_str()] = value;
+    }
+  }
+
+}
+
+void Deck::CompileInput(std::istream &ss, std::map<std::string, CardMeta> &meta,
+                        const std::string &base_dir, bool streaming) {
+  ForgetExpressions();
+  CompileContext ctx{meta, {}, {}, "", "", {}};
+  ctx.streaming = streaming;
+  CompileStream(ss, ctx, base_dir);
+  if (!ctx.curr_suit.empty()) RUMMY_PROBE1(suit__end, ctx.curr_suit.c_str());
+}
+
+void Deck::Build(std::istream &ss) { BuildInternal(ss, ""); }
+
+void Deck::BuildStreaming(std::istream &ss) { BuildInternal(ss, "", true); }
+
+void Deck::BuildStreaming(int fd) {
+  FdStreamBuf buf(fd);
+  std::istream ss(&buf);
+  BuildInternal(ss, "", true);
+}
+
+void Deck::BuildInternal(std::istream &ss, const std::string &base_dir, bool streaming) {
+  RUMMY_PROBE0(build__begin);
+  BatchGuard batch(*this);
+  std::map<std::string, CardMeta> meta;
+
+  if (!deck.empty()) {
+    for (const auto &suit : deck) {
+      for (const auto &card : suit.second) {
+        // replace suit name / with _
+        std::string suit_name = suit.first;
+        if (suit_name == "/") {
+          vm.globals[card.first] = card.second.GetValue();
+          meta[card.first] = GetCardMeta(suit.first, card.first);
+        } else {
+          std::replace(suit_name.begin(), suit_name.end(), '/', '.');
+          // use suit name as prefix
+          vm.globals[suit_name + "." + card.first] = card.second.GetValue();
+          meta[suit_name + "." + card.first] = GetCardMeta(suit.first, card.first);
+        }
+      }
+    }
+  }
+  // Ensure the global "/" suit exists
+  if (deck.find("/") == deck.end()) {
+    deck["/"] = std::map<std::string, Card>();
+    suits.push_back("/");
+    card_map["/"] = std::vector<std::string>();
+  }
+  CompileInput(ss, meta, base_dir, streaming);
+
+  for (const auto &global : vm.globals) {
+    if (global.first == kEvalName) continue;
+    if (inherited.count(global.first)) {
+      // shared from a parent suit unless the child overrode it
+      if (meta.find(global.first) == meta.end()) continue;
+      inherited.erase(global.first);
+    }
+    const auto &card_meta = meta[global.first];
+    const int loc = card_meta.loc;
+    const auto &comment = card_meta.comment;
+    // find position of the last dot
+    const auto last_dot = global.first.find_last_of('.');
+    std::string suit, card_name;
+    if (last_dot == std::string::npos) {
+      suit = "/";
+      card_name = global.first;
+    } else {
+      suit = global.first.substr(0, last_dot);
+      card_name = global.first.substr(last_dot + 1);
+      std::replace(suit.begin(), suit.end(), '.', '/');
+    }
+    if (!subscriptions.empty()) {
+      const Card *old_card = FindCard(suit, card_name);
+      const auto old_value = old_card ? old_card->GetValue() : pips::Value();
+      if (!SameValue(old_value, global.second)) {
+        pending_changes.push_back({suit, card_name, old_value, global.second, cycle});
+      }
+    }
+    if (metadata == CardMetadata::FULL) {
+      CopyCard(Card(std::move(suit), std::move(card_name), global.second, comment, loc));
+    } else {
+      CopyCard(Card(std::move(suit), std::move(card_name), global.second, "", -1));
+    }
+  }
+  if (metadata == CardMetadata::COLD) {
+    cold_meta = std::make_shared<const std::map<std::string, CardMeta>>(std::move(meta));
+  } else {
+    cold_meta.reset();
+  }
+  for (const auto &[key, list] : bindings) {
+    WriteBindings(key.first, key.second);
+  }
+  RUMMY_PROBE1(build__end, static_cast<int>(vm.globals.size()));
+}
+
+CardMeta Deck::GetCardMeta(const std::string &suit, const std::string &name) const {
+  const Card *card = FindCard(suit, name);
+  if (card == nullptr) return {};
+  CardMeta meta{card->loc, card->comment};
+  if (cold_meta && (meta.loc < 0 || meta.comment.empty())) {
+    auto it = cold_meta->find(GlobalName(card->suit, name));
+    if (it != cold_meta->end()) {
+      if (meta.loc < 0) meta.loc = it->second.loc;
+      if (meta.comment.empty()) meta.comment = it->second.comment;
+    }
+  }
+  return meta;
+}
+
+StringArena &Deck::OwnArena() {
+  // the entries are immutable and shared, so the clone copies pointers, not text
+  if (arena.use_count() > 1) arena = std::make_shared<StringArena>(*arena);
+  return *arena;
+}
+
+Card &Deck::Adopt(Card &card) {
+  if (!card.isString()) return card;
+  if (card.text) {
+    const auto id = OwnArena().Intern(*card.text);
+    card.value = pips::Value(StringArena::Reference(id));
+    card.text = arena->Get(id);
+  } else if (auto id = arena->ParseReference(card.value.as.str)) {
+    card.text = arena->Get(*id);
+  }
+  return card;
+}
+
+// String literals and concatenations of strings are evaluated here when the result
+// does not fit in a pips::Value (or an operand is already in the arena); the compiler
+// then only sees the arena reference. Returns false to leave expr to the compiler.
+bool Deck::CompileString(std::string_view global_name, std::string_view expr,
+                         pips::VTable &locals) {
+  if (expr.find('"') == std::string::npos) return false;
+  std::vector<std::string> terms;
+  {
+    std::string current;
+    bool in_quotes = false;
+    for (char c : expr) {
+      if (c == '"') in_quotes = !in_quotes;
+      if (c == '+' && !in_quotes) {
+        terms.push_back(current);
+        current.clear();
+      } else {
+        current += c;
+      }
+    }
+    terms.push_back(current);
+  }
+  std::string result;
+  bool uses_arena = false;
+  for (auto &term : terms) {
+    RemoveLeadingWhitespace(term);
+    RemoveTrailingWhitespace(term);
+    if (term.size() >= 2 && term.front() == '"' && term.back() == '"') {
+      if (term.find('"', 1) != term.size() - 1) return false;
+      result += term.substr(1, term.size() - 2);
+      continue;
+    }
+    // a previously defined string card
+    const pips::Value *value = nullptr;
+    auto local = locals.find(term);
+    if (local != locals.end()) {
+      value = &local->second;
+    } else {
+      auto global = vm.globals.find(term);
+      if (global == vm.globals.end()) return false;
+      value = &global->second;
+    }
+    if (value->type != pips::ValueType::STRING) return false;
+    if (auto id = arena->ParseReference(value->as.str)) {
+      result += *arena->Get(*id);
+      uses_arena = true;
+    } else {
+      result += value->as.str;
+    }
+  }
+  if (!uses_arena && result.size() < STRING_MAX) return false;
+  vm.globals[std::string(global_name)] =
+      pips::Value(StringArena::Reference(OwnArena().Intern(result)));
+  return true;
+}
+
+std::string Deck::UnitSystem(const int line_num) {
+  auto it = vm.globals.find("units.system");
+  if (it == vm.globals.end()) return "si";
+  const std::string system =
+      (it->second.type == pips::ValueType::STRING) ? it->second.as.str : "";
+  if (!IsUnitSystem(system)) {
+    std::stringstream msg;
+    msg << "Unknown unit system '" << system << "' at line " << line_num
+        << "\nExpected units.system to be \"si\" or \"cgs\"";
+    fatal(msg);
+  }
+  return system;
+}
+
+std::string Deck::GetCardUnits(const std::string &suit, const std::string &name) const {
+  auto it = dimensions.find(GlobalName(suit, name));
+  if (it == dimensions.end()) return "";
+  const Card *system = FindCard("units", "system");
+  return FormatUnits(it->second, system ? system->GetString() : "si");
+}
+
+std::map<std::string, std::map<std::string, double>>
+Deck::Jacobian(const std::vector<std::string> &inputs) const {
+  std::vector<std::string> unknown;
+  auto jacobian = Jacobian(inputs, unknown);
+  if (!unknown.empty()) {
+    std::stringstream msg;
+    msg << "Cannot differentiate";
+    for (const auto &path : unknown) msg << " '" << path << "'";
+    msg << " (unsupported functions or computed indices)";
+    fatal(msg);
+  }
+  return jacobian;
+}
+
+std::map<std::string, std::map<std::string, double>>
+Deck::Jacobian(const std::vector<std::string> &inputs,
+               std::vector<std::string> &unknown) const {
+  // current value of a compiler global, from the deck; booleans read as 1 and 0
+  auto deck_value = [this](const std::string &global_name) -> std::optional<double> {
+    const auto [suit, name] = SplitGlobalName(global_name);
+    const Card *card = FindCard(suit, name);
+    if (card == nullptr || !(card->isNumber() || card->isBool())) return std::nullopt;
+    const auto value = card->GetValue();
+    return card->isBool() ? (value.as.boolean ? 1.0 : 0.0) : value.as.number;
+  };
+  std::unordered_map<std::string, Dual> values;
+  std::unordered_map<std::string, std::size_t> input_ids;
+  for (std::size_t i = 0; i < inputs.size(); i++) {
+    const auto slash = inputs[i].find_last_of('/');
+    const auto global_name =
+        (slash == std::string::npos)
+            ? inputs[i]
+            : GlobalName(inputs[i].substr(0, slash), inputs[i].substr(slash + 1));
+    const auto [suit, name] = SplitGlobalName(global_name);
+    const Card *card = FindCard(suit, name);
+    if (card == nullptr || !card->isNumber()) {
+      std::stringstream msg;
+      msg << "Jacobian input '" << inputs[i] << "' is not a numeric card";
+      fatal(msg);
+    }
+    values[global_name] = {card->GetValue().as.number,
+                           std::vector<double>(inputs.size(), 0.0)};
+    values[global_name].grad[i] = 1.0;
+    input_ids[global_name] = i;
+  }
+  auto lookup = [&](const std::string &name, const std::string &prefix) -> Dual {
+    const auto qualified = prefix.empty() ? name : prefix + "." + name;
+    for (const auto &candidate : {qualified, name}) {
+      auto it = values.find(candidate);
+      if (it != values.end()) return it->second;
+    }
+    for (const auto &candidate : {qualified, name}) {
+      if (auto value = deck_value(candidate)) return {*value, {}};
+    }
+    return {std::numeric_limits<double>::quiet_NaN(), {}};
+  };
+
+  // cards whose expressions cannot be replayed, and every card that reads one of them
+  std::set<std::string> tainted;
+  auto is_tainted = [&](const std::string &name, const std::string &prefix) {
+    const auto qualified = prefix.empty() ? name : prefix + "." + name;
+    return tainted.count(values.count(qualified) ? qualified : name) > 0;
+  };
+
+  std::vector<std::string> derived;
+  for (const auto &source : sources) {
+    if (input_ids.count(source.global_name)) continue;
+    if (source.expr.empty()) {
+      // set to a literal or removed: read from the deck from here on
+      tainted.erase(source.global_name);
+      values.erase(source.global_name);
+      derived.erase(std::remove(derived.begin(), derived.end(), source.global_name),
+                    derived.end());
+      continue;
+    }
+    Dual result;
+    auto expr = Expression::Compile(source.expr);
+    bool replayed = expr.has_value();
+    for (std::size_t i = 0; replayed && i < expr->Names().size(); i++) {
+      replayed = !is_tainted(expr->Names()[i], source.prefix);
+    }
+    if (replayed) {
+      result = expr->Evaluate(
+          [&](std::size_t i) { return lookup(expr->Names()[i], source.prefix); });
+      tainted.erase(source.global_name);
+    } else {
+      result = {deck_value(source.global_name).value_or(0.0), {}};
+      tainted.insert(source.global_name);
+    }
+    if (values.find(source.global_name) == values.end()) {
+      derived.push_back(source.global_name);
+    }
+    values[source.global_name] = std::move(result);
+  }
+
+  std::map<std::string, std::map<std::string, double>> jacobian;
+  unknown.clear();
+  for (const auto &global_name : derived) {
+    const auto [suit, name] = SplitGlobalName(global_name);
+    const Card *card = FindCard(suit, name);
+    if (card == nullptr || !card->isNumber()) continue; // booleans and strings
+    const auto path = CardPath(suit, name);
+    if (tainted.count(global_name)) {
+      unknown.push_back(path);
+      continue;
     }
-    // Add this card to the card map
-    {
-      auto bracket = local_name.find('[');
-      std::string base_name =
-          (bracket != std::string::npos) ? local_name.substr(0, bracket) : local_name;
-      const std::string &map_suit = curr_suit.empty() ? "/" : curr_suit;
-      if (std::find(card_map[map_suit].begin(), card_map[map_suit].end(), base_name) ==
-          card_map[map_suit].end()) {
-        card_map[map_suit].push_back(base_name);
-      }
+    const auto &grad = values[global_name].grad;
+    for (std::size_t i = 0; i < grad.size(); i++) {
+      if (grad[i] != 0.0) jacobian[path][inputs[i]] = grad[i];
     }
+  }
+  return jacobian;
+}
 
-    // Processing the card
-    // Four cases:
-    //  a = 2           # no vector
-    //  a = [1,2,3]     # assign a vector
-    //  a[:2] = [1,2]   # assign a slice of a vector
-    //  a[:2] = b[:2]   # vector operation
-
-    bool lhs_vec = false;
-    bool rhs_vec = false;
-    // check for [] in the local name
-    auto open_bracket = local_name.find_first_of('[');
-    if (open_bracket != std::string::npos) {
-      // we have a vector case
-      auto close_bracket = local_name.find_first_of(']', open_bracket);
-      if (close_bracket == std::string::npos) {
-        std::stringstream msg;
-        msg << "Missing closing ']' in vector declaration at line " << line_num;
-        fatal(msg);
-      }
-      lhs_vec = true;
+std::shared_ptr<const DeckSnapshot> Deck::Snapshot() const {
+  // the compiler globals name every card, including the copies in inheriting suits,
+  // but the cards hold the published values
+  std::unordered_map<std::string, double> values;
+  values.reserve(vm.globals.size());
+  for (const auto &[global_name, global] : vm.globals) {
+    const auto [suit, name] = SplitGlobalName(global_name);
+    const Card *card = FindCard(suit, name);
+    if (card == nullptr) continue;
+    const auto value = card->GetValue();
+    if (value.type == pips::ValueType::NUMBER) {
+      values.emplace(global_name, value.as.number);
+    } else if (value.type == pips::ValueType::BOOL) {
+      values.emplace(global_name, value.as.boolean ? 1.0 : 0.0);
     }
-    open_bracket = card_value_stripped.find_first_of('[');
-    if (open_bracket != std::string::npos) {
-      // we have a vector case
-      auto close_bracket = card_value_stripped.find_first_of(']', open_bracket);
-      if (close_bracket == std::string::npos) {
-        std::stringstream msg;
-        msg << "Missing closing ']' in vector declaration at line " << line_num;
-        fatal(msg);
-      }
-      rhs_vec = true;
-    } else {
-      // allow vector without []. Look for comma separated values
-      // a = 1,2,3
-      // but ignore commas inside parentheses (e.g. atan2(a,b)) or quotes
-      if (card_value_stripped.find_first_of(',') != std::string::npos) {
-        auto comma_pos = card_value_stripped.find_first_of(',');
-        while (comma_pos != std::string::npos) {
-          bool in_quotes = false;
-          int paren_depth = 0;
-          for (size_t i = 0; i < comma_pos; i++) {
-            char c = card_value_stripped[i];
-            if (c == '"')
-              in_quotes = !in_quotes;
-            else if (!in_quotes && c == '(')
-              paren_depth++;
-            else if (!in_quotes && c == ')')
-              paren_depth--;
-          }
-          if (!in_quotes && paren_depth == 0) {
-            rhs_vec = true;
-            break;
-          }
-          comma_pos = card_value_stripped.find_first_of(',', comma_pos + 1);
-        }
+  }
+  return std::make_shared<const DeckSnapshot>(std::move(values));
+}
+
+CompiledExpression Deck::Resolve(std::shared_ptr<const Expression> program,
+                                 const std::string &suit) const {
+  CompiledExpression compiled;
+  compiled.deck = this;
+  compiled.suit = suit;
+  std::string prefix = (suit == "/") ? "" : suit;
+  std::replace(prefix.begin(), prefix.end(), '/', '.');
+  for (const auto &name : program->Names()) {
+    // the card's own suit first, then the global name
+    const Card *card = nullptr;
+    for (const auto &global_name : {prefix.empty() ? name : prefix + "." + name, name}) {
+      const auto [card_suit, card_name] = SplitGlobalName(global_name);
+      card = FindCard(card_suit, card_name);
+      if (card != nullptr) {
+        compiled.cards.emplace_back(card_suit, card_name);
+        break;
       }
     }
-    const bool has_comma = card_value_stripped.find_first_of(',') != std::string::npos;
-    if (local_name.find_first_of(',') != std::string::npos) {
+    if (card == nullptr || !(card->isNumber() || card->isBool())) {
       std::stringstream msg;
-      msg << "Cannot have comma in card name at line " << line_num;
+      msg << "'" << name << "' in expression '" << program->Source() << "' is "
+          << ((card == nullptr) ? "not a card" : "not a number");
       fatal(msg);
     }
+  }
+  compiled.program = std::move(program);
+  return compiled;
+}
 
-    // A colon is a slice separator only when it appears inside [...] on the
-    // LHS or RHS. A bare colon (e.g. from a ternary a ? b : c) is not a slice.
-    bool has_colon = (local_name.find_first_of(':') != std::string::npos);
-    if (!has_colon && rhs_vec) {
-      // Only look for a colon if we already know we're in a vector context
-      bool in_quotes = false;
-      bool in_brackets = false;
-      for (char c : card_value_stripped) {
-        if (c == '"')
-          in_quotes = !in_quotes;
-        else if (!in_quotes && c == '[')
-          in_brackets = true;
-        else if (!in_quotes && c == ']')
-          in_brackets = false;
-        else if (!in_quotes && in_brackets && c == ':') {
-          has_colon = true;
-          break;
-        }
-      }
+CompiledExpression Deck::Compile(const std::string &expr, const std::string &suit) {
+  return Cached(expr, suit);
+}
+
+const CompiledExpression &Deck::Cached(const std::string &expr, const std::string &suit) {
+  std::shared_ptr<const Expression> program;
+  auto it = expression_index.find(expr);
+  if (it != expression_index.end()) {
+    for (const auto entry : it->second) {
+      if (entry->suit != suit) continue;
+      expressions.splice(expressions.begin(), expressions, entry);
+      return *entry;
     }
-    if (!has_colon && ((!lhs_vec && !rhs_vec) || (lhs_vec && !rhs_vec) ||
-                       ((lhs_vec || rhs_vec) && !has_comma))) {
-      // a = 2
-      // a[0] = 2
-      // a = b[0]
-      std::string expr = "var " + global_name + " = " + card_value;
-      // add the local card to the locals table
-      if (vm.interpret(expr.c_str(), '\n', locals) != pips::InterpretResult::OK) {
-        std::stringstream msg;
-        msg << "Failed to compile expression '" << expr << "' at line " << line_num;
-        fatal(msg);
-      }
-      auto value = vm.globals[global_name.c_str()];
-      meta[global_name.c_str()] = {line_num, comment};
-      comment.clear();
-      // Stash the local for this suit
-      locals[local_name.c_str()] = value;
-    } else if (!lhs_vec && rhs_vec) {
-      // a = [1,2,3]
-      // loop through comma separated values
-      auto open_bracket = card_value_stripped.find_first_of('[');
-      if (open_bracket != std::string::npos) {
-        auto close_bracket = card_value_stripped.find_first_of(']', open_bracket);
-        card_value_stripped = card_value_stripped.substr(
-            open_bracket + 1, close_bracket - open_bracket - 1);
-      }
-
-      // Split card_value_stripped by commas, but ignore commas inside quotes
-      std::vector<std::string> values;
-      std::string current;
-      bool in_quotes = false;
-      for (size_t i = 0; i < card_value_stripped.size(); ++i) {
-        char c = card_value_stripped[i];
-        if (c == '"') {
-          in_quotes = !in_quotes;
-          current += c;
-        } else if (c == ',' && !in_quotes) {
-          values.push_back(current);
-          current.clear();
-        } else {
-          current += c;
-        }
-      }
-      if (!current.empty()) {
-        values.push_back(current);
-      }
-      int index = 0;
-      for (auto &value : values) {
-        RemoveWhitespacePreserveQuotes(value, line_num);
-        EmptyCheck(value, line_num);
-        // add the local card to the locals table
-        std::string vec_name = global_name + "[" + std::to_string(index) + "]";
-        std::string expr = "var " + vec_name + " = " + value;
-        if (vm.interpret(expr.c_str(), '\n', locals) != pips::InterpretResult::OK) {
-          std::stringstream msg;
-          msg << "Failed to compile expression '" << expr << "' at line " << line_num;
-          fatal(msg);
-        }
-        auto vec_value = vm.globals[vec_name.c_str()];
-        meta[vec_name.c_str()] = {line_num, comment};
-        comment.clear();
-        // Stash the local for this suit
-        std::string local_vec_name = local_name + "[" + std::to_string(index) + "]";
-        locals[local_vec_name.c_str()] = vec_value;
-        index++;
-      }
-    } else {
-      // a[1:2] = [1,2]
-      // a[:2] = b[:2]
-      // These are handled by replicating the line and substituting the indices
-      auto card_values = SplitString(card_value_stripped, line_num);
-      auto card_names = SplitString(local_name, line_num, card_values.size());
+    // the bytecode does not depend on the suit, only the names do
+    program = it->second.front()->program;
+  } else {
+    auto compiled = Expression::Compile(expr);
+    if (!compiled) {
+      std::stringstream msg;
+      msg << "Expression '" << expr << "' cannot be compiled (strings and vectors are "
+          << "not supported)";
+      fatal(msg);
+    }
+    program = std::make_shared<const Expression>(std::move(*compiled));
+  }
+  expressions.push_front(Resolve(std::move(program), suit));
+  expression_index[expr].push_back(expressions.begin());
+  TrimExpressions();
+  return expressions.front();
+}
 
-      // the RHS is split up
-      // Now create each expression and evaluate it
+void Deck::SetExpressionCacheSize(std::size_t size) {
+  expression_cache_size = size;
+  TrimExpressions();
+}
 
-      if (card_names.size() > card_values.size()) {
-        std::stringstream msg;
-        msg << "More card names than values at line " << line_num;
-        fatal(msg);
-      }
-      for (size_t idx = 0; idx < card_names.size(); idx++) {
-        std::string local_vec_name = card_names[idx];
-        std::string global_vec_name = name_prefix + local_vec_name;
+void Deck::TrimExpressions() {
+  while (expressions.size() > std::max<std::size_t>(1, expression_cache_size)) {
+    const auto last = std::prev(expressions.end());
+    auto it = expression_index.find(last->Source());
+    auto &entries = it->second;
+    entries.erase(std::find(entries.begin(), entries.end(), last));
+    if (entries.empty()) expression_index.erase(it);
+    expressions.pop_back();
+  }
+}
 
-        std::string expr = "var " + global_vec_name + " = " + card_values[idx];
-        if (vm.interpret(expr.c_str(), '\n', locals) != pips::InterpretResult::OK) {
+double CompiledExpression::Value() const {
+  return program->Evaluate(
+      [this](std::size_t i) {
+        const auto &[card_suit, card_name] = cards[i];
+        const Card *card = deck->FindCard(card_suit, card_name);
+        if (card == nullptr || !(card->isNumber() || card->isBool())) {
           std::stringstream msg;
-          msg << "Failed to compile expression '" << expr << "' at line " << line_num;
+          msg << "Card '" << CardPath(card_suit, card_name) << "' in expression '"
+              << Source() << "' is no longer a number";
           fatal(msg);
         }
-        auto value = vm.globals[global_vec_name.c_str()];
-        meta[global_vec_name.c_str()] = {line_num, comment};
-        comment.clear();
-        // Stash the local for this suit
-        locals[local_vec_name.c_str()] = value;
-      }
-    }
+        const auto value = card->GetValue();
+        return card->isBool() ? (value.as.boolean ? 1.0 : 0.0) : value.as.number;
+      },
+      stack);
+}
+
+Transaction &Transaction::Recompile(const std::string &line) {
+  const auto eq = line.find('=');
+  std::string global_name = line.substr(0, eq);
+  RemoveWhitespace(global_name);
+  if (eq == std::string::npos || global_name.empty()) {
+    std::stringstream msg;
+    msg << "Malformed transaction expression '" << line << "'";
+    fatal(msg);
+  }
+  const auto [suit, name] = SplitGlobalName(global_name);
+  writes.push_back({suit, name, std::nullopt, line.substr(eq + 1)});
+  return *this;
+}
 
-  } // end while
+bool Transaction::Commit() {
+  error.clear();
+  const bool ok = deck->Commit(*this, error);
+  writes.clear();
+  return ok;
 }
 
-void Deck::CompileInput(std::istream &ss, std::map<std::string, CardMeta> &meta,
-                        const std::string &base_dir) {
-  pips::VTable locals;
-  std::string curr_suit;
-  std::string prev_suit;
-  std::set<std::string> include_stack;
-  CompileStream(ss, meta, base_dir, include_stack, locals, curr_suit, prev_suit);
+void Deck::IndexSources() {
+  for (auto i = compiled_sources.size(); i < sources.size(); i++) {
+    const auto &source = sources[i];
+    compiled_sources.push_back(Expression::Compile(source.expr));
+    source_index[source.global_name] = i;
+    // cards Expression cannot evaluate (strings) are still dependents, so that a
+    // transaction changing their inputs fails rather than leaving them stale
+    const auto names = compiled_sources.back() ? compiled_sources.back()->Names()
+                                               : Expression::References(source.expr);
+    for (const auto &name : names) {
+      const auto qualified = source.prefix.empty() ? name : source.prefix + "." + name;
+      const bool local = vm.globals.find(qualified) != vm.globals.end();
+      dependents[local ? qualified : name].push_back(i);
+    }
+  }
 }
 
-void Deck::Build(std::istream &ss) { BuildInternal(ss, ""); }
+bool Deck::Commit(const Transaction &tx, std::string &error) {
+  IndexSources();
+  // a card to (re)evaluate: a recompiled card or a dependent of a change
+  struct Node {
+    std::string global_name;
+    std::string prefix;
+    std::string expr;
+    std::optional<std::size_t> source;
+    std::optional<Expression> compiled;
+  };
+  std::vector<Node> nodes;
+  std::unordered_map<std::string, std::size_t> node_of;
+  std::unordered_map<std::string, pips::Value> staged; // new values by global name
+  std::unordered_map<std::string, const Card *> set_cards;
+  std::vector<std::string> changed;
 
-void Deck::BuildInternal(std::istream &ss, const std::string &base_dir) {
-  std::map<std::string, CardMeta> meta;
+  for (const auto &write : tx.writes) {
+    const Card *card = FindCard(write.suit, write.name);
+    if (card == nullptr) {
+      error = "Card '" + CardPath(write.suit, write.name) + "' does not exist";
+      return false;
+    }
+    const auto global_name = GlobalName(write.suit, write.name);
+    changed.push_back(global_name);
+    if (write.card) {
+      staged[global_name] = write.card->GetValue();
+      set_cards[global_name] = &*write.card;
+      continue;
+    }
+    set_cards.erase(global_name);
+    auto source = source_index.find(global_name);
+    Node node{global_name, (write.suit == "/") ? "" : write.suit, write.expr,
+              std::nullopt, Expression::Compile(write.expr)};
+    std::replace(node.prefix.begin(), node.prefix.end(), '/', '.');
+    if (source != source_index.end()) node.source = source->second;
+    auto it = node_of.find(global_name);
+    if (it == node_of.end()) {
+      node_of[global_name] = nodes.size();
+      nodes.push_back(std::move(node));
+    } else {
+      nodes[it->second] = std::move(node);
+    }
+  }
+  // Set wins over an earlier Recompile of the same card
+  for (const auto &[global_name, card] : set_cards) {
+    auto it = node_of.find(global_name);
+    if (it != node_of.end()) nodes[it->second].expr.clear();
+  }
 
-  if (!deck.empty()) {
-    for (const auto &suit : deck) {
-      for (const auto &card : suit.second) {
-        // replace suit name / with _
-        std::string suit_name = suit.first;
-        if (suit_name == "/") {
-          vm.globals[card.first] = card.second.GetValue();
-          meta[card.first] = {card.second.loc, card.second.GetComment()};
-        } else {
-          std::replace(suit_name.begin(), suit_name.end(), '/', '.');
-          // use suit name as prefix
-          vm.globals[suit_name + "." + card.first] = card.second.GetValue();
-          meta[suit_name + "." + card.first] = {card.second.loc,
-                                                card.second.GetComment()};
-        }
+  // everything downstream of the changes, including copies in inheriting suits
+  for (std::size_t i = 0; i < changed.size(); i++) {
+    const auto [suit, name] = SplitGlobalName(changed[i]);
+    for (const auto &[child, parent] : suit_parents) {
+      const auto copy = GlobalName(child, name);
+      if (parent == suit && inherited.count(copy) &&
+          std::find(changed.begin(), changed.end(), copy) == changed.end()) {
+        changed.push_back(copy);
+      }
+    }
+    auto deps = dependents.find(changed[i]);
+    if (deps == dependents.end()) continue;
+    for (const auto index : deps->second) {
+      const auto &source = sources[index];
+      // redefined or removed later, or set to a literal
+      auto latest = source_index.find(source.global_name);
+      if (latest == source_index.end() || latest->second != index ||
+          source.expr.empty()) {
+        continue;
+      }
+      if (set_cards.count(source.global_name) || node_of.count(source.global_name)) {
+        continue;
       }
+      node_of[source.global_name] = nodes.size();
+      nodes.push_back({source.global_name, source.prefix, source.expr, index,
+                       compiled_sources[index]});
+      changed.push_back(source.global_name);
     }
   }
-  // Ensure the global "/" suit exists
-  if (deck.find("/") == deck.end()) {
-    deck["/"] = std::map<std::string, Card>();
-    suits.push_back("/");
-    card_map["/"] = std::vector<std::string>();
+
+  // name in an expression -> global name, preferring the card's own suit
+  auto resolve = [&](const std::string &name, const std::string &prefix) {
+    if (prefix.empty()) return name;
+    const auto qualified = prefix + "." + name;
+    if (staged.count(qualified) || node_of.count(qualified) ||
+        vm.globals.find(qualified) != vm.globals.end()) {
+      return qualified;
+    }
+    return name;
+  };
+
+  // dependency order over the affected cards only
+  std::vector<std::vector<std::size_t>> edges(nodes.size());
+  std::vector<std::size_t> indegree(nodes.size(), 0);
+  for (std::size_t n = 0; n < nodes.size(); n++) {
+    auto &node = nodes[n];
+    if (node.expr.empty()) continue;
+    const auto [suit, name] = SplitGlobalName(node.global_name);
+    const Card *card = FindCard(suit, name);
+    if (!node.compiled || card == nullptr || card->isString()) {
+      error = "Card '" + CardPath(suit, name) + "' cannot be re-evaluated from '" +
+              node.expr + "'";
+      return false;
+    }
+    for (const auto &name : node.compiled->Names()) {
+      auto it = node_of.find(resolve(name, node.prefix));
+      if (it == node_of.end() || it->second == n) continue;
+      edges[it->second].push_back(n);
+      indegree[n]++;
+    }
+  }
+  std::vector<std::size_t> order;
+  for (std::size_t n = 0; n < nodes.size(); n++) {
+    if (indegree[n] == 0) order.push_back(n);
+  }
+  for (std::size_t i = 0; i < order.size(); i++) {
+    for (const auto next : edges[order[i]]) {
+      if (--indegree[next] == 0) order.push_back(next);
+    }
+  }
+  if (order.size() != nodes.size()) {
+    error = "Circular dependency among the cards changed by the transaction";
+    return false;
   }
-  CompileInput(ss, meta, base_dir);
 
-  for (auto global : vm.globals) {
-    const int loc = meta[global.first].loc;
-    const auto comment = meta[global.first].comment;
-    // find position of the last dot
-    const auto last_dot = global.first.find_last_of('.');
-    std::string suit, card_name;
-    if (last_dot == std::string::npos) {
-      suit = "/";
-      card_name = global.first;
-    } else {
-      suit = global.first.substr(0, last_dot);
-      card_name = global.first.substr(last_dot + 1);
-      std::replace(suit.begin(), suit.end(), '.', '/');
+  // booleans read as 1 and 0, as in CompiledExpression
+  auto number = [](const pips::Value &value) {
+    if (value.type == pips::ValueType::BOOL) return value.as.boolean ? 1.0 : 0.0;
+    return (value.type == pips::ValueType::NUMBER)
+               ? value.as.number
+               : std::numeric_limits<double>::quiet_NaN();
+  };
+  for (const auto n : order) {
+    const auto &node = nodes[n];
+    if (node.expr.empty()) continue;
+    const double value = node.compiled->Evaluate([&](std::size_t i) {
+      const auto global_name = resolve(node.compiled->Names()[i], node.prefix);
+      auto it = staged.find(global_name);
+      if (it != staged.end()) return number(it->second);
+      const auto [suit, name] = SplitGlobalName(global_name);
+      const Card *card = FindCard(suit, name);
+      return (card == nullptr) ? std::numeric_limits<double>::quiet_NaN()
+                               : number(card->GetValue());
+    });
+    const auto [suit, name] = SplitGlobalName(node.global_name);
+    const Card *card = FindCard(suit, name);
+    if (card->isBool()) {
+      if (std::isnan(value)) {
+        error = "Card '" + CardPath(suit, name) + "' evaluates to nan";
+        return false;
+      }
+      staged[node.global_name] = pips::Value(value != 0.0);
+      continue;
+    }
+    const bool was_finite = card->isNumber() && std::isfinite(card->GetValue().as.number);
+    if (!std::isfinite(value) && (was_finite || std::isnan(value))) {
+      error = "Card '" + CardPath(suit, name) + "' evaluates to " + std::to_string(value);
+      return false;
+    }
+    staged[node.global_name] = pips::Value(value);
+  }
+
+  // everything checked out: publish
+  BatchGuard batch(*this);
+  for (const auto &write : tx.writes) {
+    const auto global_name = GlobalName(write.suit, write.name);
+    auto set = set_cards.find(global_name);
+    if (set != set_cards.end()) {
+      if (set->second == &*write.card) UpdateCard(write.suit, write.name, *write.card);
+      auto source = source_index.find(global_name);
+      if (source != source_index.end()) {
+        // the card is a literal from now on
+        sources[source->second].expr.clear();
+        compiled_sources[source->second].reset();
+      }
+    }
+  }
+  for (const auto n : order) {
+    auto &node = nodes[n];
+    if (node.expr.empty()) continue;
+    const auto [suit, name] = SplitGlobalName(node.global_name);
+    UpdateCard(suit, name, staged[node.global_name]);
+    if (node.source && sources[*node.source].expr == node.expr) continue;
+    // a recompiled card keeps its new expression for later transactions
+    if (!node.source) {
+      sources.push_back({node.global_name, node.prefix, node.expr});
+      IndexSources();
+      continue;
+    }
+    sources[*node.source].expr = node.expr;
+    compiled_sources[*node.source] = node.compiled;
+    for (const auto &dep : node.compiled->Names()) {
+      dependents[resolve(dep, node.prefix)].push_back(*node.source);
     }
-    CopyCard(Card(suit, card_name, global.second, comment, loc));
   }
+  return true;
 }
 
 void Deck::RecompileCard(const std::string &line) {
-  // The line should already be in the correct format
-  // so we can pass it directly to compiler
-
-  if (vm.interpret(line.c_str(), '\n') != pips::InterpretResult::OK) {
+  // The line should already be in the correct format so it can go to the compiler.
+  // Assignments of strings go through CompileString first, as in Build, so strings
+  // built from arena references are interned rather than stored as the reference text.
+  std::size_t eq = std::string::npos;
+  bool in_quotes = false;
+  for (std::size_t i = 0; i < line.size() && eq == std::string::npos; i++) {
+    if (line[i] == '"') in_quotes = !in_quotes;
+    if (!in_quotes && line[i] == '=') eq = i;
+  }
+  const bool assignment = eq != std::string::npos && eq > 0 &&
+                          std::string("=<>!").find(line[eq - 1]) == std::string::npos &&
+                          (eq + 1 == line.size() || line[eq + 1] != '=');
+  if (assignment) {
+    std::string global_name = line.substr(0, eq);
+    RemoveLeadingWhitespace(global_name);
+    if (global_name.compare(0, 4, "var ") == 0) global_name.erase(0, 4);
+    RemoveWhitespace(global_name);
+    std::string_view expr(line);
+    expr.remove_prefix(eq + 1);
+    while (!expr.empty() && expr.front() == ' ') expr.remove_prefix(1);
+    while (!expr.empty() && expr.back() == ' ') expr.remove_suffix(1);
+    pips::VTable no_locals;
+    if (vm.globals.find(global_name) != vm.globals.end() &&
+        CompileString(global_name, expr, no_locals)) {
+      PublishBound();
+      return;
+    }
+  }
+  if (Interpret(line.c_str()) != pips::InterpretResult::OK) {
     std::stringstream msg;
     msg << "Failed to compile expression '" << line << "'";
     fatal(msg);
   }
+  PublishBound();
+}
+
+void Deck::PublishBound() {
+  // bound cards are live, so they are published without waiting for UpdateDeck
+  BatchGuard batch(*this);
+  for (const auto &[key, list] : bindings) {
+    const auto &[suit, name] = key;
+    auto global = vm.globals.find(GlobalName(suit, name));
+    const Card *card = FindCard(suit, name);
+    if (global != vm.globals.end() && card != nullptr &&
+        !SameValue(card->GetValue(), global->second)) {
+      UpdateCard(suit, name, global->second);
+    }
+  }
   return;
 }
 void Deck::UpdateDeck(void) {
-  // Update the table
+  BatchGuard batch(*this);
+  // Update the table. A recompiled card shared from a parent suit differs from the
+  // parent's card, so UpdateCard gives the child its own copy.
   for (auto global : vm.globals) {
     const auto last_dot = global.first.find_last_of('.');
     std::string suit, card_name;
@@ -648,7 +2087,8 @@ void Deck::UpdateDeck(void) {
       card_name = global.first.substr(last_dot + 1);
       std::replace(suit.begin(), suit.end(), '.', '/');
     }
-    if (DoesSuitExist(suit) && DoesCardExist(suit, card_name)) {
+    if (DoesSuitExist(suit) && DoesCardExist(suit, card_name) &&
+        !SameValue(GetCard(suit, card_name).GetValue(), global.second)) {
       UpdateCard(suit, card_name, global.second);
     }
   }
@@ -656,19 +2096,81 @@ void Deck::UpdateDeck(void) {
 }
 
 Card &Deck::GetCard(const std::string &suit, const std::string &name) {
-  auto suit_it = deck.find(suit);
-  if (suit_it == deck.end()) {
+  return const_cast<Card &>(static_cast<const Deck *>(this)->GetCard(suit, name));
+}
+const Card &Deck::GetCard(const std::string &suit, const std::string &name) const {
+  if (deck.find(suit) == deck.end()) {
+    RUMMY_PROBE2(getcard__miss, suit.c_str(), name.c_str());
     std::stringstream msg;
     msg << "Suit '" << suit << "' not found in the deck.";
     fatal(msg);
   }
-  auto card_it = suit_it->second.find(name);
-  if (card_it == suit_it->second.end()) {
+  const Card *card = FindCard(suit, name);
+  if (card == nullptr) {
+    RUMMY_PROBE2(getcard__miss, suit.c_str(), name.c_str());
     std::stringstream msg;
     msg << "Card '" << name << "' not found in suit '" << suit << "'.";
     fatal(msg);
   }
-  return card_it->second;
+  RUMMY_PROBE2(getcard__hit, suit.c_str(), name.c_str());
+  return *card;
+}
+const Card *Deck::FindCard(const std::string &suit, const std::string &name) const {
+  auto suit_it = deck.find(suit);
+  if (suit_it == deck.end()) return nullptr;
+  auto card_it = suit_it->second.find(name);
+  if (card_it != suit_it->second.end()) return &card_it->second;
+  auto parent = suit_parents.find(suit);
+  if (parent != suit_parents.end()) return FindCard(parent->second, name);
+  return nullptr;
+}
+Card &Deck::OwnCard(const std::string &suit, const std::string &name) {
+  auto suit_it = deck.find(suit);
+  if (suit_it != deck.end()) {
+    auto card_it = suit_it->second.find(name);
+    if (card_it != suit_it->second.end()) return card_it->second;
+  }
+  // copy-on-write of an inherited card
+  Card card = GetCard(suit, name);
+  card.suit = suit;
+  inherited.erase(GlobalName(suit, name));
+  return deck[suit][name] = card;
+}
+
+void Deck::InheritSuit(const std::string &child, const std::string &parent,
+                       pips::VTable &locals, const int line_num) {
+  if (parent == "/" || deck.find(parent) == deck.end()) {
+    std::stringstream msg;
+    msg << "Unknown parent suit '" << parent << "' at line " << line_num;
+    fatal(msg);
+  }
+  for (auto p = parent; !p.empty(); p = GetParentSuit(p)) {
+    if (p == child) {
+      std::stringstream msg;
+      msg << "Suit '" << child << "' cannot inherit from itself at line " << line_num;
+      fatal(msg);
+    }
+  }
+  suit_parents[child] = parent;
+  // Share the parent's evaluated cards: locals for unqualified references in the
+  // child, and child-qualified globals that are not stored in the deck.
+  const auto parent_prefix = GlobalName(parent, "");
+  std::vector<std::pair<std::string, pips::Value>> shared;
+  for (const auto &global : vm.globals) {
+    const std::string &global_name = global.first;
+    if (global_name.compare(0, parent_prefix.size(), parent_prefix) != 0) continue;
+    auto local_name = global_name.substr(parent_prefix.size());
+    if (local_name.find('.') != std::string::npos) continue; // nested suit
+    shared.push_back({local_name, global.second});
+  }
+  for (const auto &[local_name, value] : shared) {
+    locals[local_name.c_str()] = value;
+    const auto child_name = GlobalName(child, local_name);
+    if (vm.globals.find(child_name) == vm.globals.end() || inherited.count(child_name)) {
+      vm.globals[child_name] = value;
+      inherited.insert(child_name);
+    }
+  }
 }
 void Deck::RemoveCard(const std::string &suit, const std::string &name) {
   auto suit_it = deck.find(suit);
@@ -683,23 +2185,282 @@ void Deck::RemoveCard(const std::string &suit, const std::string &name) {
     msg << "Card '" << name << "' not found in suit '" << suit << "'.";
     fatal(msg);
   }
+  journal.push_back({suit, name, card_it->second.GetValue(), pips::Value(), cycle, true});
   suit_it->second.erase(card_it);
+  // later transactions and Jacobians no longer evaluate it
+  sources.push_back({GlobalName(suit, name), "", ""});
+  ForgetExpressions();
 }
 
 void Deck::UpdateCard(const std::string &suit, const std::string &name, const Card &card,
                       std::string comment) {
-  auto &mycard = GetCard(suit, name);
+  auto &mycard = OwnCard(suit, name);
+  const auto old_value = mycard.GetValue();
   mycard = card;
+  Adopt(mycard);
   if (!comment.empty() && (comment != "")) {
     mycard.UpdateComment(comment);
   }
+  RecordChange(suit, name, old_value, mycard.GetValue());
+}
+
+void Deck::RecordChange(const std::string &suit, const std::string &name,
+                        const pips::Value &old_value, const pips::Value &new_value) {
+  if (SameValue(old_value, new_value)) return;
+  journal.push_back({suit, name, old_value, new_value, cycle});
+  // keep the compiler in sync so later RecompileCard/UpdateDeck calls see the change,
+  // including the shared copies in suits that inherit this card
+  vm.globals[GlobalName(suit, name)] = new_value;
+  WriteBindings(suit, name);
+  // down every level of inheritance that has not overridden the card
+  std::vector<std::string> heirs = {suit};
+  for (std::size_t i = 0; i < heirs.size(); i++) {
+    for (const auto &[child, parent] : suit_parents) {
+      if (parent == heirs[i] && inherited.count(GlobalName(child, name))) {
+        vm.globals[GlobalName(child, name)] = new_value;
+        WriteBindings(child, name);
+        heirs.push_back(child);
+      }
+    }
+  }
+  if (!subscriptions.empty()) {
+    pending_changes.push_back(journal.back());
+    if (batch_depth == 0) Notify();
+  }
+}
+
+void Deck::Unbind(const void *host) {
+  for (auto it = bindings.begin(); it != bindings.end();) {
+    auto &list = it->second;
+    list.erase(std::remove_if(list.begin(), list.end(),
+                              [host](const Binding &b) { return b.host == host; }),
+               list.end());
+    it = list.empty() ? bindings.erase(it) : std::next(it);
+  }
+}
+
+void Deck::WriteBindings(const std::string &suit, const std::string &name) {
+  if (bindings.empty()) return;
+  auto it = bindings.find({suit, name});
+  if (it == bindings.end()) return;
+  const Card *card = FindCard(suit, name);
+  if (card == nullptr) return;
+  for (const auto &binding : it->second) {
+    binding.write(binding.host, *card);
+  }
+}
+
+std::size_t Deck::Subscribe(const std::string &pattern, ChangeCallback callback) {
+  subscriptions.push_back({next_subscription, pattern, std::move(callback)});
+  return next_subscription++;
+}
+
+void Deck::Unsubscribe(std::size_t id) {
+  subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+                                     [id](const Subscription &s) { return s.id == id; }),
+                      subscriptions.end());
+}
+
+void Deck::EndBatch() {
+  if (batch_depth > 0 && --batch_depth == 0) Notify();
+}
+
+void Deck::Notify() {
+  // changes made by the callbacks themselves are delivered in the next round
+  batch_depth++;
+  while (!pending_changes.empty()) {
+    std::vector<JournalEntry> changes;
+    std::map<std::pair<std::string, std::string>, std::size_t> index;
+    for (auto &entry : std::exchange(pending_changes, {})) {
+      auto [it, added] =
+          index.emplace(std::make_pair(entry.suit, entry.name), changes.size());
+      if (added) {
+        changes.push_back(std::move(entry));
+      } else {
+        changes[it->second].new_value = entry.new_value;
+        changes[it->second].cycle = entry.cycle;
+      }
+    }
+    // a card set back to its old value did not change
+    changes.erase(std::remove_if(changes.begin(), changes.end(),
+                                 [](const JournalEntry &c) {
+                                   return SameValue(c.old_value, c.new_value);
+                                 }),
+                  changes.end());
+    const auto subscribers = subscriptions; // callbacks may (un)subscribe
+    for (const auto &sub : subscribers) {
+      std::vector<JournalEntry> matched;
+      for (const auto &change : changes) {
+        if (MatchesCard(sub.pattern, CardPath(change.suit, change.name))) {
+          matched.push_back(change);
+        }
+      }
+      if (!matched.empty()) sub.callback(matched);
+    }
+  }
+  batch_depth--;
+}
+
+void Deck::WriteDelta(std::ostream &os) {
+  // Keep only the final value of each card, grouped by suit with globals first so
+  // the output is also a valid deck.
+  std::vector<std::string> delta_suits;
+  std::map<std::string, std::vector<std::string>> delta_cards;
+  std::set<std::string> removed; // global names whose last change is a removal
+  int first_cycle = cycle;
+  for (const auto &entry : journal) {
+    if (entry.removed) {
+      removed.insert(GlobalName(entry.suit, entry.name));
+    } else {
+      removed.erase(GlobalName(entry.suit, entry.name));
+    }
+    first_cycle = std::min(first_cycle, entry.cycle);
+    auto it = delta_cards.find(entry.suit);
+    if (it == delta_cards.end()) {
+      it = delta_cards.emplace(entry.suit, std::vector<std::string>()).first;
+      if (entry.suit == "/") {
+        delta_suits.insert(delta_suits.begin(), entry.suit);
+      } else {
+        delta_suits.push_back(entry.suit);
+      }
+    }
+    if (std::find(it->second.begin(), it->second.end(), entry.name) == it->second.end()) {
+      it->second.push_back(entry.name);
+    }
+  }
+  os << "# rummy delta: cycles " << first_cycle << " to " << cycle << "\n";
+  for (const auto &suit_name : delta_suits) {
+    if (suit_name != "/") {
+      os << "<" << suit_name << ">\n";
+    }
+    for (const auto &name : delta_cards[suit_name]) {
+      // a removal is written as a comment so the delta stays a valid deck
+      if (removed.count(GlobalName(suit_name, name))) {
+        os << "# removed: " << name << "\n";
+        continue;
+      }
+      const auto *found = FindCard(suit_name, name);
+      if (found == nullptr) continue;
+      const auto &card = *found;
+      os << name << " = ";
+      if (card.isString()) {
+        os << "\"" << card.GetString() << "\"";
+      } else {
+        os << card.GetString();
+      }
+      const auto comment = GetCardMeta(suit_name, name).comment;
+      if (!comment.empty()) {
+        os << "  # " << comment;
+      }
+      os << "\n";
+    }
+  }
+  Checkpoint();
+}
+
+void Deck::ReplayDelta(std::istream &is) {
+  // Deltas hold literal values only, so they are applied directly without going
+  // through the compiler.
+  BatchGuard batch(*this);
+  std::string line;
+  std::string suit = "/";
+  int line_num = 0;
+  while (std::getline(is, line)) {
+    line_num++;
+    RemoveLeadingWhitespace(line);
+    RemoveTrailingWhitespace(line);
+    if (line.empty()) continue;
+    if (line[0] == '#') {
+      const std::string tag = "# rummy delta: cycles ";
+      if (line.compare(0, tag.size(), tag) == 0) {
+        auto to_pos = line.find(" to ");
+        if (to_pos != std::string::npos) cycle = std::stoi(line.substr(to_pos + 4));
+      }
+      const std::string removal = "# removed: ";
+      if (line.compare(0, removal.size(), removal) == 0) {
+        std::string name = line.substr(removal.size());
+        RemoveWhitespace(name);
+        auto suit_it = deck.find(suit);
+        if (suit_it != deck.end() && suit_it->second.count(name)) RemoveCard(suit, name);
+      }
+      continue;
+    }
+    if (line[0] == '<') {
+      suit = line.substr(1, line.find('>') - 1);
+      RemoveWhitespace(suit);
+      continue;
+    }
+    auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      std::stringstream msg;
+      msg << "Malformed delta entry '" << line << "' at line " << line_num;
+      fatal(msg);
+    }
+    std::string name = line.substr(0, eq);
+    RemoveWhitespace(name);
+    std::string text = line.substr(eq + 1);
+    RemoveLeadingWhitespace(text);
+    std::string comment;
+    pips::Value value;
+    std::optional<std::string> str; // kept whole so long strings are interned
+    if (!text.empty() && text[0] == '"') {
+      auto close = text.find('"', 1);
+      if (close == std::string::npos) {
+        std::stringstream msg;
+        msg << "Missing closing quote in delta entry at line " << line_num;
+        fatal(msg);
+      }
+      str = text.substr(1, close - 1);
+      text = text.substr(close + 1);
+    } else {
+      auto hash = text.find('#');
+      std::string literal = text.substr(0, hash);
+      RemoveTrailingWhitespace(literal);
+      text = (hash == std::string::npos) ? "" : text.substr(hash);
+      if (literal == "true" || literal == "false") {
+        value = pips::Value(literal == "true");
+      } else {
+        char *end = nullptr;
+        value = pips::Value(std::strtod(literal.c_str(), &end));
+        if (literal.empty() || *end != '\0') {
+          std::stringstream msg;
+          msg << "Delta value '" << literal << "' is not a literal at line " << line_num;
+          fatal(msg);
+        }
+      }
+    }
+    auto hash = text.find('#');
+    if (hash != std::string::npos) {
+      comment = text.substr(hash + 1);
+      RemoveLeadingWhitespace(comment);
+    }
+    // an inherited card gets its own copy in the suit, as for UpdateCard at run time
+    const bool exists = FindCard(suit, name) != nullptr;
+    if (str && exists) {
+      UpdateCard(suit, name, *str, comment);
+    } else if (str) {
+      GetOrAddCardValue(suit, name, *str, comment);
+    } else if (exists) {
+      UpdateCard(suit, name, value, comment);
+    } else {
+      GetOrAddCardValue(suit, name, value, comment);
+    }
+  }
+  Checkpoint();
 }
 // functions to iterate over the deck
 std::vector<std::string> Deck::GetCardsInOrder(const std::string &suit) const {
+  std::vector<std::string> names;
+  auto parent = suit_parents.find(suit);
+  if (parent != suit_parents.end()) {
+    names = GetCardsInOrder(parent->second);
+  }
   if (card_map.find(suit) != card_map.end()) {
-    return card_map.at(suit);
+    for (const auto &name : card_map.at(suit)) {
+      if (std::find(names.begin(), names.end(), name) == names.end()) names.push_back(name);
+    }
   }
-  return {};
+  return names;
 }
 // FindSuit returns a map of cards that match the suit
 std::map<std::string, Card> Deck::FindSuit(const std::string &suit) const {
@@ -709,7 +2470,17 @@ std::map<std::string, Card> Deck::FindSuit(const std::string &suit) const {
     msg << "Suit '" << suit << "' not found in the deck.";
     fatal(msg);
   }
-  return it->second;
+  auto parent = suit_parents.find(suit);
+  if (parent == suit_parents.end()) return it->second;
+  // full view of an inheriting suit: parent cards overlaid with the overrides
+  auto cards = FindSuit(parent->second);
+  for (auto &card : cards) {
+    card.second.suit = suit;
+  }
+  for (const auto &card : it->second) {
+    cards[card.first] = card.second;
+  }
+  return cards;
 }
 // fuzzy match version of FindSuit
 std::vector<Card> Deck::FindSuitFuzzy(std::string suit_) const {
@@ -724,7 +2495,7 @@ std::vector<Card> Deck::FindSuitFuzzy(std::string suit_) const {
   for (const auto &suit : deck) {
     if (suit.first.find(suit_) != std::string::npos) {
       // use the loc as the sorting index
-      for (const auto &card : suit.second) {
+      for (const auto &card : FindSuit(suit.first)) {
         result.push_back(card.second);
       }
     }
@@ -747,11 +2518,19 @@ std::vector<Card> Deck::FindSuitInOrder(const std::string &suit, const bool fuzz
         fatal(msg);
       }
     } else {
-      for (const auto &card : block->second) {
+      for (const auto &card : FindSuit(suit)) {
         subdeck.push_back(card.second);
       }
     }
   }
+  if (cold_meta) {
+    // the returned copies carry their metadata
+    for (auto &card : subdeck) {
+      auto meta = GetCardMeta(card.suit, card.name);
+      card.loc = meta.loc;
+      card.comment = std::move(meta.comment);
+    }
+  }
   std::sort(subdeck.begin(), subdeck.end(),
             [](const Card &a, const Card &b) { return a.loc < b.loc; });
   return subdeck;
@@ -770,22 +2549,48 @@ bool Deck::DoesSuitExist(const std::string &suit) const {
   return deck.find(suit) != deck.end();
 }
 bool Deck::DoesCardExist(const std::string &suit, const std::string &name) const {
-  auto suit_it = deck.find(suit);
-  if (suit_it == deck.end()) return false;
   // Be careful of vectors
-  return (suit_it->second.find(name) != suit_it->second.end()) ||
-         (suit_it->second.find(name + "[0]") != suit_it->second.end());
+  return (FindCard(suit, name) != nullptr) || (FindCard(suit, name + "[0]") != nullptr);
 }
 bool Deck::IsCardVector(const std::string &suit, const std::string &name) const {
-  auto suit_it = deck.find(suit);
-  if (suit_it == deck.end()) return false;
   // one of the cards must be the first element
-  for (const auto &card : suit_it->second) {
-    if (card.first == name + "[0]") {
-      return true;
+  return FindCard(suit, name + "[0]") != nullptr;
+}
+VectorView Deck::GetVectorView(const std::string &suit, const std::string &name,
+                               const std::string &slice) const {
+  VectorView view;
+  // elements are keyed name[i] and sort together; overrides in a child suit win
+  const std::string key = name + "[";
+  for (auto s = suit; !s.empty(); s = GetParentSuit(s)) {
+    auto suit_it = deck.find(s);
+    if (suit_it == deck.end()) break;
+    const auto &cards = suit_it->second;
+    for (auto it = cards.lower_bound(key);
+         it != cards.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+      const auto &card_name = it->first;
+      std::size_t index = 0;
+      const char *first = card_name.data() + key.size();
+      const char *last = card_name.data() + card_name.size() - 1;
+      auto [ptr, ec] = std::from_chars(first, last, index);
+      if (ec != std::errc() || ptr != last || *last != ']') continue;
+      if (index >= view.elements.size()) view.elements.resize(index + 1, nullptr);
+      if (view.elements[index] == nullptr) view.elements[index] = &it->second;
     }
   }
-  return false;
+  // the vector ends at the first missing element
+  auto gap = std::find(view.elements.begin(), view.elements.end(), nullptr);
+  view.elements.erase(gap, view.elements.end());
+  if (view.elements.empty()) {
+    std::stringstream msg;
+    msg << "Vector '" << name << "' not found in suit '" << suit << "'.";
+    fatal(msg);
+  }
+  const auto parsed = Slice::Parse(slice, -1);
+  const auto [first, count] = parsed.Resolve(static_cast<long>(view.elements.size()), -1);
+  view.first = first;
+  view.step = parsed.step;
+  view.count = static_cast<std::size_t>(count);
+  return view;
 }
 void Deck::WriteDeck(std::ostream &os) const {
   for (const auto &suit_name : suits) {
@@ -793,30 +2598,32 @@ void Deck::WriteDeck(std::ostream &os) const {
     if (!(suit_name.empty() || (suit_name == "/"))) {
       os << "<" << suit_name << ">\n";
     }
-    const auto &suit = deck.at(suit_name);
+    const auto suit = FindSuit(suit_name);
     // Collect cards and sort by insertion order (loc), falling back to name for
     // cards added programmatically (loc == -1). This preserves forward-reference
     // correctness when the output is re-read.
-    std::vector<std::pair<std::string, const Card *>> ordered;
+    std::vector<std::tuple<std::string, const Card *, CardMeta>> ordered;
     ordered.reserve(suit.size());
     for (const auto &card_pair : suit) {
-      ordered.push_back({card_pair.first, &card_pair.second});
+      ordered.emplace_back(card_pair.first, &card_pair.second,
+                           GetCardMeta(suit_name, card_pair.first));
     }
     std::sort(ordered.begin(), ordered.end(), [](const auto &a, const auto &b) {
-      if (a.second->loc != b.second->loc) return a.second->loc < b.second->loc;
-      return a.first < b.first;
+      if (std::get<2>(a).loc != std::get<2>(b).loc) {
+        return std::get<2>(a).loc < std::get<2>(b).loc;
+      }
+      return std::get<0>(a) < std::get<0>(b);
     });
-    for (const auto &entry : ordered) {
-      const auto &card = *entry.second;
-      const std::string &name = entry.first;
+    for (const auto &[name, card_ptr, meta] : ordered) {
+      const auto &card = *card_ptr;
       os << name << " = ";
       if (card.isString()) {
         os << "\"" << card.GetString() << "\"";
       } else {
         os << card.GetString();
       }
-      if (!card.GetComment().empty()) {
-        os << "  # " << card.GetComment();
+      if (!meta.comment.empty()) {
+        os << "  # " << meta.comment;
       }
       os << "\n";
     }
@@ -18,25 +18,40 @@
 #define RUMMY_DECK_HPP_
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include "expression.hpp"
 #include "rummy_utils.hpp"
+#include "sampling.hpp"
+#include "string_arena.hpp"
+#include "units.hpp"
 #include <pips/value_types.hpp>
 #include <pips/vm.hpp>
 
 namespace Rummy {
 
+// true for doubles that hold an integer exactly representable as int64
+inline bool IsExactInteger(double x) {
+  return std::isfinite(x) && (x == std::trunc(x)) && (std::fabs(x) <= 9007199254740992.0);
+}
+
 class Card {
  public:
   int loc;
@@ -47,10 +62,11 @@ class Card {
 
   Card(const Card &other)
       : loc(other.loc), name(other.name), suit(other.suit), value(other.value), comment(other.comment),
-        initialized(true) {}
+        text(other.text), initialized(true) {}
   Card &operator=(const Card &other) {
     if (this != &other) {
       value = other.value;
+      text = other.text;
       loc = other.loc;
       name = other.name;
       suit = other.suit;
@@ -61,9 +77,20 @@ class Card {
   }
   template <typename T>
   Card(std::string suit, std::string name, const T &v, std::string comment, int loc = -1)
-      : loc(loc), suit(suit), name(name), value(pips::Value(v)), comment(comment), initialized(true) {}
+      : loc(loc), suit(std::move(suit)), name(std::move(name)),
+        comment(std::move(comment)), initialized(true) {
+    if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      // strings too long for a pips::Value keep their full text beside the value
+      const std::string_view str(v);
+      if (str.size() >= STRING_MAX) text = std::make_shared<const std::string>(str);
+      value = pips::Value(std::string(str.substr(0, STRING_MAX - 1)));
+    } else {
+      value = pips::Value(v);
+    }
+  }
   Card(std::string suit, std::string name, pips::Value v, std::string comment, int loc = -1)
-      : loc(loc), suit(suit), name(name), value(v), comment(comment), initialized(true) {}
+      : loc(loc), suit(std::move(suit)), name(std::move(name)), value(v),
+        comment(std::move(comment)), initialized(true) {}
 
   bool empty() const { return !initialized; }
   bool isBool() const { return value.type == pips::ValueType::BOOL; }
@@ -73,13 +100,23 @@ class Card {
   std::string GetComment() const { return comment; }
   void UpdateComment(const std::string &new_comment) { comment = new_comment; }
 
+  // View of a string value, valid while the card is alive and unchanged
+  std::string_view GetStringView() const {
+    if (value.type != pips::ValueType::STRING) {
+      std::stringstream msg;
+      msg << "Calling GetStringView but value is not a string at " << suit << "/" << name;
+      fatal(msg);
+    }
+    if (text) return *text;
+    return std::string_view(value.as.str);
+  }
   std::string GetString(int precision = std::numeric_limits<double>::max_digits10) const {
     if (value.type == pips::ValueType::STRING) {
-      return std::string(value.as.str);
+      return std::string(GetStringView());
     } else if (value.type == pips::ValueType::NUMBER) {
-      // int or double
-      if (static_cast<int>(value.as.number) == value.as.number) {
-        return std::to_string(static_cast<int>(value.as.number));
+      // int or double; integers are exact up to 2^53 so they are printed as int64
+      if (IsExactInteger(value.as.number)) {
+        return std::to_string(static_cast<std::int64_t>(value.as.number));
       } else {
         std::ostringstream oss;
         oss << std::scientific << std::setprecision(precision) << value.as.number;
@@ -93,9 +130,9 @@ class Card {
   }
   template <typename T>
   T Get() const {
-    if constexpr (std::is_same_v<T, std::string>) {
+    if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
       if (value.type == pips::ValueType::STRING) {
-        return std::string(value.as.str);
+        return T(GetStringView());
       }
       std::stringstream msg;
       msg << "Calling Get with a string type but value is not a string at " << suit << "/"
@@ -114,6 +151,18 @@ class Card {
 
     } else if constexpr (std::is_arithmetic_v<T>) {
       if (value.type == pips::ValueType::NUMBER) {
+        if constexpr (std::is_integral_v<T>) {
+          // converting an out of range double is undefined, e.g. zone counts above 2^31
+          const double whole = std::trunc(value.as.number);
+          const double lo = static_cast<double>(std::numeric_limits<T>::min());
+          const double hi = static_cast<double>(std::numeric_limits<T>::max()) + 1.0;
+          if (!(whole >= lo && whole < hi)) {
+            std::stringstream msg;
+            msg << "Value " << GetString() << " is out of range for a "
+                << sizeof(T) * 8 << " bit integer at " << suit << "/" << name;
+            fatal(msg);
+          }
+        }
         return static_cast<T>(value.as.number);
       } else if (std::is_integral_v<T> && (value.type == pips::ValueType::BOOL)){
         return static_cast<T>(value.as.boolean);
@@ -128,58 +177,319 @@ class Card {
   }
 
  private:
+  friend class Deck;
   pips::Value value;
+  // full text of a string longer than STRING_MAX - 1; value then holds the short
+  // reference into the deck's StringArena (or a truncated copy before the card is
+  // added to a deck)
+  std::shared_ptr<const std::string> text;
   bool initialized;
 };
 
+// Exact comparison of two card values, used to detect changed cards
+inline bool SameValue(const pips::Value &a, const pips::Value &b) {
+  if (a.type != b.type) return false;
+  switch (a.type) {
+  case pips::ValueType::NUMBER:
+    return (a.as.number == b.as.number) ||
+           (std::isnan(a.as.number) && std::isnan(b.as.number));
+  case pips::ValueType::BOOL:
+    return a.as.boolean == b.as.boolean;
+  case pips::ValueType::STRING:
+    return std::strncmp(a.as.str, b.as.str, STRING_MAX) == 0;
+  default:
+    return true;
+  }
+}
+
+// Compare card values; long strings are compared by text since arena references are
+// only meaningful within one deck
+inline bool SameCardValue(const Card &a, const Card &b) {
+  if (a.isString() && b.isString()) return a.GetStringView() == b.GetStringView();
+  return SameValue(a.GetValue(), b.GetValue());
+}
+
 struct CardMeta {
   int loc = -1;
   std::string comment;
 };
 
+// What Build keeps of card comments and source line numbers. FULL stores them in every
+// card. COLD leaves the cards without them and keeps one side table that WriteDeck,
+// FindSuitInOrder and GetCardMeta read. NONE drops them. Either way the Card layout is
+// unchanged; the fields are left empty, which saves their heap text but not their size.
+enum class CardMetadata : std::uint8_t { FULL, COLD, NONE };
+
+// A logical deck statement: trailing comment removed and continuation lines joined.
+// The text and comment are views into the scanned input or a block body and are only
+// valid while the statement is compiled.
+struct Statement {
+  std::string_view text;
+  int line_num = 0;
+  bool sets_comment = false; // the statement carried its own trailing comment
+  std::string_view comment;
+};
+
+// A statement kept in the body of a block or template
+struct StoredStatement {
+  std::string text;
+  int line_num = 0;
+  bool sets_comment = false;
+  std::string comment;
+};
+
+// Body of a deck level for loop, template or if block, collected up to its matching
+// 'end'. Each instance substitutes into a copy of the body text and compiles it again.
+// An if block keeps only the branch its condition selected, and a block in a disabled
+// suit keeps nothing and is never expanded.
+struct StatementBlock {
+  std::string header;
+  int line_num = 0;
+  int depth = 0; // blocks nested inside the body
+  std::vector<StoredStatement> body;
+  bool disabled = false;
+  bool is_if = false;
+  bool condition = true; // value of an if condition
+  bool in_else = false;
+  bool Keeps() const { return !disabled && (condition != in_else); }
+};
+
+struct DeckTemplate {
+  std::vector<std::string> params;
+  std::vector<StoredStatement> body;
+};
+
+// State shared by every statement of one compile, including included files
+struct CompileContext {
+  std::map<std::string, CardMeta> &meta;
+  std::set<std::string> include_stack;
+  pips::VTable locals;
+  std::string curr_suit;
+  std::string prev_suit;
+  std::map<std::string, DeckTemplate> templates;
+  bool suit_disabled = false;     // current suit header had a false condition
+  bool absolute_disabled = false; // same for the last non-relative suit header
+  bool streaming = false;         // read line by line, includes too (BuildStreaming)
+};
+
+// Expression a card was compiled from. prefix is the dotted suit used to resolve
+// unqualified names. Cards set to a literal have none; an empty expr marks a card
+// whose earlier expression was replaced by a literal or that was removed.
+struct CardSource {
+  std::string global_name;
+  std::string prefix;
+  std::string expr;
+};
+
+// One runtime change of a card. old_value is NIL for cards added at run time.
+struct JournalEntry {
+  std::string suit;
+  std::string name;
+  pips::Value old_value;
+  pips::Value new_value;
+  int cycle;
+  bool removed = false; // RemoveCard; new_value is nil
+};
+
+// Strided, read-only view of the elements of a vector card selected by a slice. The
+// view points at the deck's cards, so it is invalidated by anything that adds or
+// removes cards; values updated in place are seen through it.
+class VectorView {
+ public:
+  VectorView() = default;
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  // i-th element of the slice and its index in the vector
+  const Card &operator[](std::size_t i) const { return *elements[Index(i)]; }
+  std::size_t Index(std::size_t i) const {
+    return static_cast<std::size_t>(first + static_cast<long>(i) * step);
+  }
+  template <typename T>
+  T Get(std::size_t i) const {
+    return (*this)[i].Get<T>();
+  }
+
+ private:
+  friend class Deck;
+  std::vector<const Card *> elements; // every element of the vector, by index
+  long first = 0;
+  long step = 1;
+  std::size_t count = 0;
+};
+
+class Deck;
+class DeckSnapshot;
+
+// A group of runtime changes applied together, from Deck::Begin. Set stages a new value
+// for a card and Recompile a new expression ("gas.eos.cv = 1.0/(gamma - 1.0)", as for
+// RecompileCard). Commit applies the staged writes and re-evaluates the numeric and
+// boolean cards derived from them once, in dependency order, then publishes every
+// change in one batch. If anything fails (a missing card, a dependent that cannot be
+// re-evaluated such as a string, a circular dependency or a non-finite result) the
+// deck is left untouched, Commit returns false and Error() says why. Uncommitted
+// writes are discarded.
+class Transaction {
+ public:
+  template <typename T>
+  Transaction &Set(const std::string &suit, const std::string &name, const T &value) {
+    writes.push_back({suit, name, Card(suit, name, value, ""), ""});
+    return *this;
+  }
+  Transaction &Recompile(const std::string &line);
+  bool Commit();
+  void Rollback() { writes.clear(); }
+  const std::string &Error() const { return error; }
+
+ private:
+  friend class Deck;
+  explicit Transaction(Deck &deck_) : deck(&deck_) {}
+  struct Write {
+    std::string suit;
+    std::string name;
+    std::optional<Card> card; // Set, otherwise Recompile with expr
+    std::string expr;
+  };
+  Deck *deck;
+  std::vector<Write> writes;
+  std::string error;
+};
+
+// An arithmetic expression over the cards of a deck, from Deck::Compile. The card names
+// are resolved once, relative to the suit first and then as globals, and every Evaluate
+// reads their current values with no lexing, parsing or allocation. It refers to the
+// deck, which must outlive it, and is not meant for several threads at once.
+class CompiledExpression {
+ public:
+  const std::string &Source() const { return program->Source(); }
+  const std::string &Suit() const { return suit; }
+  template <typename T = double>
+  T Evaluate() const {
+    static_assert(std::is_arithmetic_v<T>, "Expressions evaluate to arithmetic types");
+    const double value = Value();
+    if constexpr (std::is_same_v<T, bool>) {
+      return value != 0.0;
+    } else if constexpr (std::is_integral_v<T>) {
+      const double whole = std::trunc(value);
+      const double lo = static_cast<double>(std::numeric_limits<T>::min());
+      const double hi = static_cast<double>(std::numeric_limits<T>::max()) + 1.0;
+      if (!(whole >= lo && whole < hi)) {
+        std::stringstream msg;
+        msg << "Value " << value << " of '" << Source() << "' is out of range for a "
+            << sizeof(T) * 8 << " bit integer";
+        fatal(msg);
+      }
+    }
+    return static_cast<T>(value);
+  }
+
+ private:
+  friend class Deck;
+  double Value() const;
+  const Deck *deck = nullptr;
+  std::string suit;
+  std::shared_ptr<const Expression> program;
+  std::vector<std::pair<std::string, std::string>> cards; // (suit, name) of each name
+  mutable std::vector<double> stack;
+};
+
 class Deck {
  public:
   Deck() = default;
-  Deck(const Deck &other) : deck(other.deck), suits(other.suits), card_map(other.card_map), vm(other.vm) {}
+  Deck(const Deck &other)
+      : vm(other.vm), arena(other.arena), deck(other.deck), suits(other.suits),
+        card_map(other.card_map), dimensions(other.dimensions), sources(other.sources),
+        suit_parents(other.suit_parents), inherited(other.inherited), journal(other.journal),
+        cycle(other.cycle), metadata(other.metadata),
+        cold_meta(other.cold_meta), scan_chunk_size(other.scan_chunk_size),
+        scan_threads(other.scan_threads), sampled(other.sampled),
+        build_inputs(other.build_inputs),
+        expression_cache_size(other.expression_cache_size) {}
   Deck &operator=(const Deck &other) {
     if (this != &other) {
       deck = other.deck;
       suits = other.suits;
       card_map = other.card_map;
       vm = other.vm;
+      arena = other.arena;
+      dimensions = other.dimensions;
+      sources = other.sources;
+      suit_parents = other.suit_parents;
+      inherited = other.inherited;
+      journal = other.journal;
+      cycle = other.cycle;
+      metadata = other.metadata;
+      cold_meta = other.cold_meta;
+      scan_chunk_size = other.scan_chunk_size;
+      scan_threads = other.scan_threads;
+      sampled = other.sampled;
+      build_inputs = other.build_inputs;
+      expression_cache_size = other.expression_cache_size;
+      // the dependency index describes the old sources; it is rebuilt on demand
+      compiled_sources.clear();
+      dependents.clear();
+      source_index.clear();
+      ForgetExpressions();
     }
     return *this;
   }
+  // Set before Build; runtime-only users pick COLD or NONE to skip comment storage
+  void SetMetadata(CardMetadata mode) { metadata = mode; }
+  CardMetadata GetMetadata() const { return metadata; }
+  // Inputs are read in windows of bytes per thread (0 threads for one per core); the
+  // lines of a window are scanned in parallel, split at line starts, before its
+  // statements are compiled in order. bytes = 0 reads line by line, as BuildStreaming
+  // does. The result does not depend on either.
+  void SetScanChunkSize(std::size_t bytes, unsigned threads = 0) {
+    scan_chunk_size = bytes;
+    scan_threads = threads;
+  }
+  // Comment and source line of a card, from the card itself or the cold side table
+  CardMeta GetCardMeta(const std::string &suit, const std::string &name) const;
   void Build(std::string fname, std::string prepends = "");
   void Build(std::istream &ss);
   void Build(std::istream &ss, std::string prepends);
   void Build(std::istream &ss, std::istream &prepends);
+  // Build from a pipe or other stream without holding the whole input. Lines are read
+  // through a fixed-size buffer and each statement is compiled as soon as it is
+  // complete, so memory is bounded by the longest statement plus the deck itself.
+  // Included files are streamed the same way. Build("-") streams standard input.
+  void BuildStreaming(std::istream &ss);
+  void BuildStreaming(int fd);
   void CompileInput(std::istream &ss, std::map<std::string, CardMeta> &meta,
-                    const std::string &base_dir = "");
+                    const std::string &base_dir = "", bool streaming = false);
 
+  // Cards stored in the suit itself. For a suit that inherits from a parent
+  // (<child : parent>) this holds only the overrides; FindSuit gives the full view.
   const std::map<std::string, Card> &GetSuit(const std::string &suit) const {
     return deck.at(suit);
   }
+  // Parent of an inheriting suit, or an empty string
+  std::string GetParentSuit(const std::string &suit) const {
+    auto it = suit_parents.find(suit);
+    return (it == suit_parents.end()) ? "" : it->second;
+  }
   const std::map<std::string, std::map<std::string, Card>> &GetDeck() const {
     return deck;
   }
 
   template <typename T>
   void AddCard(const std::string &suit, const std::string &name, const T &val, std::string comment = "") {
+    ForgetExpressions(); // names may resolve differently now
     if (deck.find(suit) == deck.end()) {
       deck[suit] = std::map<std::string, Card>();
       suits.push_back(suit);
       card_map[suit] = std::vector<std::string>();
     }
     if constexpr (std::is_same_v<T, Card>) {
-      deck[suit][name] = val;
+      Adopt(deck[suit][name] = val);
     } else {
-      deck[suit][name] = Card(suit, name, val, comment);
+      Adopt(deck[suit][name] = Card(suit, name, val, comment));
     }
   }
   void RemoveCard(const std::string &suit, const std::string &name);
   void CopyCard(const Card &card) { AddCard(card.suit, card.name, card); }
   Card &GetCard(const std::string &suit, const std::string &name);
+  const Card &GetCard(const std::string &suit, const std::string &name) const;
   template <typename T>
   T GetCardValue(const std::string &suit, const std::string &name) {
     return GetCard(suit, name).Get<T>();
@@ -188,26 +498,30 @@ class Deck {
   void UpdateCard(const std::string &suit, const std::string &name, const Card &card, std::string comment="");
   template <typename T>
   void UpdateCard(const std::string &suit, const std::string &name, const T &val, std::string comment="") {
-    auto &mycard = GetCard(suit, name);
+    auto &mycard = OwnCard(suit, name);
     if (comment.empty()) {
       comment = mycard.GetComment();
     }
+    const auto old_value = mycard.GetValue();
     mycard = Card(suit, name, val, comment, mycard.loc);
+    Adopt(mycard);
+    RecordChange(suit, name, old_value, mycard.GetValue());
   }
   template <typename T>
   T GetOrAddCardValue(const std::string &suit, const std::string &name, const T &val, std::string comment="Default value added at run time") {
     // Like AddCard, but don't error
     if (deck.find(suit) == deck.end()) {
       AddCard<T>(suit, name, val, comment);
+      RecordChange(suit, name, pips::Value(), GetCard(suit, name).GetValue());
       return val;
     }
-    const auto it = deck[suit].find(name);
-    if ( it == deck[suit].end()) {
+    if (FindCard(suit, name) == nullptr) {
       if constexpr (std::is_same_v<T, Card>) {
-        deck[suit][name] = val;
+        Adopt(deck[suit][name] = val);
       } else {
-        deck[suit][name] = Card(suit, name, val, comment);
+        Adopt(deck[suit][name] = Card(suit, name, val, comment));
       }
+      RecordChange(suit, name, pips::Value(), deck[suit][name].GetValue());
       return val;
     }
     return GetCard(suit, name).Get<T>();
@@ -226,6 +540,10 @@ class Deck {
   std::vector<std::string> GetCardsInOrder(const std::string &suit)  const;
 
   bool IsCardVector(const std::string &suit, const std::string &name) const;
+  // View of name[start:stop:step] with Python slice semantics, e.g. "::2", "-3:" or
+  // "10:0:-1". Elements are not copied.
+  VectorView GetVectorView(const std::string &suit, const std::string &name,
+                           const std::string &slice = ":") const;
   template <typename T>
   std::vector<T> GetVector(const std::string &suit, const std::string &name, 
                            std::vector<std::string> &comments) const {
@@ -248,7 +566,7 @@ class Deck {
       } else {
         vec.push_back(cards[i].Get<T>());
       }
-      comments.push_back(cards[i].GetComment());
+      comments.push_back(GetCardMeta(cards[i].suit, cards[i].name).comment);
     }
     return vec;
   }
@@ -261,6 +579,7 @@ class Deck {
   void UpdateVector(const std::string &suit, const std::string &name,
                     const std::vector<T> &values, const std::string comment="") {
     // Deck stores vectors as separate cards with names of suit.name[index]
+    BatchGuard batch(*this); // subscribers hear about the vector once
     for (size_t i = 0; i < values.size(); i++) {
       std::string card_name = name + "[" + std::to_string(i) + "]";
       UpdateCard(suit, card_name, values[i], comment);
@@ -285,10 +604,92 @@ class Deck {
                  const std::initializer_list<T> &values, const std::string comment="") {
     AddVector(suit, name, std::vector<T>(values), comment);
   }
+  const StringArena &GetStringArena() const { return *arena; }
+  // Units of a card defined from unit annotated literals, in the deck's unit system
+  // (units.system, "si" by default), e.g. "g cm^-3". Empty if the units are unknown.
+  std::string GetCardUnits(const std::string &suit, const std::string &name) const;
+  // Sparse Jacobian d(card)/d(input) of the derived numeric cards with respect to the
+  // given input cards ("suit/name", or "name" for globals). The card expressions
+  // recorded during Build are replayed once with dual numbers; only nonzero entries are
+  // returned, keyed by card path then input path. Cards whose expressions cannot be
+  // replayed (unsupported functions, computed indices), and the cards that read them,
+  // have no derivatives: the first form fails for them and the second leaves them out
+  // of the result and lists their paths in unknown.
+  std::map<std::string, std::map<std::string, double>>
+  Jacobian(const std::vector<std::string> &inputs) const;
+  std::map<std::string, std::map<std::string, double>>
+  Jacobian(const std::vector<std::string> &inputs,
+           std::vector<std::string> &unknown) const;
+  // Compile an arithmetic expression over the cards, e.g. "2*mesh.nx1 + 1", once for
+  // repeated evaluation. Eval compiles through a bounded LRU cache keyed by the suit
+  // and the text, so evaluating them again is a lookup; suits share the compiled
+  // program and only resolve the names again. Adding or removing cards, building
+  // and assigning the deck empty the cache; copies of the deck start without one.
+  CompiledExpression Compile(const std::string &expr, const std::string &suit = "/");
+  template <typename T = double>
+  T Eval(const std::string &expr, const std::string &suit = "/") {
+    return Cached(expr, suit).Evaluate<T>();
+  }
+  void SetExpressionCacheSize(std::size_t size);
+  std::size_t GetExpressionCacheSize() const { return expression_cache_size; }
+  // Read-only copy of the numeric and boolean card values for concurrent evaluation
+  // (see EvaluatorPool in evaluator.hpp). Runtime changes made afterwards are not seen.
+  std::shared_ptr<const DeckSnapshot> Snapshot() const;
+  // Cards declared with a sampling distribution ("rho ~ uniform(0.9, 1.1)"), in
+  // declaration order. Ensemble::Sample draws members from them.
+  const std::vector<SampledCard> &GetSampledCards() const { return sampled; }
+  // Run a line through the compiler. A string assignment to an existing card is
+  // interned like a Build-time one, so it may use long strings.
   void RecompileCard(const std::string &line);
   void UpdateDeck();
   void WriteDeck(std::ostream &os) const;
 
+  // Change journal. Every runtime change made through UpdateCard, UpdateVector,
+  // UpdateDeck (after RecompileCard), GetOrAddCardValue and RemoveCard is appended to
+  // the journal tagged with the current cycle. The journal holds only the changes since
+  // the last checkpoint; Checkpoint drops them. WriteDelta emits the final value of
+  // every card changed since the last checkpoint, in deck syntax, and checkpoints.
+  // ReplayDelta applies such a delta, so a runtime deck is rebuilt by Build(base)
+  // followed by ReplayDelta for each delta in order. Journaled changes are also
+  // pushed to the compiler so later RecompileCard/UpdateDeck calls see them.
+  void SetCycle(int cycle_) { cycle = cycle_; }
+  int GetCycle() const { return cycle; }
+  const std::vector<JournalEntry> &GetJournal() const { return journal; }
+  std::size_t NumPendingChanges() const { return journal.size(); }
+  void Checkpoint() { journal.clear(); }
+  void WriteDelta(std::ostream &os);
+  void ReplayDelta(std::istream &is);
+  // Keep *host equal to a card. It is written now and again whenever the card changes
+  // through UpdateCard, UpdateDeck, RecompileCard, ReplayDelta, a transaction or a
+  // rebuild. T is an arithmetic type, bool or std::string; the conversion is chosen
+  // here once. Call Unbind before the host variable goes away.
+  template <typename T>
+  void BindTo(const std::string &suit, const std::string &name, T *host) {
+    static_assert(std::is_arithmetic_v<T> || std::is_same_v<T, std::string>,
+                  "Cards bind to arithmetic, bool or std::string variables");
+    Binding binding{host, [](void *dst, const Card &card) {
+                      *static_cast<T *>(dst) = card.Get<T>();
+                    }};
+    binding.write(host, GetCard(suit, name));
+    bindings[{suit, name}].push_back(binding);
+  }
+  void Unbind(const void *host);
+  // Start a group of changes that are applied together, see Transaction
+  Transaction Begin() { return Transaction(*this); }
+
+  // Change notifications. A subscriber is called with the cards it matches that
+  // changed through UpdateCard, UpdateVector, UpdateDeck, GetOrAddCardValue,
+  // ReplayDelta or a (re)Build. pattern is a card path ("gas/rho", or "rho" for a
+  // global), a suit prefix ending in '/' ("gas/" also matches gas/eos/...), or a glob
+  // with '*' and '?'. A vector name matches all of its elements. Changes are coalesced
+  // per card (first old value, last new value) and delivered once when the outermost
+  // call, or the outermost BeginBatch/EndBatch pair, finishes.
+  using ChangeCallback = std::function<void(const std::vector<JournalEntry> &)>;
+  std::size_t Subscribe(const std::string &pattern, ChangeCallback callback);
+  void Unsubscribe(std::size_t id);
+  void BeginBatch() { batch_depth++; }
+  void EndBatch();
+
   // Seed the deck
   void SeedGlobals(const std::map<std::string, std::map<std::string, Card>> &new_cards,
                    const std::vector<std::string> &new_suits,
@@ -311,20 +712,124 @@ class Deck {
     }
     for (const auto &[suit, cards] : new_cards) {
       for (const auto &[card_name, card] : cards) {
-        deck[suit][card_name] = card;
+        Adopt(deck[suit][card_name] = card);
       }
     }
   }
 
  private:
-  void BuildInternal(std::istream &ss, const std::string &base_dir);
-  void CompileStream(std::istream &ss, std::map<std::string, CardMeta> &meta,
-                     const std::string &base_dir, std::set<std::string> &include_stack,
-                     pips::VTable &locals, std::string &curr_suit, std::string &prev_suit);
+  void BuildInternal(std::istream &ss, const std::string &base_dir,
+                     bool streaming = false);
+  void CompileStream(std::istream &ss, CompileContext &ctx, const std::string &base_dir);
+  void CompileStatement(const Statement &stmt, CompileContext &ctx,
+                        const std::string &base_dir, std::string &comment,
+                        std::optional<StatementBlock> &block);
+  void CompileStatements(const std::vector<StoredStatement> &body,
+                         const std::map<std::string, std::string> &subs,
+                         CompileContext &ctx, const std::string &base_dir,
+                         std::string &comment);
+  void ExpandBlock(const StatementBlock &block, CompileContext &ctx,
+                   const std::string &base_dir, std::string &comment);
+  void ProcessStatement(std::string_view line, const int line_num, CompileContext &ctx,
+                        const std::string &base_dir, std::string &comment);
+  // vm.interpret between the interpret__entry and interpret__exit probes (probes.hpp)
+  pips::InterpretResult Interpret(const char *source, pips::VTable &locals);
+  pips::InterpretResult Interpret(const char *source);
+  pips::Value EvalExpression(const std::string &expr, CompileContext &ctx,
+                             const int line_num);
+  // "name ~ distribution(a, b)": defines the card at its nominal value
+  void ProcessSampling(std::string_view line, std::size_t tilde, const int line_num,
+                       CompileContext &ctx, const std::string &base_dir,
+                       std::string &comment);
+  void RecordChange(const std::string &suit, const std::string &name,
+                    const pips::Value &old_value, const pips::Value &new_value);
+  // deliver the pending changes to the subscribers
+  void Notify();
+  friend class Transaction;
+  friend class PreparedDeck;
+  friend class CompiledExpression;
+  const CompiledExpression &Cached(const std::string &expr, const std::string &suit);
+  void TrimExpressions(); // evict the least recently used beyond expression_cache_size
+  CompiledExpression Resolve(std::shared_ptr<const Expression> program,
+                             const std::string &suit) const;
+  void ForgetExpressions() {
+    if (expressions.empty()) return;
+    expressions.clear();
+    expression_index.clear();
+  }
+  bool Commit(const Transaction &tx, std::string &error);
+  // extend the reverse dependencies of sources to any added since the last call
+  void IndexSources();
+  struct BatchGuard {
+    explicit BatchGuard(Deck &deck_) : deck(deck_) { deck.BeginBatch(); }
+    ~BatchGuard() { deck.EndBatch(); }
+    Deck &deck;
+  };
+  struct Binding {
+    void *host;
+    void (*write)(void *host, const Card &card);
+  };
+  void WriteBindings(const std::string &suit, const std::string &name);
+  // publish the bound cards whose compiler value changed, after RecompileCard
+  void PublishBound();
+  struct Subscription {
+    std::size_t id;
+    std::string pattern;
+    ChangeCallback callback;
+  };
+  void InheritSuit(const std::string &child, const std::string &parent,
+                   pips::VTable &locals, const int line_num);
+  // lookup that falls through to parent suits; nullptr if the card does not exist
+  const Card *FindCard(const std::string &suit, const std::string &name) const;
+  // the suit's own copy of a card, copied from the parent on first write
+  Card &OwnCard(const std::string &suit, const std::string &name);
+  // Link a string card to the arena: long text is interned and referenced from the
+  // value, and arena references coming from the compiler get their text back.
+  Card &Adopt(Card &card);
+  // the arena for writing; a copy that still shares its arena clones it first, so
+  // copies used on other threads never intern into the same arena
+  StringArena &OwnArena();
+  bool CompileString(std::string_view global_name, std::string_view expr,
+                     pips::VTable &locals);
+  std::string UnitSystem(const int line_num);
   pips::VM vm;
+  // shared by copies until one of them interns a string, see OwnArena
+  std::shared_ptr<StringArena> arena = std::make_shared<StringArena>();
   std::map<std::string, std::map<std::string, Card>> deck = {{"/", {}}};
   std::vector<std::string> suits = {"/"}; // suits in order
   std::map<std::string, std::vector<std::string>> card_map; // cards in order 
+  // compiler global -> known dimension
+  std::map<std::string, Dimension, std::less<>> dimensions;
+  std::vector<CardSource> sources; // card expressions in compile order
+  std::map<std::string, std::string> suit_parents; // child suit -> parent suit
+  std::set<std::string> inherited; // compiler globals shared from a parent suit
+  std::vector<JournalEntry> journal; // changes since the last checkpoint
+  int cycle = 0;
+  CardMetadata metadata = CardMetadata::FULL;
+  // build metadata keyed by compiler global name in COLD mode, shared by copies
+  std::shared_ptr<const std::map<std::string, CardMeta>> cold_meta;
+  std::size_t scan_chunk_size = std::size_t(1) << 22; // 4 MB, see SetScanChunkSize
+  unsigned scan_threads = 0;
+  std::vector<SampledCard> sampled; // card ~ distribution(...) declarations
+  // compiler globals read by loop bounds, block and suit conditions and sampling
+  // arguments while building
+  std::set<std::string> build_inputs;
+  // reverse dependencies of the cards, built on the first transaction
+  std::vector<std::optional<Expression>> compiled_sources;
+  std::unordered_map<std::string, std::vector<std::size_t>> dependents;
+  std::unordered_map<std::string, std::size_t> source_index; // latest definition
+  // observers of this object; copies of the deck start without any
+  std::map<std::pair<std::string, std::string>, std::vector<Binding>> bindings;
+  std::vector<Subscription> subscriptions;
+  std::vector<JournalEntry> pending_changes;
+  std::size_t next_subscription = 0;
+  int batch_depth = 0;
+  // Eval cache keyed by suit and text, most recently used first
+  std::list<CompiledExpression> expressions;
+  // text -> its entries, one per suit the names were resolved in
+  std::unordered_map<std::string, std::vector<std::list<CompiledExpression>::iterator>>
+      expression_index;
+  std::size_t expression_cache_size = 256;
 };
 
 } // namespace Rummy
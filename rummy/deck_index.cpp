@@ -0,0 +1,484 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "deck.hpp"
+#include "deck_index.hpp"
+#include "rummy_utils.hpp"
+
+namespace Rummy {
+
+namespace {
+constexpr char kIndexMagic[8] = {'R', 'U', 'M', 'M', 'Y', 'I', 'D', 'X'};
+constexpr std::uint32_t kIndexVersion = 1;
+
+// Branch-free scan kernels. mask[i] stays set only if the row has a value and
+// the comparison holds; written as plain loops over contiguous arrays so the
+// compiler can vectorize them.
+template <typename T, typename Cmp>
+void ScanLoop(const T *x, const std::uint8_t *valid, std::uint8_t *mask, std::size_t n,
+              Cmp cmp) {
+  for (std::size_t i = 0; i < n; i++) {
+    mask[i] &= valid[i] & static_cast<std::uint8_t>(cmp(x[i]));
+  }
+}
+
+template <typename T>
+void ScanOp(CompareOp op, const T *x, const std::uint8_t *valid, std::uint8_t *mask,
+            std::size_t n, T c) {
+  switch (op) {
+  case CompareOp::EQ:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v == c; });
+    break;
+  case CompareOp::NE:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v != c; });
+    break;
+  case CompareOp::LT:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v < c; });
+    break;
+  case CompareOp::LE:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v <= c; });
+    break;
+  case CompareOp::GT:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v > c; });
+    break;
+  case CompareOp::GE:
+    ScanLoop(x, valid, mask, n, [c](T v) { return v >= c; });
+    break;
+  }
+}
+
+template <typename T>
+bool Compare(CompareOp op, const T &a, const T &b) {
+  switch (op) {
+  case CompareOp::EQ:
+    return a == b;
+  case CompareOp::NE:
+    return a != b;
+  case CompareOp::LT:
+    return a < b;
+  case CompareOp::LE:
+    return a <= b;
+  case CompareOp::GT:
+    return a > b;
+  case CompareOp::GE:
+    return a >= b;
+  }
+  return false;
+}
+
+template <typename T>
+void WriteVector(std::ostream &os, const std::vector<T> &vec) {
+  WritePod(os, static_cast<std::uint64_t>(vec.size()));
+  os.write(reinterpret_cast<const char *>(vec.data()), vec.size() * sizeof(T));
+}
+// Every column holds one entry per row; the row count was read entry by entry, so a
+// corrupt count cannot allocate more than the file holds.
+template <typename T>
+void ReadVector(std::istream &is, std::vector<T> &vec, std::uint64_t nrows) {
+  if (ReadPod<std::uint64_t>(is) != nrows) fatal("Corrupt column in deck index file");
+  vec.resize(nrows);
+  is.read(reinterpret_cast<char *>(vec.data()), vec.size() * sizeof(T));
+  if (!is) fatal("Unexpected end of file while reading deck index");
+}
+
+std::string ColumnName(const std::string &suit, const std::string &card) {
+  return (suit == "/") ? card : suit + "/" + card;
+}
+} // namespace
+
+Predicate Predicate::Parse(const std::string &expr) {
+  Predicate pred;
+  auto op_pos = expr.find_first_of("=!<>");
+  if (op_pos == std::string::npos || op_pos == 0) {
+    std::stringstream msg;
+    msg << "Malformed index query '" << expr << "'. Expected e.g. 'gas/eos/gamma < 1.5'";
+    fatal(msg);
+  }
+  auto op_len = 1;
+  const char c0 = expr[op_pos];
+  const char c1 = (op_pos + 1 < expr.size()) ? expr[op_pos + 1] : '\0';
+  if (c0 == '=') {
+    pred.op = CompareOp::EQ;
+    if (c1 == '=') op_len = 2;
+  } else if (c0 == '!' && c1 == '=') {
+    pred.op = CompareOp::NE;
+    op_len = 2;
+  } else if (c0 == '<') {
+    pred.op = (c1 == '=') ? CompareOp::LE : CompareOp::LT;
+    if (c1 == '=') op_len = 2;
+  } else if (c0 == '>') {
+    pred.op = (c1 == '=') ? CompareOp::GE : CompareOp::GT;
+    if (c1 == '=') op_len = 2;
+  } else {
+    std::stringstream msg;
+    msg << "Unknown operator in index query '" << expr << "'";
+    fatal(msg);
+  }
+  pred.column = expr.substr(0, op_pos);
+  RemoveWhitespace(pred.column);
+  std::string value = expr.substr(op_pos + op_len);
+  RemoveLeadingWhitespace(value);
+  RemoveTrailingWhitespace(value);
+  EmptyCheck(value, 0);
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+    pred.type = ColumnType::STRING;
+    pred.str = value.substr(1, value.size() - 2);
+  } else if (value == "true" || value == "false") {
+    pred.type = ColumnType::BOOL;
+    pred.boolean = (value == "true");
+  } else {
+    char *end = nullptr;
+    pred.type = ColumnType::NUMBER;
+    pred.number = std::strtod(value.c_str(), &end);
+    if (end == value.c_str() || *end != '\0') {
+      // bare words compare as strings
+      pred.type = ColumnType::STRING;
+      pred.str = value;
+    }
+  }
+  return pred;
+}
+
+std::vector<std::string> DeckIndex::GetColumnNames() const {
+  std::vector<std::string> names;
+  names.reserve(columns.size());
+  for (const auto &column : columns) {
+    names.push_back(column.first);
+  }
+  return names;
+}
+
+std::size_t DeckIndex::Row(const std::string &path, std::int64_t mtime) {
+  auto it = rows.find(path);
+  if (it != rows.end()) {
+    // refreshing an existing row: drop its old values
+    const auto row = it->second;
+    mtimes[row] = mtime;
+    for (auto &column : columns) {
+      column.second.valid[row] = 0;
+    }
+    return row;
+  }
+  const auto row = paths.size();
+  paths.push_back(path);
+  mtimes.push_back(mtime);
+  rows[path] = row;
+  for (auto &[name, column] : columns) {
+    column.valid.push_back(0);
+    if (column.type == ColumnType::NUMBER) {
+      column.numbers.push_back(0.0);
+    } else if (column.type == ColumnType::BOOL) {
+      column.bools.push_back(0);
+    } else {
+      column.codes.push_back(0);
+    }
+  }
+  return row;
+}
+
+void DeckIndex::SetValue(Column &column, const std::string &name, std::size_t row,
+                         const Card &card) {
+  const auto value = card.GetValue();
+  if (value.type == pips::ValueType::NUMBER && column.type == ColumnType::NUMBER) {
+    column.numbers[row] = value.as.number;
+  } else if (value.type == pips::ValueType::BOOL && column.type == ColumnType::BOOL) {
+    column.bools[row] = value.as.boolean;
+  } else if (value.type == pips::ValueType::STRING && column.type == ColumnType::STRING) {
+    std::string str(card.GetStringView());
+    auto it = column.dictionary_ids.find(str);
+    if (it == column.dictionary_ids.end()) {
+      it = column.dictionary_ids
+               .emplace(str, static_cast<std::uint32_t>(column.dictionary.size()))
+               .first;
+      column.dictionary.push_back(str);
+    }
+    column.codes[row] = it->second;
+  } else {
+    std::cerr << "Deck index: type of '" << name << "' in '" << paths[row]
+              << "' does not match the column type; value not indexed." << std::endl;
+    return;
+  }
+  column.valid[row] = 1;
+}
+
+void DeckIndex::AddDeck(const std::string &path, const Deck &deck, std::int64_t mtime) {
+  const auto row = Row(path, mtime);
+  const auto nrows = NumRows();
+  for (const auto &suit_pair : deck.GetDeck()) {
+    const auto &suit = suit_pair.first;
+    for (const auto &[card_name, card] : deck.FindSuit(suit)) {
+      const auto name = ColumnName(suit, card_name);
+      const auto value = card.GetValue();
+      auto it = columns.find(name);
+      if (it == columns.end()) {
+        Column column;
+        if (value.type == pips::ValueType::NUMBER) {
+          column.type = ColumnType::NUMBER;
+          column.numbers.resize(nrows, 0.0);
+        } else if (value.type == pips::ValueType::BOOL) {
+          column.type = ColumnType::BOOL;
+          column.bools.resize(nrows, 0);
+        } else if (value.type == pips::ValueType::STRING) {
+          column.type = ColumnType::STRING;
+          column.codes.resize(nrows, 0);
+        } else {
+          continue;
+        }
+        column.valid.resize(nrows, 0);
+        it = columns.emplace(name, std::move(column)).first;
+      }
+      SetValue(it->second, name, row, card);
+    }
+  }
+}
+
+bool DeckIndex::AddDeck(const std::string &path) {
+  std::error_code ec;
+  const auto stamp = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    std::stringstream msg;
+    msg << "Could not open file '" << path << "'";
+    fatal(msg);
+  }
+  const std::int64_t mtime = stamp.time_since_epoch().count();
+  auto it = rows.find(path);
+  if (it != rows.end() && mtimes[it->second] == mtime) return false;
+  Deck deck;
+  deck.Build(path);
+  AddDeck(path, deck, mtime);
+  return true;
+}
+
+std::size_t DeckIndex::AddDirectory(const std::string &dir, const std::string &extension,
+                                    bool recursive) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> files;
+  auto collect = [&](const fs::directory_entry &entry) {
+    if (entry.is_regular_file() && entry.path().extension() == extension) {
+      files.push_back(entry.path().string());
+    }
+  };
+  if (recursive) {
+    for (const auto &entry : fs::recursive_directory_iterator(dir)) collect(entry);
+  } else {
+    for (const auto &entry : fs::directory_iterator(dir)) collect(entry);
+  }
+  // deterministic row order
+  std::sort(files.begin(), files.end());
+  std::size_t count = 0;
+  for (const auto &file : files) {
+    count += AddDeck(file) ? 1 : 0;
+  }
+  return count;
+}
+
+void DeckIndex::ScanColumn(const Column &column, const Predicate &pred,
+                           std::vector<std::uint8_t> &mask) const {
+  const auto n = mask.size();
+  const auto *valid = column.valid.data();
+  auto *m = mask.data();
+  if (column.type == ColumnType::NUMBER && pred.type != ColumnType::STRING) {
+    const double c = (pred.type == ColumnType::BOOL) ? pred.boolean : pred.number;
+    ScanOp(pred.op, column.numbers.data(), valid, m, n, c);
+  } else if (column.type == ColumnType::BOOL && pred.type != ColumnType::STRING) {
+    const std::uint8_t c =
+        (pred.type == ColumnType::BOOL) ? pred.boolean : (pred.number != 0.0);
+    ScanOp(pred.op, column.bools.data(), valid, m, n, c);
+  } else if (column.type == ColumnType::STRING && pred.type == ColumnType::STRING) {
+    // evaluate the predicate once per dictionary entry, then gather by code
+    std::vector<std::uint8_t> pass(column.dictionary.size());
+    for (std::size_t i = 0; i < pass.size(); i++) {
+      pass[i] = Compare(pred.op, column.dictionary[i], pred.str);
+    }
+    const auto *codes = column.codes.data();
+    for (std::size_t i = 0; i < n; i++) {
+      m[i] &= valid[i] & (pass.empty() ? 0 : pass[codes[i]]);
+    }
+  } else {
+    std::fill(mask.begin(), mask.end(), 0);
+  }
+}
+
+std::vector<std::size_t> DeckIndex::Filter(const std::vector<Predicate> &predicates) const {
+  std::vector<std::uint8_t> mask(NumRows(), 1);
+  for (const auto &pred : predicates) {
+    auto it = columns.find(pred.column);
+    if (it == columns.end()) {
+      // no deck has this card
+      return {};
+    }
+    ScanColumn(it->second, pred, mask);
+  }
+  std::vector<std::size_t> result;
+  for (std::size_t i = 0; i < mask.size(); i++) {
+    if (mask[i]) result.push_back(i);
+  }
+  return result;
+}
+
+std::vector<std::size_t> DeckIndex::Query(const std::vector<std::string> &predicates) const {
+  std::vector<Predicate> parsed;
+  parsed.reserve(predicates.size());
+  for (const auto &expr : predicates) {
+    parsed.push_back(Predicate::Parse(expr));
+  }
+  return Filter(parsed);
+}
+
+std::optional<pips::Value> DeckIndex::Get(std::size_t row, const std::string &column) const {
+  auto it = columns.find(column);
+  if (it == columns.end() || row >= NumRows() || !it->second.valid[row]) return std::nullopt;
+  const auto &col = it->second;
+  if (col.type == ColumnType::NUMBER) return pips::Value(col.numbers[row]);
+  if (col.type == ColumnType::BOOL) return pips::Value(static_cast<bool>(col.bools[row]));
+  return pips::Value(col.dictionary[col.codes[row]]);
+}
+
+std::vector<std::vector<std::string>>
+DeckIndex::Project(const std::vector<std::size_t> &rows_,
+                   const std::vector<std::string> &cols) const {
+  std::vector<std::vector<std::string>> table;
+  table.reserve(rows_.size());
+  for (const auto row : rows_) {
+    std::vector<std::string> values;
+    values.reserve(cols.size());
+    for (const auto &col : cols) {
+      auto value = Get(row, col);
+      values.push_back(value ? Card("", col, *value, "").GetString() : "");
+    }
+    table.push_back(std::move(values));
+  }
+  return table;
+}
+
+void DeckIndex::Write(const std::string &fname) const {
+  std::ofstream os(fname, std::ios::binary);
+  if (!os.is_open()) {
+    std::stringstream msg;
+    msg << "Could not open file '" << fname << "'";
+    fatal(msg);
+  }
+  Write(os);
+}
+
+void DeckIndex::Write(std::ostream &os) const {
+  os.write(kIndexMagic, sizeof(kIndexMagic));
+  WritePod(os, kIndexVersion);
+  WritePod(os, static_cast<std::uint64_t>(paths.size()));
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    WriteBytes(os, paths[i]);
+    WritePod(os, mtimes[i]);
+  }
+  WritePod(os, static_cast<std::uint64_t>(columns.size()));
+  for (const auto &[name, column] : columns) {
+    WriteBytes(os, name);
+    WritePod(os, static_cast<std::uint8_t>(column.type));
+    WriteVector(os, column.valid);
+    if (column.type == ColumnType::NUMBER) {
+      WriteVector(os, column.numbers);
+    } else if (column.type == ColumnType::BOOL) {
+      WriteVector(os, column.bools);
+    } else {
+      WriteVector(os, column.codes);
+      WritePod(os, static_cast<std::uint64_t>(column.dictionary.size()));
+      for (const auto &str : column.dictionary) {
+        WriteBytes(os, str);
+      }
+    }
+  }
+}
+
+void DeckIndex::Read(const std::string &fname) {
+  std::ifstream is(fname, std::ios::binary);
+  if (!is.is_open()) {
+    std::stringstream msg;
+    msg << "Could not open file '" << fname << "'";
+    fatal(msg);
+  }
+  Read(is);
+}
+
+void DeckIndex::Read(std::istream &is) {
+  char magic[sizeof(kIndexMagic)];
+  is.read(magic, sizeof(magic));
+  if (!is || std::memcmp(magic, kIndexMagic, sizeof(magic)) != 0) {
+    fatal("Input is not a Rummy deck index file");
+  }
+  if (ReadPod<std::uint32_t>(is) != kIndexVersion) {
+    fatal("Unsupported Rummy deck index file version");
+  }
+  *this = DeckIndex();
+  // counts are not trusted: rows, columns and dictionary entries are read one by one,
+  // so a bad count runs into the end of the file instead of a huge allocation
+  const auto nrows = ReadPod<std::uint64_t>(is);
+  for (std::uint64_t i = 0; i < nrows; i++) {
+    paths.push_back(ReadBytes(is));
+    mtimes.push_back(ReadPod<std::int64_t>(is));
+    rows[paths.back()] = i;
+  }
+  if (rows.size() != nrows) fatal("Corrupt row table in deck index file");
+  const auto ncols = ReadPod<std::uint64_t>(is);
+  for (std::uint64_t c = 0; c < ncols; c++) {
+    auto name = ReadBytes(is);
+    Column column;
+    const auto type = ReadPod<std::uint8_t>(is);
+    if (type > static_cast<std::uint8_t>(ColumnType::STRING)) {
+      fatal("Corrupt column type in deck index file");
+    }
+    column.type = static_cast<ColumnType>(type);
+    ReadVector(is, column.valid, nrows);
+    if (column.type == ColumnType::NUMBER) {
+      ReadVector(is, column.numbers, nrows);
+    } else if (column.type == ColumnType::BOOL) {
+      ReadVector(is, column.bools, nrows);
+    } else {
+      ReadVector(is, column.codes, nrows);
+      const auto ndict = ReadPod<std::uint64_t>(is);
+      for (std::uint64_t i = 0; i < ndict; i++) {
+        column.dictionary.push_back(ReadBytes(is));
+        column.dictionary_ids[column.dictionary.back()] = static_cast<std::uint32_t>(i);
+      }
+      if (column.dictionary_ids.size() != ndict) {
+        fatal("Corrupt dictionary in deck index file");
+      }
+      // rows without a value keep code 0, which the scan reads when the dictionary
+      // is not empty
+      for (std::uint64_t i = 0; i < nrows; i++) {
+        if (column.codes[i] >= std::max<std::uint64_t>(ndict, 1) ||
+            (column.valid[i] && column.codes[i] >= ndict)) {
+          fatal("Corrupt string code in deck index file");
+        }
+      }
+    }
+    for (const auto valid : column.valid) {
+      if (valid > 1) fatal("Corrupt column in deck index file");
+    }
+    if (!columns.emplace(std::move(name), std::move(column)).second) {
+      fatal("Corrupt column table in deck index file");
+    }
+  }
+}
+
+} // namespace Rummy
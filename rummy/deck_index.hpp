@@ -0,0 +1,108 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_DECK_INDEX_HPP_
+#define RUMMY_DECK_INDEX_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "deck.hpp"
+#include <pips/value_types.hpp>
+
+namespace Rummy {
+
+enum class ColumnType : std::uint8_t { NUMBER, BOOL, STRING };
+enum class CompareOp : std::uint8_t { EQ, NE, LT, LE, GT, GE };
+
+// One column per card path (e.g. "gas/eos/gamma"). Values are stored contiguously
+// by type; strings are dictionary encoded. valid[row] is 0 when the deck of that
+// row did not have the card.
+struct Column {
+  ColumnType type = ColumnType::NUMBER;
+  std::vector<std::uint8_t> valid;
+  std::vector<double> numbers;
+  std::vector<std::uint8_t> bools;
+  std::vector<std::uint32_t> codes;
+  std::vector<std::string> dictionary;
+  std::unordered_map<std::string, std::uint32_t> dictionary_ids;
+};
+
+// A single filter term such as "gas/eos/gamma < 1.5"
+struct Predicate {
+  std::string column;
+  CompareOp op = CompareOp::EQ;
+  ColumnType type = ColumnType::NUMBER;
+  double number = 0.0;
+  bool boolean = false;
+  std::string str;
+  static Predicate Parse(const std::string &expr);
+};
+
+class DeckIndex {
+ public:
+  DeckIndex() = default;
+
+  std::size_t NumRows() const { return paths.size(); }
+  std::size_t NumColumns() const { return columns.size(); }
+  const std::vector<std::string> &GetPaths() const { return paths; }
+  std::vector<std::string> GetColumnNames() const;
+  bool HasColumn(const std::string &name) const { return columns.count(name) > 0; }
+
+  // Build the deck at path and index it. Decks already indexed are skipped unless
+  // the file changed since; returns true if the index was modified.
+  bool AddDeck(const std::string &path);
+  // Index an already built deck under the given row name
+  void AddDeck(const std::string &path, const Deck &deck, std::int64_t mtime = 0);
+  // Index every file under dir with the given extension; returns the number of
+  // decks that were added or refreshed.
+  std::size_t AddDirectory(const std::string &dir, const std::string &extension = ".par",
+                           bool recursive = true);
+
+  // Rows that satisfy every predicate. Query parses predicates like "gas/eos/gamma < 1.5"
+  std::vector<std::size_t> Filter(const std::vector<Predicate> &predicates) const;
+  std::vector<std::size_t> Query(const std::vector<std::string> &predicates) const;
+  // Values of the requested columns for the requested rows, formatted as strings.
+  // Missing values are empty strings.
+  std::vector<std::vector<std::string>> Project(const std::vector<std::size_t> &rows,
+                                                const std::vector<std::string> &cols) const;
+  std::optional<pips::Value> Get(std::size_t row, const std::string &column) const;
+
+  void Write(const std::string &fname) const;
+  void Write(std::ostream &os) const;
+  void Read(const std::string &fname);
+  void Read(std::istream &is);
+
+ private:
+  std::size_t Row(const std::string &path, std::int64_t mtime);
+  void SetValue(Column &column, const std::string &name, std::size_t row,
+                const Card &card);
+  void ScanColumn(const Column &column, const Predicate &pred,
+                  std::vector<std::uint8_t> &mask) const;
+
+  std::vector<std::string> paths;
+  std::vector<std::int64_t> mtimes;
+  std::unordered_map<std::string, std::size_t> rows;
+  std::map<std::string, Column> columns;
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_DECK_INDEX_HPP_
@@ -0,0 +1,387 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "deck.hpp"
+#include "ensemble.hpp"
+#include "rummy_utils.hpp"
+
+namespace Rummy {
+
+namespace {
+constexpr char kEnsembleMagic[8] = {'R', 'U', 'M', 'M', 'Y', 'E', 'N', 'S'};
+constexpr std::uint32_t kEnsembleVersion = 1;
+} // namespace
+
+// ----------------------------------------------------------------------------------
+// EnsembleMember
+// ----------------------------------------------------------------------------------
+std::size_t EnsembleMember::NumChanges() const {
+  return ensemble->offsets[index + 1] - ensemble->offsets[index];
+}
+
+const DeltaValue *EnsembleMember::Find(const std::string &suit,
+                                       const std::string &name) const {
+  auto id = ensemble->FindCardId(suit, name);
+  if (!id) return nullptr;
+  auto first = ensemble->deltas.begin() + ensemble->offsets[index];
+  auto last = ensemble->deltas.begin() + ensemble->offsets[index + 1];
+  auto it = std::lower_bound(first, last, *id, [](const DeltaValue &d, std::uint32_t c) {
+    return d.card < c;
+  });
+  if (it == last || it->card != *id) return nullptr;
+  return &(*it);
+}
+
+bool EnsembleMember::DoesCardExist(const std::string &suit, const std::string &name) const {
+  return (Find(suit, name) != nullptr) || ensemble->base.DoesCardExist(suit, name);
+}
+
+Card EnsembleMember::GetCard(const std::string &suit, const std::string &name) const {
+  const auto *delta = Find(suit, name);
+  if (delta == nullptr) return ensemble->base.GetCard(suit, name);
+  const auto &base_deck = ensemble->base.GetDeck();
+  auto suit_it = base_deck.find(suit);
+  if (suit_it != base_deck.end()) {
+    auto card_it = suit_it->second.find(name);
+    if (card_it != suit_it->second.end()) {
+      const auto &base_card = card_it->second;
+      return ensemble->Decode(*delta, suit, name, base_card.comment, base_card.loc);
+    }
+  }
+  return ensemble->Decode(*delta, suit, name, "", -1);
+}
+
+std::vector<Card> EnsembleMember::GetChanges() const {
+  std::vector<Card> changes;
+  changes.reserve(NumChanges());
+  for (auto i = ensemble->offsets[index]; i < ensemble->offsets[index + 1]; i++) {
+    const auto &delta = ensemble->deltas[i];
+    const auto &[suit, name] = ensemble->cards[delta.card];
+    changes.push_back(GetCard(suit, name));
+  }
+  return changes;
+}
+
+Deck EnsembleMember::Materialize() const {
+  Deck deck = ensemble->base;
+  for (const auto &card : GetChanges()) {
+    if (deck.DoesSuitExist(card.suit) && deck.DoesCardExist(card.suit, card.name)) {
+      deck.UpdateCard(card.suit, card.name, card);
+    } else {
+      deck.AddCard(card.suit, card.name, card);
+    }
+  }
+  // the member values are the starting point of the deck, not runtime changes
+  deck.Checkpoint();
+  return deck;
+}
+
+void EnsembleMember::WriteDeck(std::ostream &os) const { Materialize().WriteDeck(os); }
+
+// ----------------------------------------------------------------------------------
+// Ensemble
+// ----------------------------------------------------------------------------------
+std::optional<std::uint32_t> Ensemble::FindCardId(const std::string &suit,
+                                                  const std::string &name) const {
+  auto it = card_ids.find({suit, name});
+  if (it == card_ids.end()) return std::nullopt;
+  return it->second;
+}
+
+std::uint32_t Ensemble::CardId(const std::string &suit, const std::string &name) {
+  auto it = card_ids.find({suit, name});
+  if (it != card_ids.end()) return it->second;
+  const auto id = static_cast<std::uint32_t>(cards.size());
+  cards.push_back({suit, name});
+  card_ids[{suit, name}] = id;
+  return id;
+}
+
+DeltaValue Ensemble::Encode(std::uint32_t card, const Card &full_card) {
+  const auto value = full_card.GetValue();
+  DeltaValue delta;
+  std::memset(&delta, 0, sizeof(DeltaValue));
+  delta.card = card;
+  delta.type = value.type;
+  if (value.type == pips::ValueType::NUMBER) {
+    delta.as.number = value.as.number;
+  } else if (value.type == pips::ValueType::BOOL) {
+    delta.as.boolean = value.as.boolean;
+  } else if (value.type == pips::ValueType::STRING) {
+    std::string str(full_card.GetStringView());
+    auto it = string_ids.find(str);
+    if (it == string_ids.end()) {
+      it = string_ids.emplace(str, static_cast<std::uint32_t>(strings.size())).first;
+      strings.push_back(str);
+    }
+    delta.as.str = it->second;
+  } else {
+    fatal("Value type is not supported in an ensemble delta");
+  }
+  return delta;
+}
+
+Card Ensemble::Decode(const DeltaValue &delta, const std::string &suit,
+                      const std::string &name, const std::string &comment, int loc) const {
+  if (delta.type == pips::ValueType::NUMBER) {
+    return Card(suit, name, pips::Value(delta.as.number), comment, loc);
+  } else if (delta.type == pips::ValueType::BOOL) {
+    return Card(suit, name, pips::Value(delta.as.boolean), comment, loc);
+  }
+  return Card(suit, name, strings.at(delta.as.str), comment, loc);
+}
+
+std::size_t Ensemble::CommitMember(std::vector<DeltaValue> &member_deltas) {
+  std::stable_sort(member_deltas.begin(), member_deltas.end(),
+                   [](const DeltaValue &a, const DeltaValue &b) { return a.card < b.card; });
+  // a card listed twice keeps its last value
+  auto last = std::unique(member_deltas.rbegin(), member_deltas.rend(),
+                          [](const DeltaValue &a, const DeltaValue &b) {
+                            return a.card == b.card;
+                          });
+  member_deltas.erase(member_deltas.begin(), last.base());
+  deltas.insert(deltas.end(), member_deltas.begin(), member_deltas.end());
+  offsets.push_back(deltas.size());
+  return size() - 1;
+}
+
+std::size_t Ensemble::AddMember(const Deck &member) {
+  std::vector<DeltaValue> member_deltas;
+  const auto &base_deck = base.GetDeck();
+  for (const auto &[suit, cards_in_suit] : member.GetDeck()) {
+    auto base_suit = base_deck.find(suit);
+    for (const auto &[name, card] : cards_in_suit) {
+      if (base_suit != base_deck.end()) {
+        auto base_card = base_suit->second.find(name);
+        if ((base_card != base_suit->second.end()) && SameCardValue(base_card->second, card)) {
+          continue;
+        }
+      }
+      member_deltas.push_back(Encode(CardId(suit, name), card));
+    }
+  }
+  // members are overlays, so every base card must still be present
+  for (const auto &[suit, cards_in_suit] : base_deck) {
+    for (const auto &card : cards_in_suit) {
+      if (!member.DoesSuitExist(suit) || !member.GetSuit(suit).count(card.first)) {
+        std::stringstream msg;
+        msg << "Ensemble member is missing base card '" << suit << "/" << card.first
+            << "'";
+        fatal(msg);
+      }
+    }
+  }
+  return CommitMember(member_deltas);
+}
+
+std::size_t Ensemble::AddMember(const std::vector<Card> &changes) {
+  std::vector<DeltaValue> member_deltas;
+  member_deltas.reserve(changes.size());
+  for (const auto &card : changes) {
+    member_deltas.push_back(Encode(CardId(card.suit, card.name), card));
+  }
+  return CommitMember(member_deltas);
+}
+
+Ensemble Ensemble::Sample(const Deck &base, unsigned threads) {
+  return Sample(base, SamplingDesign::FromDeck(base), threads);
+}
+
+Ensemble Ensemble::Sample(const Deck &base, const SamplingDesign &design,
+                          unsigned threads) {
+  const auto &sampled = base.GetSampledCards();
+  if (sampled.empty()) {
+    fatal("Deck has no sampled cards (e.g. 'rho ~ uniform(0.9, 1.1)')");
+  }
+  const auto dims = sampled.size();
+  const auto points = DesignPoints(design, dims);
+
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  const std::size_t nworkers =
+      std::max<std::size_t>(1, std::min<std::size_t>(threads, design.n));
+  // one working copy of the base per worker; copies are made before any thread runs
+  std::vector<Deck> work(nworkers, base);
+  std::vector<std::vector<Card>> changes(design.n);
+  auto run = [&](std::size_t worker) {
+    Deck &deck = work[worker];
+    // every card a member has changed; the others still hold their base value
+    std::set<std::pair<std::string, std::string>> touched;
+    std::size_t mark = deck.GetJournal().size();
+    const auto first = worker * design.n / nworkers;
+    const auto last = (worker + 1) * design.n / nworkers;
+    for (auto i = first; i < last; i++) {
+      auto tx = deck.Begin();
+      for (std::size_t d = 0; d < dims; d++) {
+        const auto &card = sampled[d];
+        tx.Set(card.suit, card.name, card.Quantile(points[i * dims + d]));
+      }
+      if (!tx.Commit()) {
+        std::stringstream msg;
+        msg << "Ensemble member " << i << " could not be evaluated: " << tx.Error();
+        fatal(msg);
+      }
+      const auto &journal = deck.GetJournal();
+      for (; mark < journal.size(); mark++) {
+        touched.insert({journal[mark].suit, journal[mark].name});
+      }
+      for (const auto &[suit, name] : touched) {
+        const auto &card = deck.GetCard(suit, name);
+        if (!SameCardValue(card, base.GetCard(suit, name))) changes[i].push_back(card);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (std::size_t w = 1; w < nworkers; w++) workers.emplace_back(run, w);
+  run(0);
+  for (auto &worker : workers) worker.join();
+
+  Ensemble ensemble(base);
+  for (const auto &member : changes) ensemble.AddMember(member);
+  return ensemble;
+}
+
+EnsembleMember Ensemble::Member(std::size_t i) const {
+  if (i >= size()) {
+    std::stringstream msg;
+    msg << "Ensemble member " << i << " out of range (size " << size() << ")";
+    fatal(msg);
+  }
+  return EnsembleMember(*this, i);
+}
+
+void Ensemble::Write(const std::string &fname) const {
+  std::ofstream os(fname, std::ios::binary);
+  if (!os.is_open()) {
+    std::stringstream msg;
+    msg << "Could not open file '" << fname << "'";
+    fatal(msg);
+  }
+  Write(os);
+}
+
+void Ensemble::Write(std::ostream &os) const {
+  os.write(kEnsembleMagic, sizeof(kEnsembleMagic));
+  WritePod(os, kEnsembleVersion);
+  std::stringstream base_ss;
+  base.WriteDeck(base_ss);
+  WriteBytes(os, base_ss.str());
+
+  WritePod(os, static_cast<std::uint64_t>(cards.size()));
+  for (const auto &[suit, name] : cards) {
+    WriteBytes(os, suit);
+    WriteBytes(os, name);
+  }
+  WritePod(os, static_cast<std::uint64_t>(strings.size()));
+  for (const auto &str : strings) {
+    WriteBytes(os, str);
+  }
+  WritePod(os, static_cast<std::uint64_t>(offsets.size()));
+  os.write(reinterpret_cast<const char *>(offsets.data()),
+           offsets.size() * sizeof(std::uint64_t));
+  for (const auto &delta : deltas) {
+    WritePod(os, delta.card);
+    WritePod(os, static_cast<std::uint8_t>(delta.type));
+    WritePod(os, delta.as);
+  }
+}
+
+void Ensemble::Read(const std::string &fname) {
+  std::ifstream is(fname, std::ios::binary);
+  if (!is.is_open()) {
+    std::stringstream msg;
+    msg << "Could not open file '" << fname << "'";
+    fatal(msg);
+  }
+  Read(is);
+}
+
+void Ensemble::Read(std::istream &is) {
+  char magic[sizeof(kEnsembleMagic)];
+  is.read(magic, sizeof(magic));
+  if (!is || std::memcmp(magic, kEnsembleMagic, sizeof(magic)) != 0) {
+    fatal("Input is not a Rummy ensemble file");
+  }
+  if (ReadPod<std::uint32_t>(is) != kEnsembleVersion) {
+    fatal("Unsupported Rummy ensemble file version");
+  }
+  *this = Ensemble();
+  std::stringstream base_ss(ReadBytes(is));
+  base.Build(base_ss);
+
+  const auto ncards = ReadPod<std::uint64_t>(is);
+  for (std::uint64_t i = 0; i < ncards; i++) {
+    auto suit = ReadBytes(is);
+    auto name = ReadBytes(is);
+    CardId(suit, name);
+  }
+  if (cards.size() != ncards) fatal("Corrupt card table in ensemble file");
+  const auto nstrings = ReadPod<std::uint64_t>(is);
+  for (std::uint64_t i = 0; i < nstrings; i++) {
+    string_ids[ReadBytes(is)] = static_cast<std::uint32_t>(i);
+  }
+  if (string_ids.size() != nstrings) fatal("Corrupt string table in ensemble file");
+  strings.resize(nstrings);
+  for (const auto &[str, id] : string_ids) {
+    strings[id] = str;
+  }
+  // sizes are not trusted: entries are read one by one, so a bad count runs into the
+  // end of the file instead of a huge allocation
+  const auto noffsets = ReadPod<std::uint64_t>(is);
+  offsets.clear();
+  for (std::uint64_t i = 0; i < noffsets; i++) {
+    const auto offset = ReadPod<std::uint64_t>(is);
+    // starts at 0 and never decreases
+    if (offset < (offsets.empty() ? 0 : offsets.back()) || (offsets.empty() && offset)) {
+      fatal("Corrupt member index in ensemble file");
+    }
+    offsets.push_back(offset);
+  }
+  if (offsets.empty()) fatal("Corrupt member index in ensemble file");
+  for (std::size_t m = 0; m + 1 < offsets.size(); m++) {
+    for (auto i = offsets[m]; i < offsets[m + 1]; i++) {
+      DeltaValue delta;
+      std::memset(&delta, 0, sizeof(DeltaValue));
+      delta.card = ReadPod<std::uint32_t>(is);
+      delta.type = static_cast<pips::ValueType>(ReadPod<std::uint8_t>(is));
+      delta.as = ReadPod<decltype(delta.as)>(is);
+      // members are sorted by card, which Find relies on
+      const bool sorted = (i == offsets[m]) || (deltas.back().card < delta.card);
+      if (delta.card >= cards.size() || !sorted) {
+        fatal("Corrupt delta card in ensemble file");
+      }
+      const bool known_type = delta.type == pips::ValueType::NUMBER ||
+                              delta.type == pips::ValueType::BOOL ||
+                              delta.type == pips::ValueType::STRING;
+      if (!known_type || (delta.type == pips::ValueType::STRING &&
+                          delta.as.str >= strings.size())) {
+        fatal("Corrupt delta value in ensemble file");
+      }
+      deltas.push_back(delta);
+    }
+  }
+}
+
+} // namespace Rummy
@@ -0,0 +1,131 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_ENSEMBLE_HPP_
+#define RUMMY_ENSEMBLE_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "deck.hpp"
+#include "sampling.hpp"
+#include <pips/value_types.hpp>
+
+namespace Rummy {
+
+// One changed card of an ensemble member. Cards are referred to by their index in
+// the ensemble card table and strings by their index in the ensemble string table,
+// so a delta record is a fixed 16 bytes regardless of STRING_MAX.
+struct DeltaValue {
+  std::uint32_t card;
+  pips::ValueType type;
+  union {
+    double number;
+    bool boolean;
+    std::uint32_t str;
+  } as;
+};
+
+class Ensemble;
+
+// Lightweight read-only view of one ensemble member. Lookups check the member's
+// delta first and fall back to the base deck; nothing is copied until Materialize.
+class EnsembleMember {
+ public:
+  EnsembleMember(const Ensemble &ensemble, std::size_t index)
+      : ensemble(&ensemble), index(index) {}
+
+  std::size_t Index() const { return index; }
+  std::size_t NumChanges() const;
+  bool DoesCardExist(const std::string &suit, const std::string &name) const;
+  Card GetCard(const std::string &suit, const std::string &name) const;
+  template <typename T>
+  T GetCardValue(const std::string &suit, const std::string &name) const {
+    return GetCard(suit, name).Get<T>();
+  }
+  // Cards that differ from the base deck, in card table order
+  std::vector<Card> GetChanges() const;
+  // Build a full standalone deck for this member
+  Deck Materialize() const;
+  void WriteDeck(std::ostream &os) const;
+
+ private:
+  const DeltaValue *Find(const std::string &suit, const std::string &name) const;
+  const Ensemble *ensemble;
+  std::size_t index;
+};
+
+class Ensemble {
+ public:
+  Ensemble() = default;
+  explicit Ensemble(const Deck &base) : base(base) {}
+
+  const Deck &GetBase() const { return base; }
+  std::size_t size() const { return offsets.size() - 1; }
+  // total number of delta records over all members
+  std::size_t DeltaSize() const { return deltas.size(); }
+
+  // Add a member from a fully built deck. Only cards that differ from the base are kept.
+  std::size_t AddMember(const Deck &member);
+  // Add a member from an explicit list of changed cards
+  std::size_t AddMember(const std::vector<Card> &changes);
+
+  // Ensemble of design.n members drawn from the sampled cards of base (declared as
+  // "rho ~ uniform(0.9, 1.1)"). Each member sets the sampled cards and re-evaluates
+  // the numeric and boolean cards derived from them, as a Deck transaction would.
+  // Members are computed on up to threads threads (0 for one per core) and the result
+  // depends only on the design and seed. The overload reads the design from the
+  // <sampling> suit.
+  static Ensemble Sample(const Deck &base, const SamplingDesign &design,
+                         unsigned threads = 0);
+  static Ensemble Sample(const Deck &base, unsigned threads = 0);
+
+  EnsembleMember Member(std::size_t i) const;
+  EnsembleMember operator[](std::size_t i) const { return Member(i); }
+
+  // Single file layout: header, base deck (WriteDeck text), card and string tables,
+  // member offset index, then the delta records.
+  void Write(const std::string &fname) const;
+  void Write(std::ostream &os) const;
+  void Read(const std::string &fname);
+  void Read(std::istream &is);
+
+ private:
+  friend class EnsembleMember;
+  std::uint32_t CardId(const std::string &suit, const std::string &name);
+  std::optional<std::uint32_t> FindCardId(const std::string &suit,
+                                          const std::string &name) const;
+  DeltaValue Encode(std::uint32_t card, const Card &full_card);
+  Card Decode(const DeltaValue &delta, const std::string &suit, const std::string &name,
+              const std::string &comment, int loc) const;
+  std::size_t CommitMember(std::vector<DeltaValue> &member_deltas);
+
+  Deck base;
+  std::vector<std::pair<std::string, std::string>> cards; // card id -> (suit, name)
+  std::map<std::pair<std::string, std::string>, std::uint32_t> card_ids;
+  std::vector<std::string> strings; // interned string values
+  std::map<std::string, std::uint32_t> string_ids;
+  std::vector<std::uint64_t> offsets = {0}; // member i owns [offsets[i], offsets[i+1])
+  std::vector<DeltaValue> deltas;           // sorted by card id within a member
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_ENSEMBLE_HPP_
@@ -0,0 +1,103 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "deck.hpp"
+#include "evaluator.hpp"
+#include "rummy_utils.hpp"
+
+namespace Rummy {
+
+// ----------------------------------------------------------------------------------
+// DeckSnapshot
+// ----------------------------------------------------------------------------------
+std::optional<double> DeckSnapshot::Find(const std::string &global_name) const {
+  auto it = values.find(global_name);
+  if (it == values.end()) return std::nullopt;
+  return it->second;
+}
+
+// ----------------------------------------------------------------------------------
+// Evaluator
+// ----------------------------------------------------------------------------------
+double Evaluator::Evaluate(const std::string &expr, const std::string &suit) {
+  auto it = compiled.find(expr);
+  if (it == compiled.end()) {
+    auto program = Expression::Compile(expr);
+    if (!program) {
+      std::stringstream msg;
+      msg << "Expression '" << expr << "' cannot be evaluated concurrently";
+      fatal(msg);
+    }
+    it = compiled.emplace(expr, std::move(*program)).first;
+  }
+  const Expression &program = it->second;
+  std::string prefix = (suit == "/") ? "" : suit;
+  std::replace(prefix.begin(), prefix.end(), '/', '.');
+  auto lookup = [&](std::size_t i) {
+    const auto &name = program.Names()[i];
+    if (!prefix.empty()) {
+      if (auto value = snapshot->Find(prefix + "." + name)) return *value;
+    }
+    if (auto value = snapshot->Find(name)) return *value;
+    std::stringstream msg;
+    msg << "Unknown card '" << name << "' in expression '" << expr << "'";
+    fatal(msg);
+    return 0.0;
+  };
+  return program.Evaluate(lookup, stack);
+}
+
+// ----------------------------------------------------------------------------------
+// EvaluatorPool
+// ----------------------------------------------------------------------------------
+EvaluatorPool::EvaluatorPool(const Deck &deck) : snapshot(deck.Snapshot()) {}
+
+void EvaluatorPool::Release::operator()(Evaluator *evaluator) const {
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  pool->idle.emplace_back(evaluator);
+}
+
+EvaluatorPool::Lease EvaluatorPool::Acquire() {
+  std::unique_ptr<Evaluator> evaluator;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!idle.empty()) {
+      evaluator = std::move(idle.back());
+      idle.pop_back();
+      evaluator->snapshot = snapshot;
+    } else {
+      evaluator = std::make_unique<Evaluator>(snapshot);
+    }
+  }
+  return Lease(evaluator.release(), Release{this});
+}
+
+void EvaluatorPool::Refresh(const Deck &deck) {
+  auto fresh = deck.Snapshot();
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot = std::move(fresh);
+}
+
+std::size_t EvaluatorPool::NumIdle() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return idle.size();
+}
+
+} // namespace Rummy
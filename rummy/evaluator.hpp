@@ -0,0 +1,97 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_EVALUATOR_HPP_
+#define RUMMY_EVALUATOR_HPP_
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace Rummy {
+
+class Deck;
+
+// Immutable copy of the numeric and boolean cards of a deck, keyed by compiler name
+// (gas/eos + gamma -> gas.eos.gamma, booleans as 0 or 1). Take one with
+// Deck::Snapshot; it is shared read-only between threads and never changes, so later
+// updates to the deck are not seen until a new snapshot is taken.
+class DeckSnapshot {
+ public:
+  explicit DeckSnapshot(std::unordered_map<std::string, double> values)
+      : values(std::move(values)) {}
+
+  std::optional<double> Find(const std::string &global_name) const;
+  std::size_t size() const { return values.size(); }
+
+ private:
+  std::unordered_map<std::string, double> values;
+};
+
+// Evaluation state owned by one thread: compiled expressions and the scratch stack.
+// Evaluating touches nothing else, so any number of evaluators can run over the same
+// snapshot concurrently without locking. An evaluator itself must not be shared.
+class Evaluator {
+ public:
+  explicit Evaluator(std::shared_ptr<const DeckSnapshot> snapshot)
+      : snapshot(std::move(snapshot)) {}
+
+  // Value of an arithmetic card expression such as "cv * (gamma - 1.0)". Names are
+  // resolved as in the deck: relative to suit first, then as globals. Unknown names
+  // and expressions outside the Expression subset are fatal.
+  double Evaluate(const std::string &expr, const std::string &suit = "/");
+  const DeckSnapshot &Snapshot() const { return *snapshot; }
+
+ private:
+  friend class EvaluatorPool;
+  std::shared_ptr<const DeckSnapshot> snapshot;
+  std::unordered_map<std::string, Expression> compiled;
+  std::vector<double> stack;
+};
+
+// Hands out evaluators to worker threads. Only Acquire, the release of a lease and
+// Refresh take the pool lock; evaluation itself is lock free. Evaluators are reused
+// between leases, keeping their compiled expressions, and a lease sees the snapshot
+// that was current when it was acquired. The pool must outlive its leases.
+class EvaluatorPool {
+ public:
+  explicit EvaluatorPool(const Deck &deck);
+
+  struct Release {
+    EvaluatorPool *pool = nullptr;
+    void operator()(Evaluator *evaluator) const;
+  };
+  using Lease = std::unique_ptr<Evaluator, Release>;
+
+  Lease Acquire();
+  // Snapshot the deck again, e.g. after UpdateDeck. The deck must not be modified
+  // while the snapshot is taken; leases already out keep their old snapshot.
+  void Refresh(const Deck &deck);
+  std::size_t NumIdle() const;
+
+ private:
+  mutable std::mutex mutex;
+  std::shared_ptr<const DeckSnapshot> snapshot;
+  std::vector<std::unique_ptr<Evaluator>> idle;
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_EVALUATOR_HPP_
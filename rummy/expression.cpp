@@ -0,0 +1,490 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace Rummy {
+
+namespace {
+const std::vector<std::string> &Functions1() {
+  static const std::vector<std::string> functions = {
+      "sqrt", "exp",  "log",  "log10", "sin",  "cos",  "tan",   "asin", "acos",
+      "atan", "sinh", "cosh", "tanh",  "abs",  "floor", "ceil", "round", "cbrt"};
+  return functions;
+}
+const std::vector<std::string> &Functions2() {
+  static const std::vector<std::string> functions = {"pow", "min", "max", "atan2"};
+  return functions;
+}
+
+// ---- arithmetic on doubles and duals -------------------------------------------------
+double Value(double x) { return x; }
+double Value(const Dual &x) { return x.value; }
+
+double Constant(double x, double) { return x; }
+Dual Constant(double x, const Dual &) { return {x, {}}; }
+
+// a * da + b * db for the gradients
+void Combine(Dual &out, const Dual &a, double da, const Dual &b, double db) {
+  out.grad.assign(std::max(a.grad.size(), b.grad.size()), 0.0);
+  for (std::size_t i = 0; i < a.grad.size(); i++) out.grad[i] += da * a.grad[i];
+  for (std::size_t i = 0; i < b.grad.size(); i++) out.grad[i] += db * b.grad[i];
+}
+Dual Chain(const Dual &a, double value, double da) {
+  Dual out{value, a.grad};
+  for (auto &g : out.grad) g *= da;
+  return out;
+}
+
+double Binary(char op, double a, double b) {
+  switch (op) {
+  case '+': return a + b;
+  case '-': return a - b;
+  case '*': return a * b;
+  case '/': return a / b;
+  case 'i': return std::floor(a / b);
+  case '%': return std::fmod(a, b);
+  case '^': return std::pow(a, b);
+  }
+  return 0.0;
+}
+Dual Binary(char op, const Dual &a, const Dual &b) {
+  Dual out{Binary(op, a.value, b.value), {}};
+  switch (op) {
+  case '+': Combine(out, a, 1.0, b, 1.0); break;
+  case '-': Combine(out, a, 1.0, b, -1.0); break;
+  case '*': Combine(out, a, b.value, b, a.value); break;
+  case '/': Combine(out, a, 1.0 / b.value, b, -a.value / (b.value * b.value)); break;
+  case 'i': break;
+  case '%': Combine(out, a, 1.0, b, -std::trunc(a.value / b.value)); break;
+  case '^': {
+    const double da = (a.grad.empty()) ? 0.0 : b.value * std::pow(a.value, b.value - 1.0);
+    const double db = (b.grad.empty()) ? 0.0 : out.value * std::log(a.value);
+    Combine(out, a, da, b, db);
+    break;
+  }
+  }
+  return out;
+}
+
+double Call1(const std::string &f, double x) {
+  if (f == "sqrt") return std::sqrt(x);
+  if (f == "exp") return std::exp(x);
+  if (f == "log") return std::log(x);
+  if (f == "log10") return std::log10(x);
+  if (f == "sin") return std::sin(x);
+  if (f == "cos") return std::cos(x);
+  if (f == "tan") return std::tan(x);
+  if (f == "asin") return std::asin(x);
+  if (f == "acos") return std::acos(x);
+  if (f == "atan") return std::atan(x);
+  if (f == "sinh") return std::sinh(x);
+  if (f == "cosh") return std::cosh(x);
+  if (f == "tanh") return std::tanh(x);
+  if (f == "abs") return std::fabs(x);
+  if (f == "floor") return std::floor(x);
+  if (f == "ceil") return std::ceil(x);
+  if (f == "round") return std::round(x);
+  return std::cbrt(x);
+}
+// derivative of f at x given y = f(x)
+double Derivative1(const std::string &f, double x, double y) {
+  if (f == "sqrt") return 0.5 / y;
+  if (f == "exp") return y;
+  if (f == "log") return 1.0 / x;
+  if (f == "log10") return 1.0 / (x * std::log(10.0));
+  if (f == "sin") return std::cos(x);
+  if (f == "cos") return -std::sin(x);
+  if (f == "tan") return 1.0 + y * y;
+  if (f == "asin") return 1.0 / std::sqrt(1.0 - x * x);
+  if (f == "acos") return -1.0 / std::sqrt(1.0 - x * x);
+  if (f == "atan") return 1.0 / (1.0 + x * x);
+  if (f == "sinh") return std::cosh(x);
+  if (f == "cosh") return std::sinh(x);
+  if (f == "tanh") return 1.0 - y * y;
+  if (f == "abs") return (x < 0.0) ? -1.0 : 1.0;
+  if (f == "cbrt") return 1.0 / (3.0 * y * y);
+  return 0.0; // floor, ceil, round
+}
+double Call1(const std::string &f, const double &x, double) { return Call1(f, x); }
+Dual Call1(const std::string &f, const Dual &x, const Dual &) {
+  const double y = Call1(f, x.value);
+  if (x.grad.empty()) return {y, {}};
+  return Chain(x, y, Derivative1(f, x.value, y));
+}
+
+double Call2(const std::string &f, double a, double b) {
+  if (f == "pow") return std::pow(a, b);
+  if (f == "min") return std::min(a, b);
+  if (f == "max") return std::max(a, b);
+  return std::atan2(a, b);
+}
+Dual Call2(const std::string &f, const Dual &a, const Dual &b) {
+  if (f == "pow") return Binary('^', a, b);
+  if (f == "min") return (b.value < a.value) ? b : a;
+  if (f == "max") return (a.value < b.value) ? b : a;
+  Dual out{std::atan2(a.value, b.value), {}};
+  const double r2 = a.value * a.value + b.value * b.value;
+  Combine(out, a, b.value / r2, b, -a.value / r2);
+  return out;
+}
+} // namespace
+
+// Recursive descent compiler emitting the postfix program
+class ExpressionCompiler {
+ public:
+  explicit ExpressionCompiler(Expression &expr) : expr(expr), src(expr.source) {}
+
+  bool Compile() {
+    Ternary();
+    Skip();
+    return ok && pos == src.size();
+  }
+
+ private:
+  using Op = Expression::Op;
+  void Emit(Op op, double constant = 0.0, std::uint32_t index = 0) {
+    expr.code.push_back({op, constant, index});
+  }
+  void Skip() {
+    while (pos < src.size() && src[pos] == ' ') pos++;
+  }
+  bool Accept(const char *token) {
+    Skip();
+    const std::size_t n = std::char_traits<char>::length(token);
+    if (src.compare(pos, n, token) != 0) return false;
+    // do not split ** or // or comparison operators
+    if (n == 1 && pos + 1 < src.size()) {
+      const char next = src[pos + 1];
+      if ((token[0] == '*' && next == '*') || (token[0] == '/' && next == '/') ||
+          ((token[0] == '<' || token[0] == '>' || token[0] == '!') && next == '=')) {
+        return false;
+      }
+    }
+    pos += n;
+    return true;
+  }
+  void Fail() { ok = false; }
+
+  void Ternary() {
+    Or();
+    if (ok && Accept("?")) {
+      Ternary();
+      if (!Accept(":")) return Fail();
+      Ternary();
+      Emit(Op::SELECT);
+    }
+  }
+  void Or() {
+    And();
+    while (ok && (Accept("||") || AcceptWord("or"))) {
+      And();
+      Emit(Op::OR);
+    }
+  }
+  void And() {
+    Comparison();
+    while (ok && (Accept("&&") || AcceptWord("and"))) {
+      Comparison();
+      Emit(Op::AND);
+    }
+  }
+  void Comparison() {
+    Additive();
+    static const std::vector<std::pair<const char *, Op>> ops = {
+        {"<=", Op::LE}, {">=", Op::GE}, {"==", Op::EQ},
+        {"!=", Op::NE}, {"<", Op::LT},  {">", Op::GT}};
+    for (const auto &[token, op] : ops) {
+      if (ok && Accept(token)) {
+        Additive();
+        Emit(op);
+        return;
+      }
+    }
+  }
+  void Additive() {
+    Term();
+    while (ok) {
+      if (Accept("+")) {
+        Term();
+        Emit(Op::ADD);
+      } else if (Accept("-")) {
+        Term();
+        Emit(Op::SUB);
+      } else {
+        break;
+      }
+    }
+  }
+  void Term() {
+    Unary();
+    while (ok) {
+      if (Accept("*")) {
+        Unary();
+        Emit(Op::MUL);
+      } else if (Accept("//")) {
+        Unary();
+        Emit(Op::IDIV);
+      } else if (Accept("/")) {
+        Unary();
+        Emit(Op::DIV);
+      } else if (Accept("%")) {
+        Unary();
+        Emit(Op::MOD);
+      } else {
+        break;
+      }
+    }
+  }
+  void Unary() {
+    if (Accept("-")) {
+      Unary();
+      Emit(Op::NEG);
+    } else if (Accept("+")) {
+      Unary();
+    } else if (Accept("!") || AcceptWord("not")) {
+      Unary();
+      Emit(Op::NOT);
+    } else {
+      Power();
+    }
+  }
+  void Power() {
+    Primary();
+    if (ok && Accept("**")) {
+      Unary(); // right associative, binds tighter than unary minus on the left
+      Emit(Op::POW);
+    }
+  }
+  bool AcceptWord(const char *word) {
+    Skip();
+    const std::size_t n = std::char_traits<char>::length(word);
+    if (src.compare(pos, n, word) != 0) return false;
+    if (pos + n < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos + n])) ||
+                                 src[pos + n] == '_')) {
+      return false;
+    }
+    pos += n;
+    return true;
+  }
+  void Primary() {
+    Skip();
+    if (pos >= src.size()) return Fail();
+    const char c = src[pos];
+    if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+      char *end = nullptr;
+      const double value = std::strtod(src.c_str() + pos, &end);
+      if (end == src.c_str() + pos) return Fail();
+      pos = end - src.c_str();
+      return Emit(Op::CONST, value);
+    }
+    if (c == '(') {
+      pos++;
+      Ternary();
+      if (!Accept(")")) Fail();
+      return;
+    }
+    if (!(std::isalpha(static_cast<unsigned char>(c)) || c == '_')) return Fail();
+    std::size_t end = pos;
+    while (end < src.size() &&
+           (std::isalnum(static_cast<unsigned char>(src[end])) || src[end] == '_' ||
+            src[end] == '.')) {
+      end++;
+    }
+    std::string name = src.substr(pos, end - pos);
+    pos = end;
+    if (Accept("(")) {
+      auto f1 = std::find(Functions1().begin(), Functions1().end(), name);
+      auto f2 = std::find(Functions2().begin(), Functions2().end(), name);
+      Ternary();
+      if (f2 != Functions2().end() && Accept(",")) {
+        Ternary();
+        Emit(Op::CALL2, 0.0, static_cast<std::uint32_t>(f2 - Functions2().begin()));
+      } else if (f1 != Functions1().end()) {
+        Emit(Op::CALL1, 0.0, static_cast<std::uint32_t>(f1 - Functions1().begin()));
+      } else {
+        return Fail();
+      }
+      if (!Accept(")")) Fail();
+      return;
+    }
+    if (name == "true" || name == "false") return Emit(Op::CONST, name == "true");
+    if (name == "pi") return Emit(Op::CONST, std::acos(-1.0));
+    // element reference a[2]
+    if (pos < src.size() && src[pos] == '[') {
+      auto close = src.find(']', pos);
+      if (close == std::string::npos) return Fail();
+      auto index = src.substr(pos + 1, close - pos - 1);
+      if (index.empty() || index.find_first_not_of("0123456789") != std::string::npos) {
+        return Fail(); // slices and computed indices
+      }
+      name += src.substr(pos, close - pos + 1);
+      pos = close + 1;
+    }
+    auto it = std::find(expr.names.begin(), expr.names.end(), name);
+    if (it == expr.names.end()) it = expr.names.insert(expr.names.end(), name);
+    Emit(Op::NAME, 0.0, static_cast<std::uint32_t>(it - expr.names.begin()));
+  }
+
+  Expression &expr;
+  const std::string &src;
+  std::size_t pos = 0;
+  bool ok = true;
+};
+
+std::optional<Expression> Expression::Compile(const std::string &source) {
+  Expression expr;
+  expr.source = source;
+  if (source.find('"') != std::string::npos || source.find('[') == 0) return std::nullopt;
+  if (!ExpressionCompiler(expr).Compile()) return std::nullopt;
+  return expr;
+}
+
+std::vector<std::string> Expression::References(const std::string &source) {
+  std::vector<std::string> refs;
+  auto is_name = [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+  };
+  std::size_t pos = 0;
+  while (pos < source.size()) {
+    const char c = source[pos];
+    if (c == '"') {
+      const auto close = source.find('"', pos + 1);
+      pos = (close == std::string::npos) ? source.size() : close + 1;
+      continue;
+    }
+    if (!(std::isalpha(static_cast<unsigned char>(c)) || c == '_')) {
+      // numbers, including exponents such as 1e5, are skipped whole
+      do {
+        pos++;
+      } while (std::isdigit(static_cast<unsigned char>(c)) && pos < source.size() &&
+               is_name(source[pos]));
+      continue;
+    }
+    auto end = pos;
+    while (end < source.size() && is_name(source[end])) end++;
+    std::string name = source.substr(pos, end - pos);
+    pos = end;
+    while (pos < source.size() && source[pos] == ' ') pos++;
+    if (pos < source.size() && source[pos] == '(') continue; // function
+    static const std::vector<std::string> keywords = {"true", "false", "pi",
+                                                      "and",  "or",    "not"};
+    if (std::find(keywords.begin(), keywords.end(), name) != keywords.end()) continue;
+    // element reference a[2]; a slice reads the vector as a whole
+    if (pos < source.size() && source[pos] == '[') {
+      const auto close = source.find(']', pos);
+      const auto index = source.substr(pos + 1, close - pos - 1);
+      if (close != std::string::npos && !index.empty() &&
+          index.find_first_not_of("0123456789") == std::string::npos) {
+        name += source.substr(pos, close - pos + 1);
+        pos = close + 1;
+      }
+    }
+    if (std::find(refs.begin(), refs.end(), name) == refs.end()) refs.push_back(name);
+  }
+  return refs;
+}
+
+template <typename T>
+T Expression::Run(const std::function<T(std::size_t)> &lookup,
+                  std::vector<T> &stack) const {
+  stack.clear();
+  stack.reserve(code.size());
+  auto pop = [&stack]() {
+    T top = std::move(stack.back());
+    stack.pop_back();
+    return top;
+  };
+  const T zero{};
+  for (const auto &ins : code) {
+    switch (ins.op) {
+    case Op::CONST:
+      stack.push_back(Constant(ins.constant, zero));
+      break;
+    case Op::NAME:
+      stack.push_back(lookup(ins.index));
+      break;
+    case Op::NEG:
+      stack.back() = Binary('-', Constant(0.0, zero), stack.back());
+      break;
+    case Op::NOT:
+      stack.back() = Constant(Value(stack.back()) == 0.0, zero);
+      break;
+    case Op::SELECT: {
+      T b = pop();
+      T a = pop();
+      T cond = pop();
+      stack.push_back((Value(cond) != 0.0) ? a : b);
+      break;
+    }
+    case Op::CALL1:
+      stack.back() = Call1(Functions1()[ins.index], stack.back(), zero);
+      break;
+    case Op::CALL2: {
+      T b = pop();
+      T a = pop();
+      stack.push_back(Call2(Functions2()[ins.index], a, b));
+      break;
+    }
+    default: {
+      T b = pop();
+      T a = pop();
+      const double x = Value(a), y = Value(b);
+      switch (ins.op) {
+      case Op::ADD: stack.push_back(Binary('+', a, b)); break;
+      case Op::SUB: stack.push_back(Binary('-', a, b)); break;
+      case Op::MUL: stack.push_back(Binary('*', a, b)); break;
+      case Op::DIV: stack.push_back(Binary('/', a, b)); break;
+      case Op::IDIV: stack.push_back(Binary('i', a, b)); break;
+      case Op::MOD: stack.push_back(Binary('%', a, b)); break;
+      case Op::POW: stack.push_back(Binary('^', a, b)); break;
+      case Op::LT: stack.push_back(Constant(x < y, zero)); break;
+      case Op::LE: stack.push_back(Constant(x <= y, zero)); break;
+      case Op::GT: stack.push_back(Constant(x > y, zero)); break;
+      case Op::GE: stack.push_back(Constant(x >= y, zero)); break;
+      case Op::EQ: stack.push_back(Constant(x == y, zero)); break;
+      case Op::NE: stack.push_back(Constant(x != y, zero)); break;
+      case Op::AND: stack.push_back(Constant(x != 0.0 && y != 0.0, zero)); break;
+      case Op::OR: stack.push_back(Constant(x != 0.0 || y != 0.0, zero)); break;
+      default: break;
+      }
+    }
+    }
+  }
+  return stack.back();
+}
+
+double Expression::Evaluate(const std::function<double(std::size_t)> &lookup) const {
+  std::vector<double> stack;
+  return Run<double>(lookup, stack);
+}
+double Expression::Evaluate(const std::function<double(std::size_t)> &lookup,
+                            std::vector<double> &stack) const {
+  return Run<double>(lookup, stack);
+}
+Dual Expression::Evaluate(const std::function<Dual(std::size_t)> &lookup) const {
+  std::vector<Dual> stack;
+  return Run<Dual>(lookup, stack);
+}
+
+} // namespace Rummy
@@ -0,0 +1,78 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_EXPRESSION_HPP_
+#define RUMMY_EXPRESSION_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Rummy {
+
+// Forward mode dual number: value and derivatives with respect to the chosen inputs.
+// An empty grad is a constant.
+struct Dual {
+  double value = 0.0;
+  std::vector<double> grad;
+};
+
+// Arithmetic card expression compiled to a postfix program. Supports numbers, card
+// names (including elements such as a[2]), + - * / // % **, comparisons, && || !,
+// the ternary operator and the common math functions. Strings and vector operations
+// are not supported; Compile returns nothing for them.
+class Expression {
+ public:
+  static std::optional<Expression> Compile(const std::string &source);
+  // Card names an expression reads, also for the ones Compile rejects: a lexical scan
+  // that skips quoted text, numbers, function names and keywords
+  static std::vector<std::string> References(const std::string &source);
+
+  const std::string &Source() const { return source; }
+  // card names referenced by the expression, indexed as passed to the lookup
+  const std::vector<std::string> &Names() const { return names; }
+
+  double Evaluate(const std::function<double(std::size_t)> &lookup) const;
+  // as above, with a caller owned scratch stack that is reused between calls.
+  // Evaluation touches no shared state, so threads may evaluate the same expression.
+  double Evaluate(const std::function<double(std::size_t)> &lookup,
+                  std::vector<double> &stack) const;
+  Dual Evaluate(const std::function<Dual(std::size_t)> &lookup) const;
+
+ private:
+  friend class ExpressionCompiler;
+  enum class Op : std::uint8_t {
+    CONST, NAME, NEG, NOT, ADD, SUB, MUL, DIV, IDIV, MOD, POW,
+    LT, LE, GT, GE, EQ, NE, AND, OR, SELECT, CALL1, CALL2
+  };
+  struct Instruction {
+    Op op;
+    double constant = 0.0;
+    std::uint32_t index = 0; // name or function
+  };
+  template <typename T>
+  T Run(const std::function<T(std::size_t)> &lookup, std::vector<T> &stack) const;
+
+  std::string source;
+  std::vector<Instruction> code;
+  std::vector<std::string> names;
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_EXPRESSION_HPP_
@@ -0,0 +1,66 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+#ifndef RUMMY_FD_STREAMBUF_HPP_
+#define RUMMY_FD_STREAMBUF_HPP_
+
+#include <cerrno>
+#include <cstddef>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+
+#include <unistd.h>
+
+#include "rummy_utils.hpp"
+
+namespace Rummy {
+
+// Read-only streambuf over a file descriptor, such as a pipe from a deck generator.
+// The buffer has a fixed size and is refilled in place once it has been consumed, so
+// reading never holds more than that many bytes of the input. The descriptor is not
+// closed.
+class FdStreamBuf : public std::streambuf {
+ public:
+  explicit FdStreamBuf(int fd, std::size_t size = std::size_t(1) << 16)
+      : fd(fd), buffer(size) {
+    setg(buffer.data(), buffer.data(), buffer.data());
+  }
+
+ protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    ssize_t count = 0;
+    do {
+      count = ::read(fd, buffer.data(), buffer.size());
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+      std::stringstream msg;
+      msg << "Could not read from file descriptor " << fd;
+      fatal(msg);
+    }
+    if (count == 0) return traits_type::eof();
+    setg(buffer.data(), buffer.data(), buffer.data() + count);
+    return traits_type::to_int_type(*gptr());
+  }
+
+ private:
+  int fd;
+  std::vector<char> buffer;
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_FD_STREAMBUF_HPP_
@@ -0,0 +1,328 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "deck.hpp"
+#include "inspector.hpp"
+#include "rummy_utils.hpp"
+
+namespace Rummy {
+
+namespace {
+constexpr std::size_t kMaxRequest = 512; // longest request line
+constexpr int kPollMs = 100;             // how often the server checks for Stop
+constexpr int kClientTimeoutS = 1;       // a stalled client is dropped after this
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL; // a client that hangs up must not SIGPIPE
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+// Write side of a connected socket with a fixed buffer; errors drop the rest
+class SocketOutBuf : public std::streambuf {
+ public:
+  explicit SocketOutBuf(int fd) : fd(fd) { setp(buffer, buffer + sizeof(buffer)); }
+  ~SocketOutBuf() override { sync(); }
+
+ protected:
+  int_type overflow(int_type c) override {
+    if (sync() != 0) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+  int sync() override {
+    const char *data = pbase();
+    std::size_t left = pptr() - pbase();
+    while (left > 0 && !failed) {
+      const auto sent = ::send(fd, data, left, kSendFlags);
+      if (sent < 0 && errno == EINTR) continue;
+      if (sent <= 0) {
+        failed = true;
+        break;
+      }
+      data += sent;
+      left -= sent;
+    }
+    setp(buffer, buffer + sizeof(buffer));
+    return failed ? -1 : 0;
+  }
+
+ private:
+  int fd;
+  bool failed = false;
+  char buffer[4096];
+};
+
+sockaddr_un SocketAddress(const std::string &path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    std::stringstream msg;
+    msg << "Inspector socket path '" << path << "' must have 1 to "
+        << sizeof(addr.sun_path) - 1 << " characters";
+    fatal(msg);
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+  return addr;
+}
+
+void SetTimeouts(int fd) {
+  timeval timeout{kClientTimeoutS, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+void Fnv1a(std::uint64_t &hash, const std::string &str) {
+  for (const unsigned char c : str) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+}
+
+void WriteEntry(std::ostream &os, const InspectorSnapshot::Entry &entry) {
+  os << entry.name << " = " << entry.value << "\n";
+}
+} // namespace
+
+Inspector::Inspector(std::string socket_path, std::size_t memory_budget)
+    : socket_path(std::move(socket_path)), memory_budget(memory_budget) {}
+
+Inspector::~Inspector() { Stop(); }
+
+void Inspector::Start() {
+  if (running.load()) return;
+  const auto addr = SocketAddress(socket_path);
+  listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) fatal("Could not create the inspector socket");
+  // only a stale socket of an earlier run is replaced, never a file or a link
+  struct stat existing;
+  if (::lstat(socket_path.c_str(), &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      std::stringstream msg;
+      msg << "Inspector socket path '" << socket_path << "' exists and is not a socket";
+      ::close(listen_fd);
+      listen_fd = -1;
+      fatal(msg);
+    }
+    ::unlink(socket_path.c_str());
+  }
+  // the socket is created owner-only, so no other user can connect before listen
+  const auto *address = reinterpret_cast<const sockaddr *>(&addr);
+  const mode_t old_mask = ::umask(S_IRWXG | S_IRWXO | S_IXUSR);
+  const int bound = ::bind(listen_fd, address, sizeof(addr));
+  ::umask(old_mask);
+  if (bound != 0 || ::listen(listen_fd, 8) != 0) {
+    std::stringstream msg;
+    msg << "Could not listen on inspector socket '" << socket_path
+        << "': " << std::strerror(errno);
+    ::close(listen_fd);
+    listen_fd = -1;
+    fatal(msg);
+  }
+  running.store(true);
+  server = std::thread(&Inspector::Serve, this);
+}
+
+void Inspector::Stop() {
+  if (!running.exchange(false)) return;
+  server.join();
+  ::close(listen_fd);
+  listen_fd = -1;
+  ::unlink(socket_path.c_str());
+}
+
+bool Inspector::Publish(const Deck &deck) {
+  auto next = std::make_shared<InspectorSnapshot>();
+  std::size_t bytes = sizeof(InspectorSnapshot);
+  for (const auto &suit : deck.GetSuitsInOrder()) {
+    const auto cards = deck.FindSuit(suit);
+    if (cards.empty()) continue;
+    next->num_suits++;
+    for (const auto &[name, card] : cards) {
+      auto value = card.isString() ? "\"" + card.GetString() + "\"" : card.GetString();
+      bytes += sizeof(InspectorSnapshot::Entry) + suit.size() + name.size();
+      bytes += value.size();
+      if (bytes > memory_budget) {
+        rejected++;
+        return false;
+      }
+      next->entries.push_back({suit, name, std::move(value)});
+    }
+  }
+  std::sort(next->entries.begin(), next->entries.end(), [](const auto &a, const auto &b) {
+    return std::tie(a.suit, a.name) < std::tie(b.suit, b.name);
+  });
+  next->hash = 0xcbf29ce484222325ULL;
+  for (const auto &entry : next->entries) {
+    Fnv1a(next->hash, entry.suit + "/" + entry.name + " = " + entry.value + "\n");
+  }
+  next->bytes = bytes;
+  next->version = ++publishes;
+  next->cycle = deck.GetCycle();
+  next->published = std::chrono::steady_clock::now();
+  std::atomic_store(&snapshot, std::shared_ptr<const InspectorSnapshot>(std::move(next)));
+  return true;
+}
+
+void Inspector::Query(const std::string &request, std::ostream &os) const {
+  queries++;
+  std::stringstream words(request);
+  std::string command, arg;
+  words >> command >> arg;
+  const auto snap = std::atomic_load(&snapshot);
+  if (snap == nullptr) {
+    os << "error: nothing has been published\n";
+    return;
+  }
+  using Entry = InspectorSnapshot::Entry;
+  const auto &entries = snap->entries;
+  auto suit_range = [&](const std::string &suit) {
+    auto first = std::lower_bound(entries.begin(), entries.end(), suit,
+                                  [](const Entry &e, const std::string &s) {
+                                    return e.suit < s;
+                                  });
+    auto last = std::upper_bound(first, entries.end(), suit,
+                                 [](const std::string &s, const Entry &e) {
+                                   return s < e.suit;
+                                 });
+    return std::make_pair(first, last);
+  };
+
+  if (command == "get" && !arg.empty()) {
+    const auto slash = arg.find_last_of('/');
+    const auto suit = (slash == std::string::npos) ? "/" : arg.substr(0, slash);
+    const auto name = (slash == std::string::npos) ? arg : arg.substr(slash + 1);
+    const auto [first, last] = suit_range(suit);
+    auto by_name = [](const Entry &e, const std::string &n) { return e.name < n; };
+    auto it = std::lower_bound(first, last, name, by_name);
+    if (it == last || it->name != name) {
+      os << "error: card '" << arg << "' not found\n";
+    } else {
+      os << it->value << "\n";
+    }
+  } else if (command == "suit" && !arg.empty()) {
+    const auto [first, last] = suit_range(arg);
+    if (first == last) os << "error: suit '" << arg << "' not found\n";
+    for (auto it = first; it != last; ++it) WriteEntry(os, *it);
+  } else if (command == "dump") {
+    for (std::size_t i = 0; i < entries.size(); i++) {
+      if (i == 0 || entries[i].suit != entries[i - 1].suit) {
+        if (i > 0) os << "\n";
+        if (entries[i].suit != "/") os << "<" << entries[i].suit << ">\n";
+      }
+      WriteEntry(os, entries[i]);
+    }
+  } else if (command == "hash") {
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016" PRIx64, snap->hash);
+    os << hex << "\n";
+  } else if (command == "stats") {
+    const auto age = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                   snap->published);
+    os << "cards " << entries.size() << "\n"
+       << "suits " << snap->num_suits << "\n"
+       << "bytes " << snap->bytes << "\n"
+       << "budget " << memory_budget << "\n"
+       << "version " << snap->version << "\n"
+       << "cycle " << snap->cycle << "\n"
+       << "age_s " << age.count() << "\n"
+       << "rejected " << rejected.load() << "\n"
+       << "queries " << queries.load() << "\n";
+  } else {
+    os << "error: unknown request '" << request
+       << "' (get <suit/name>, suit <suit>, dump, hash, stats)\n";
+  }
+}
+
+void Inspector::Serve() {
+  char request[kMaxRequest];
+  while (running.load()) {
+    pollfd listener{listen_fd, POLLIN, 0};
+    if (::poll(&listener, 1, kPollMs) <= 0) continue;
+    const int client = ::accept(listen_fd, nullptr, nullptr);
+    if (client < 0) continue;
+    SetTimeouts(client);
+    // one request line per connection, read into the fixed buffer
+    std::size_t length = 0;
+    while (length < sizeof(request)) {
+      const auto count = ::recv(client, request + length, sizeof(request) - length, 0);
+      if (count < 0 && errno == EINTR) continue;
+      if (count <= 0) break;
+      length += count;
+      if (std::memchr(request, '\n', length) != nullptr) break;
+    }
+    std::string line(request, length);
+    line.erase(std::min(line.find_first_of("\r\n"), line.size()));
+    {
+      SocketOutBuf out(client);
+      std::ostream os(&out);
+      if (length == sizeof(request) && line.size() == length) {
+        os << "error: request longer than " << kMaxRequest << " bytes\n";
+      } else {
+        Query(line, os);
+      }
+    }
+    ::close(client);
+  }
+}
+
+std::string InspectorRequest(const std::string &socket_path, const std::string &request) {
+  const auto addr = SocketAddress(socket_path);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::stringstream msg;
+    msg << "Could not connect to inspector socket '" << socket_path
+        << "': " << std::strerror(errno);
+    if (fd >= 0) ::close(fd);
+    fatal(msg);
+  }
+  {
+    SocketOutBuf out(fd);
+    std::ostream os(&out);
+    os << request << "\n";
+  }
+  std::string reply;
+  char buffer[4096];
+  while (true) {
+    const auto count = ::recv(fd, buffer, sizeof(buffer), 0);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) break;
+    reply.append(buffer, count);
+  }
+  ::close(fd);
+  return reply;
+}
+
+} // namespace Rummy
@@ -0,0 +1,98 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_INSPECTOR_HPP_
+#define RUMMY_INSPECTOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Rummy {
+
+class Deck;
+
+// Frozen copy of the cards of a deck, as served by an Inspector
+struct InspectorSnapshot {
+  struct Entry {
+    std::string suit;
+    std::string name;
+    std::string value; // as written by WriteDeck, strings quoted
+  };
+  std::vector<Entry> entries; // sorted by suit, then name
+  std::size_t num_suits = 0;
+  std::size_t bytes = 0;
+  std::uint64_t hash = 0; // FNV-1a of every "suit/name = value" line
+  std::uint64_t version = 0;
+  int cycle = 0;
+  std::chrono::steady_clock::time_point published;
+};
+
+// Opt-in, read-only view of a running deck over a local Unix socket. The simulation
+// calls Publish (e.g. after UpdateDeck) to freeze the current values; a background
+// thread answers one request line per connection from the last published snapshot:
+//   get <suit/name>   value of one card ("name" for a global)
+//   suit <suit>       every card of a suit
+//   dump              every card
+//   hash              hash of the published values
+//   stats             snapshot size, version, age and counters
+// The deck is never touched by the server thread, so its accessors take no locks.
+// Publish swaps the snapshot in atomically and refuses snapshots larger than the
+// memory budget; requests are read into a fixed buffer and replies are streamed.
+class Inspector {
+ public:
+  explicit Inspector(std::string socket_path,
+                     std::size_t memory_budget = std::size_t(1) << 24);
+  ~Inspector();
+  Inspector(const Inspector &) = delete;
+  Inspector &operator=(const Inspector &) = delete;
+
+  // Create the socket (owner access only) and start serving; fatal on failure
+  void Start();
+  void Stop();
+  bool IsRunning() const { return running.load(); }
+  const std::string &SocketPath() const { return socket_path; }
+
+  // Freeze the current values of deck. Returns false, keeping the previous snapshot,
+  // if the snapshot would exceed the memory budget.
+  bool Publish(const Deck &deck);
+  // Answer one request from the current snapshot
+  void Query(const std::string &request, std::ostream &os) const;
+
+ private:
+  void Serve();
+
+  std::string socket_path;
+  std::size_t memory_budget;
+  std::shared_ptr<const InspectorSnapshot> snapshot; // std::atomic_load/store only
+  std::atomic<bool> running{false};
+  std::atomic<std::uint64_t> publishes{0};
+  std::atomic<std::uint64_t> rejected{0};
+  mutable std::atomic<std::uint64_t> queries{0};
+  int listen_fd = -1;
+  std::thread server;
+};
+
+// Send one request to an inspector socket and return the reply (rummy attach)
+std::string InspectorRequest(const std::string &socket_path, const std::string &request);
+
+} // namespace Rummy
+
+#endif // RUMMY_INSPECTOR_HPP_
@@ -14,11 +14,17 @@
 // This file was created in part with generative AI
 
 
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "deck.hpp"
+#include "deck_index.hpp"
+#include "inspector.hpp"
 
 void Deal(Rummy::Deck *deck) {
   std::cout << "Dealing the cards..." << std::endl;
@@ -37,7 +43,84 @@ std::string DefinePC() {
   return pc;
 }
 
+// rummy index <index_file> <deck_or_dir>...
+int Index(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: rummy index <index_file> <deck_or_dir>..." << std::endl;
+    return 1;
+  }
+  Rummy::DeckIndex index;
+  const std::string index_file = argv[2];
+  if (std::filesystem::exists(index_file)) index.Read(index_file);
+  std::size_t updated = 0;
+  for (int i = 3; i < argc; i++) {
+    if (std::filesystem::is_directory(argv[i])) {
+      updated += index.AddDirectory(argv[i]);
+    } else {
+      updated += index.AddDeck(argv[i]) ? 1 : 0;
+    }
+  }
+  index.Write(index_file);
+  std::cout << "Indexed " << updated << " new or changed decks (" << index.NumRows()
+            << " decks, " << index.NumColumns() << " cards)" << std::endl;
+  return 0;
+}
+
+// rummy query <index_file> [--select card1,card2] <predicate>...
+int Query(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: rummy query <index_file> [--select card1,card2] <predicate>..."
+              << std::endl;
+    return 1;
+  }
+  Rummy::DeckIndex index;
+  index.Read(argv[2]);
+  std::vector<std::string> predicates;
+  std::vector<std::string> select;
+  for (int i = 3; i < argc; i++) {
+    if (std::strcmp(argv[i], "--select") == 0 && i + 1 < argc) {
+      std::stringstream ss(argv[++i]);
+      std::string col;
+      while (std::getline(ss, col, ',')) select.push_back(col);
+    } else {
+      predicates.push_back(argv[i]);
+    }
+  }
+  const auto rows = index.Query(predicates);
+  const auto table = index.Project(rows, select);
+  for (std::size_t r = 0; r < rows.size(); r++) {
+    std::cout << index.GetPaths()[rows[r]];
+    for (std::size_t c = 0; c < select.size(); c++) {
+      std::cout << " " << select[c] << "=" << table[r][c];
+    }
+    std::cout << "\n";
+  }
+  return 0;
+}
+
+// rummy attach <socket> <get suit/name | suit name | dump | hash | stats>
+int Attach(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: rummy attach <socket> "
+                 "<get suit/name | suit name | dump | hash | stats>"
+              << std::endl;
+    return 1;
+  }
+  std::string request = argv[3];
+  for (int i = 4; i < argc; i++) request.append(" ").append(argv[i]);
+  const auto reply = Rummy::InspectorRequest(argv[2], request);
+  std::cout << reply;
+  return reply.compare(0, 6, "error:") == 0 ? 1 : 0;
+}
+
 int main(int argc, char *argv[]) {
+  if (argc > 1 && std::strcmp(argv[1], "index") == 0) {
+    return Index(argc, argv);
+  } else if (argc > 1 && std::strcmp(argv[1], "query") == 0) {
+    return Query(argc, argv);
+  } else if (argc > 1 && std::strcmp(argv[1], "attach") == 0) {
+    return Attach(argc, argv);
+  }
   if (argc == 1) {
     pips::VM vm;
     printf("Booting up REPL\n");
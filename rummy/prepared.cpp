@@ -0,0 +1,130 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+
+#include "prepared.hpp"
+
+#include <sstream>
+
+namespace Rummy {
+
+namespace {
+
+std::string ParamPath(const std::string &suit, const std::string &name) {
+  return (suit == "/") ? name : suit + "/" + name;
+}
+
+} // namespace
+
+PreparedDeck::PreparedDeck(const Deck &deck, const std::vector<std::string> &params_)
+    : base(deck), names(params_) {
+  for (const auto &param : names) {
+    std::string suit = "/";
+    std::string name = param;
+    const auto slash = param.rfind('/');
+    if (slash != std::string::npos) {
+      suit = (slash == 0) ? "/" : param.substr(0, slash);
+      name = param.substr(slash + 1);
+      if (!base.DoesCardExist(suit, name)) {
+        std::stringstream msg;
+        msg << "Parameter '" << param << "' is not a card of the deck";
+        fatal(msg);
+      }
+    } else if (!base.DoesCardExist("/", name)) {
+      // the suit that defines the card, which must be unique
+      std::vector<std::string> found;
+      for (const auto &s : base.GetSuitsInOrder()) {
+        if (base.GetSuit(s).count(name)) found.push_back(s);
+      }
+      if (found.size() != 1) {
+        std::stringstream msg;
+        msg << "Parameter '" << param << "' "
+            << (found.empty() ? "is not a card of the deck" : "is ambiguous:");
+        for (const auto &s : found) msg << " " << s << "/" << name;
+        fatal(msg);
+      }
+      suit = found.front();
+    }
+    params.emplace_back(suit, name);
+  }
+  // reverse dependencies are indexed once and shared by every instance
+  base.IndexSources();
+}
+
+Deck PreparedDeck::Instantiate(
+    const std::vector<std::pair<std::string, ParamValue>> &values) const {
+  Deck deck(base);
+  deck.compiled_sources = base.compiled_sources;
+  deck.dependents = base.dependents;
+  deck.source_index = base.source_index;
+
+  auto tx = deck.Begin();
+  for (const auto &[param, value] : values) {
+    std::size_t i = 0;
+    while (i < names.size() && names[i] != param &&
+           ParamPath(params[i].first, params[i].second) != param) {
+      i++;
+    }
+    if (i == names.size()) {
+      std::stringstream msg;
+      msg << "'" << param << "' is not a parameter of the prepared deck";
+      fatal(msg);
+    }
+    const auto &[suit, name] = params[i];
+    const Card &card = base.GetCard(suit, name);
+    const auto &v = value.Get();
+    const bool same_type = (card.isNumber() && std::holds_alternative<double>(v)) ||
+                           (card.isBool() && std::holds_alternative<bool>(v)) ||
+                           (card.isString() && std::holds_alternative<std::string>(v));
+    if (!same_type) {
+      std::stringstream msg;
+      msg << "Parameter '" << param << "' must be a "
+          << (card.isNumber() ? "number" : card.isBool() ? "bool" : "string")
+          << " like its default";
+      fatal(msg);
+    }
+    std::visit([&](const auto &x) { tx.Set(suit, name, x); }, v);
+  }
+  if (!tx.Commit()) {
+    std::stringstream msg;
+    msg << "Prepared deck could not be instantiated: " << tx.Error();
+    fatal(msg);
+  }
+  // loops, conditions and sampling declarations were expanded with the defaults
+  for (const auto &input : base.build_inputs) {
+    const auto before = base.vm.globals.find(input);
+    const auto after = deck.vm.globals.find(input);
+    if (before == base.vm.globals.end() || after == deck.vm.globals.end() ||
+        SameValue(before->second, after->second)) {
+      continue;
+    }
+    std::stringstream msg;
+    msg << "Prepared deck could not be instantiated: '" << input
+        << "' changes, but it is read by a loop bound, an if or suit condition or a "
+           "sampling declaration; build the deck with these values instead";
+    fatal(msg);
+  }
+  // an instance reads as if it had been built with these values
+  deck.journal.resize(base.journal.size());
+  return deck;
+}
+
+PreparedDeck Prepare(std::istream &ss, const std::vector<std::string> &params) {
+  Deck deck;
+  deck.Build(ss);
+  return PreparedDeck(deck, params);
+}
+
+} // namespace Rummy
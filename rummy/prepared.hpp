@@ -0,0 +1,82 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+
+#ifndef RUMMY_PREPARED_HPP_
+#define RUMMY_PREPARED_HPP_
+
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "deck.hpp"
+
+namespace Rummy {
+
+// Value of a prepared deck parameter: a number, a bool or a string
+class ParamValue {
+ public:
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+  ParamValue(T v) {
+    if constexpr (std::is_same_v<T, bool>) {
+      value = v;
+    } else {
+      value = static_cast<double>(v);
+    }
+  }
+  ParamValue(std::string v) : value(std::move(v)) {}
+  ParamValue(const char *v) : value(std::string(v)) {}
+
+  const std::variant<double, bool, std::string> &Get() const { return value; }
+
+ private:
+  std::variant<double, bool, std::string> value;
+};
+
+// A deck compiled once whose parameter cards are replaced per instance. Parameters
+// are ordinary cards of the deck ("rho", or "gas/rho" when the name is not unique)
+// and their values in the text are the defaults. Instantiate copies the compiled
+// base, sets the parameters and re-evaluates only the numeric and boolean cards
+// derived from them, as a Deck transaction does; the text is never parsed again.
+// Cards read while building (loop bounds, if and suit conditions, sampling
+// arguments) are recorded by the deck, and Instantiate fails when the parameters
+// change one of them, since the deck would need a full Build.
+class PreparedDeck {
+ public:
+  PreparedDeck(const Deck &deck, const std::vector<std::string> &params);
+
+  const Deck &GetBase() const { return base; }
+  // Parameter cards as (suit, name), in the order given to Prepare
+  const std::vector<std::pair<std::string, std::string>> &GetParams() const {
+    return params;
+  }
+  // Parameters that are not given keep their default
+  Deck Instantiate(const std::vector<std::pair<std::string, ParamValue>> &values = {})
+      const;
+
+ private:
+  Deck base;
+  std::vector<std::string> names; // as given to Prepare
+  std::vector<std::pair<std::string, std::string>> params;
+};
+
+PreparedDeck Prepare(std::istream &ss, const std::vector<std::string> &params);
+
+} // namespace Rummy
+
+#endif // RUMMY_PREPARED_HPP_
@@ -0,0 +1,41 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+#ifndef RUMMY_PROBES_HPP_
+#define RUMMY_PROBES_HPP_
+
+// Static USDT tracepoints for perf and bpftrace, enabled with -DRUMMY_ENABLE_USDT=ON.
+// Each probe compiles to a single nop plus a note in the binary, so it costs nothing
+// until a tracer attaches. Without the option the macros expand to nothing. Probes
+// (provider "rummy"; strings are const char *):
+//   build__begin()                    build__end(int ncards)
+//   suit__begin(const char *suit)     suit__end(const char *suit)
+//   include__open(const char *path)   include__close(const char *path)
+//   interpret__entry(const char *src) interpret__exit(int result)
+//   getcard__hit(suit, name)          getcard__miss(suit, name)
+// See tools/bpftrace for sample scripts.
+
+#ifdef RUMMY_ENABLE_USDT
+#include <sys/sdt.h>
+#define RUMMY_PROBE0(name) DTRACE_PROBE(rummy, name)
+#define RUMMY_PROBE1(name, a) DTRACE_PROBE1(rummy, name, a)
+#define RUMMY_PROBE2(name, a, b) DTRACE_PROBE2(rummy, name, a, b)
+#else
+#define RUMMY_PROBE0(name) ((void)0)
+#define RUMMY_PROBE1(name, a) ((void)0)
+#define RUMMY_PROBE2(name, a, b) ((void)0)
+#endif
+
+#endif // RUMMY_PROBES_HPP_
@@ -18,8 +18,22 @@
 #define RUMMY_UTILS_HPP_
 
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <memory_resource>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
 namespace Rummy {
 
 inline void fatal(const char *msg) {
@@ -35,7 +49,7 @@ inline void fatal(const std::stringstream &msg) {
   std::abort();
 }
 
-inline void EmptyCheck(const std::string &str, const int line_num) {
+inline void EmptyCheck(std::string_view str, const int line_num) {
   if (str.empty()) {
     std::stringstream msg;
     msg << "Empty string at line " << line_num;
@@ -43,151 +57,359 @@ inline void EmptyCheck(const std::string &str, const int line_num) {
   }
 }
 
-inline void RemoveLeadingWhitespace(std::string &str) {
+// The string helpers work in place on std::string and std::pmr::string alike, so
+// build-time temporaries can live in a per-statement arena.
+template <typename String>
+void RemoveLeadingWhitespace(String &str) {
   str.erase(str.begin(),
             std::find_if(str.begin(), str.end(), [](char c) { return !std::isspace(c); }));
 }
 
-inline void RemoveTrailingWhitespace(std::string &str) {
+template <typename String>
+void RemoveTrailingWhitespace(String &str) {
   str.erase(std::find_if(str.rbegin(), str.rend(), [](char c) { return !std::isspace(c); })
                 .base(),
             str.end());
 }
 
-inline void RemoveWhitespace(std::string &str) {
+template <typename String>
+void RemoveWhitespace(String &str) {
   str.erase(
       std::remove_if(str.begin(), str.end(), [](char c) { return std::isspace(c); }),
       str.end());
 }
 
-inline void RemoveWhitespacePreserveQuotes(std::string &str, const int line_num,
-                                           char quote_char = '"') {
-  if (str.find_first_of(quote_char) == std::string::npos) {
-    RemoveWhitespace(str);
-    return;
+template <typename String>
+void RemoveWhitespacePreserveQuotes(String &str, const int line_num,
+                                    char quote_char = '"') {
+  // compact in place: whitespace outside quotes is dropped, quoted text kept verbatim
+  std::size_t out = 0;
+  bool in_quotes = false;
+  for (std::size_t i = 0; i < str.size(); i++) {
+    const char c = str[i];
+    if (c == quote_char) {
+      in_quotes = !in_quotes;
+    } else if (!in_quotes && std::isspace(static_cast<unsigned char>(c))) {
+      continue;
+    }
+    str[out++] = c;
+  }
+  if (in_quotes) {
+    std::stringstream msg;
+    msg << "Missing closing quote in card value at line " << line_num;
+    fatal(msg);
+  }
+  str.resize(out);
+}
+
+// Join pieces into a string allocated from resource
+inline std::pmr::string Concat(std::pmr::memory_resource *resource,
+                               std::initializer_list<std::string_view> pieces) {
+  std::pmr::string result(resource);
+  std::size_t size = 0;
+  for (const auto &piece : pieces) {
+    size += piece.size();
   }
-  std::string result;
-  size_t pos = 0;
-  while (pos <= str.size()) {
-    auto quote_start = str.find(quote_char, pos);
-    // Strip whitespace from the unquoted segment before the next quote (or end)
-    std::string unquoted = str.substr(pos, quote_start == std::string::npos
-                                              ? std::string::npos
-                                              : quote_start - pos);
-    RemoveWhitespace(unquoted);
-    result += unquoted;
-    if (quote_start == std::string::npos) break;
-    // Find matching closing quote
-    auto quote_end = str.find(quote_char, quote_start + 1);
-    if (quote_end == std::string::npos) {
+  result.reserve(size);
+  for (const auto &piece : pieces) {
+    result.append(piece);
+  }
+  return result;
+}
+
+// Python style slice, start:stop:step. Omitted bounds are empty; negative bounds count
+// from the end of the vector.
+struct Slice {
+  std::optional<long> start;
+  std::optional<long> stop;
+  long step = 1;
+
+  // "1:5", "::2", "-3:", "10:0:-1" (surrounding brackets are allowed)
+  static Slice Parse(std::string_view text, const int line_num) {
+    if (text.size() >= 2 && text.front() == '[' && text.back() == ']') {
+      text = text.substr(1, text.size() - 2);
+    }
+    const auto ncolons = std::count(text.begin(), text.end(), ':');
+    if (ncolons < 1 || ncolons > 2) {
       std::stringstream msg;
-      msg << "Missing closing quote in card value at line " << line_num;
+      msg << "Invalid vector slice '" << text << "' at line " << line_num;
       fatal(msg);
     }
-    // Preserve the quoted segment verbatim
-    result += str.substr(quote_start, quote_end - quote_start + 1);
-    pos = quote_end + 1;
+    std::array<std::string_view, 3> fields;
+    std::size_t pos = 0;
+    for (long f = 0; f <= ncolons; f++) {
+      auto colon = std::min(text.find(':', pos), text.size());
+      auto field = text.substr(pos, colon - pos);
+      while (!field.empty() && std::isspace(static_cast<unsigned char>(field.front()))) {
+        field.remove_prefix(1);
+      }
+      while (!field.empty() && std::isspace(static_cast<unsigned char>(field.back()))) {
+        field.remove_suffix(1);
+      }
+      fields[f] = field;
+      pos = colon + 1;
+    }
+    auto to_long = [&](std::string_view field) -> std::optional<long> {
+      if (field.empty()) return std::nullopt;
+      long value = 0;
+      const char *first = field.data() + (field[0] == '+' ? 1 : 0);
+      auto [ptr, ec] = std::from_chars(first, field.data() + field.size(), value);
+      if (ec != std::errc() || ptr != field.data() + field.size()) {
+        std::stringstream msg;
+        msg << "Vector slice bounds must be integers, got '" << field << "' at line "
+            << line_num;
+        fatal(msg);
+      }
+      return value;
+    };
+    Slice slice;
+    slice.start = to_long(fields[0]);
+    slice.stop = to_long(fields[1]);
+    if (ncolons == 2 && !fields[2].empty()) slice.step = *to_long(fields[2]);
+    if (slice.step == 0) {
+      std::stringstream msg;
+      msg << "Vector slice step cannot be zero at line " << line_num;
+      fatal(msg);
+    }
+    return slice;
   }
-  str = result;
-}
 
-inline std::vector<std::string> SplitString(const std::string &str, const int line_num,
-                                            const int max_size = -1) {
-  std::vector<std::string> vec;
+  // First index and number of elements selected from a vector of the given length
+  // (-1 if unknown). With clamp, bounds past the end are cut back as in Python.
+  std::pair<long, long> Resolve(const long length, const int line_num,
+                                const bool clamp = true) const {
+    auto need_length = [&]() {
+      if (length >= 0) return;
+      std::stringstream msg;
+      msg << "Must specify upper bound in vector slice declaration at line " << line_num;
+      fatal(msg);
+    };
+    // normalize a bound; lowest is the smallest valid result (-1 means before 0)
+    auto bound = [&](long b, long lowest, long highest) {
+      if (b < 0) {
+        need_length();
+        b += length;
+      }
+      b = std::max(b, lowest);
+      return (clamp && length >= 0) ? std::min(b, highest) : b;
+    };
+    long first = 0;
+    long count = 0;
+    if (step > 0) {
+      first = start ? bound(*start, 0, length) : 0;
+      if (!stop) need_length();
+      const long last = stop ? bound(*stop, 0, length) : length;
+      count = (last > first) ? (last - first + step - 1) / step : 0;
+    } else {
+      if (!start) need_length();
+      first = start ? bound(*start, -1, length - 1) : length - 1;
+      const long last = stop ? bound(*stop, -1, length - 1) : -1;
+      count = (first > last) ? (first - last - step - 1) / -step : 0;
+    }
+    return {first, count};
+  }
+};
+
+// Expand a vector literal into its elements, or a statement with slices into one
+// statement per selected element. length(name) gives the number of elements of a
+// named vector (-1 if unknown) for negative and open bounds. max_size >= 0 marks an
+// assignment target: an open stop then takes max_size elements and explicit bounds
+// are not clamped, so a vector can grow. The results are allocated from resource.
+inline long UnknownLength(std::string_view) { return -1; }
+template <typename Length = decltype(&UnknownLength)>
+std::pmr::vector<std::pmr::string>
+SplitString(std::string_view str, const int line_num, const int max_size = -1,
+            Length &&length = &UnknownLength,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+  std::pmr::vector<std::pmr::string> vec(resource);
   auto colon_pos = str.find_first_of(':');
-  if (colon_pos == std::string::npos) {
+  if (colon_pos == std::string_view::npos) {
     // setting a vector
     auto contents = str.substr(1, str.size() - 2); // remove brackets
-    std::stringstream ss(contents);
-    std::string value;
-    while (std::getline(ss, value, ',')) {
+    std::size_t pos = 0;
+    while (pos < contents.size()) {
+      auto comma = std::min(contents.find(',', pos), contents.size());
+      auto &value = vec.emplace_back(contents.substr(pos, comma - pos));
       RemoveWhitespacePreserveQuotes(value, line_num);
       EmptyCheck(value, line_num);
-      vec.push_back(value);
+      pos = comma + 1;
     }
   } else {
-
-    // prefix[1:3]suffix[:2]suffix2
+    // prefix[1:3]suffix[::-1]suffix2
     // split this as
-    // prefix[1]suffix[0]suffix2, prefix[2]suffix[1]suffix2,
-    std::vector<std::string> parts;
-    std::vector<int> lowers;
-    std::vector<int> uppers;
-    std::string current_part;
-    std::string slice;
-    bool in_brackets = false;
-    for (char c : str) {
-      if (c == '[') {
-        if (!current_part.empty()) {
-          parts.push_back(current_part);
-          current_part.clear();
-        }
-        in_brackets = true;
-      } else if (in_brackets) {
-        if (c == ':') {
-          if (!slice.empty()) {
-            // we have a slice like [1:2]
-            lowers.push_back(std::stoi(slice));
-            slice.clear();
-          } else {
-            // if we have an empty slice, it means we have a slice like [:2]
-            lowers.push_back(0);
-          }
-        } else if (c == ']') {
-          if (!slice.empty()) {
-            // we have a slice like [1:2]
-            uppers.push_back(std::stoi(slice));
-            slice.clear();
-          } else {
-            // if we have an empty slice, it means we have a slice like [1:]
-            if (max_size < 0) {
-              std::stringstream msg;
-              msg << "Must specify upper bound in vector slice declaration at line "
-                  << line_num;
-              fatal(msg);
-            }
-            uppers.push_back(max_size);
-            slice.clear();
-          }
-          in_brackets = false;
-        } else {
-          slice += c;
-        }
+    // prefix[1]suffix[n-1]suffix2, prefix[2]suffix[n-2]suffix2,
+    // brackets without a colon are plain indices and kept as written
+    std::pmr::vector<std::string_view> parts(resource);
+    std::pmr::vector<std::pair<long, long>> ranges(resource); // first index and step
+    std::size_t part_start = 0;
+    long count = -1;
+    for (std::size_t i = 0; i < str.size(); i++) {
+      if (str[i] != '[') continue;
+      const auto close = str.find(']', i);
+      if (close == std::string_view::npos) {
+        std::stringstream msg;
+        msg << "Missing closing ']' in vector slice at line " << line_num;
+        fatal(msg);
+      }
+      const auto contents = str.substr(i + 1, close - i - 1);
+      if (contents.find(':') == std::string_view::npos) {
+        i = close;
+        continue;
+      }
+      // the sliced vector is the name just before the bracket
+      const auto part = str.substr(part_start, i - part_start);
+      auto name_start = part.size();
+      while (name_start > 0 &&
+             (std::isalnum(static_cast<unsigned char>(part[name_start - 1])) ||
+              part[name_start - 1] == '_' || part[name_start - 1] == '.')) {
+        name_start--;
+      }
+      const auto slice = Slice::Parse(contents, line_num);
+      const long vec_length = length(part.substr(name_start));
+      long first = 0;
+      long n = 0;
+      if (max_size >= 0 && !slice.stop && slice.step > 0) {
+        // an open ended target takes one element per value
+        auto head = slice;
+        head.stop = head.start.value_or(0);
+        first = head.Resolve(vec_length, line_num, false).first;
+        n = max_size;
       } else {
-        current_part += c;
+        std::tie(first, n) = slice.Resolve(vec_length, line_num, max_size < 0);
       }
+      count = (count < 0) ? n : std::min(count, n);
+      parts.push_back(part);
+      ranges.emplace_back(first, slice.step);
+      part_start = close + 1;
+      i = close;
     }
-
-    if (!current_part.empty()) {
-      parts.push_back(current_part);
-    }
+    parts.push_back(str.substr(part_start));
 
     // combine parts with slices
-    if (lowers.empty()) {
+    if (ranges.empty()) {
       std::stringstream msg;
       msg << "Vector slice syntax requires '[start:end]' brackets at line " << line_num;
       fatal(msg);
     }
-    int count = 99999;
-    for (size_t i = 0; i < lowers.size(); i++) {
-      count = std::min(count, uppers[i] - lowers[i]);
-    }
-    for (int i = 0; i < count; i++) {
-      std::string contents;
-      for (size_t j = 0; j < parts.size(); j++) {
-        if (j < lowers.size()) {
-          contents += parts[j] + "[" + std::to_string(lowers[j] + i) + "]";
-        } else {
-          contents += parts[j];
+    vec.reserve(std::max(count, 0L));
+    for (long i = 0; i < count; i++) {
+      auto &contents = vec.emplace_back();
+      for (std::size_t j = 0; j < parts.size(); j++) {
+        contents += parts[j];
+        if (j < ranges.size()) {
+          char index[24];
+          auto [ptr, ec] = std::to_chars(index, index + sizeof(index),
+                                         ranges[j].first + i * ranges[j].second);
+          contents += '[';
+          contents.append(index, ptr);
+          contents += ']';
         }
       }
       RemoveWhitespacePreserveQuotes(contents, line_num);
-      vec.push_back(contents);
     }
   }
   return vec;
 }
 
+// One element of a literal list. Numbers and plain quoted strings are decoded while
+// scanning; anything else (names, expressions) is left as text for the VM.
+struct ListElement {
+  enum class Kind : std::uint8_t { NUMBER, STRING, EXPRESSION };
+  Kind kind = Kind::EXPRESSION;
+  double number = 0.0;
+  std::string_view text; // element text, or the string contents without quotes
+};
+
+// Parse a decimal floating point literal spanning exactly [first, last)
+inline bool ParseNumber(const char *first, const char *last, double &value) {
+  if (first != last && *first == '+') first++;
+  const char *digits = (first != last && *first == '-') ? first + 1 : first;
+  // from_chars also accepts inf/nan, which the VM would read as names
+  if (digits == last || !(std::isdigit(static_cast<unsigned char>(*digits)) || *digits == '.')) {
+    return false;
+  }
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  auto [ptr, ec] = std::from_chars(first, last, value);
+  return ec == std::errc() && ptr == last;
+#else
+  if (std::find_if(first, last, [](char c) { return c == 'x' || c == 'X'; }) != last) {
+    return false;
+  }
+  std::string copy(first, last);
+  char *end = nullptr;
+  value = std::strtod(copy.c_str(), &end);
+  return end == copy.c_str() + copy.size();
+#endif
+}
+
+// Split a comma separated list (brackets and whitespace outside quotes already
+// removed) in one pass. A trailing comma is ignored and empty elements are fatal.
+inline std::pmr::vector<ListElement>
+ScanList(std::string_view list, const int line_num,
+         std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+  std::pmr::vector<ListElement> elements(resource);
+  elements.reserve(std::count(list.begin(), list.end(), ',') + 1);
+  std::size_t pos = 0;
+  while (pos < list.size()) {
+    std::size_t end = pos;
+    bool in_quotes = false;
+    while (end < list.size() && (in_quotes || list[end] != ',')) {
+      if (list[end] == '"') in_quotes = !in_quotes;
+      end++;
+    }
+    ListElement element;
+    element.text = list.substr(pos, end - pos);
+    if (element.text.empty()) {
+      std::stringstream msg;
+      msg << "Empty string at line " << line_num;
+      fatal(msg);
+    }
+    const auto &text = element.text;
+    if (ParseNumber(text.data(), text.data() + text.size(), element.number)) {
+      element.kind = ListElement::Kind::NUMBER;
+    } else if (text.size() >= 2 && text.front() == '"' && text.back() == '"' &&
+               std::count(text.begin(), text.end(), '"') == 2 &&
+               text.find('\\') == std::string_view::npos) {
+      element.kind = ListElement::Kind::STRING;
+      element.text = text.substr(1, text.size() - 2);
+    }
+    elements.push_back(element);
+    pos = end + 1;
+  }
+  return elements;
+}
+
+// Binary I/O helpers for the on-disk ensemble and index formats (native byte order)
+template <typename T>
+void WritePod(std::ostream &os, const T &val) {
+  os.write(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+inline void WriteBytes(std::ostream &os, const std::string &str) {
+  WritePod(os, static_cast<std::uint64_t>(str.size()));
+  os.write(str.data(), str.size());
+}
+template <typename T>
+T ReadPod(std::istream &is) {
+  T val;
+  is.read(reinterpret_cast<char *>(&val), sizeof(T));
+  if (!is) fatal("Unexpected end of file while reading binary input");
+  return val;
+}
+inline std::string ReadBytes(std::istream &is) {
+  const auto len = ReadPod<std::uint64_t>(is);
+  // grow in bounded steps so a corrupt length fails at the end of the input rather
+  // than allocating it up front
+  std::string str;
+  while (str.size() < len) {
+    const auto old_size = str.size();
+    const auto step = std::min<std::uint64_t>(len - old_size, std::uint64_t(1) << 20);
+    str.resize(old_size + step);
+    is.read(&str[old_size], str.size() - old_size);
+    if (!is) fatal("Unexpected end of file while reading binary input");
+  }
+  return str;
+}
+
 } // namespace Rummy
 
 #endif // RUMMY_UTILS_HPP_
@@ -0,0 +1,223 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "deck.hpp"
+#include "rummy_utils.hpp"
+#include "sampling.hpp"
+
+namespace Rummy {
+
+namespace {
+// primitive polynomial degree s, coefficients a and initial direction numbers m of
+// Sobol dimensions 2-21 (Joe and Kuo, new-joe-kuo-6.21201)
+struct SobolPolynomial {
+  unsigned s;
+  unsigned a;
+  std::array<std::uint32_t, 7> m;
+};
+constexpr SobolPolynomial kSobol[] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+};
+constexpr std::size_t kMaxSobolDims = 1 + sizeof(kSobol) / sizeof(kSobol[0]);
+constexpr double kTwo32 = 4294967296.0;
+constexpr double kTwo64 = 18446744073709551616.0;
+
+// 32 direction numbers V[1..32] of a Sobol dimension, scaled to 32 bits
+std::array<std::uint32_t, 33> DirectionNumbers(std::size_t dim) {
+  std::array<std::uint32_t, 33> v{};
+  if (dim == 0) {
+    for (unsigned k = 1; k <= 32; k++) v[k] = std::uint32_t(1) << (32 - k);
+    return v;
+  }
+  const auto &poly = kSobol[dim - 1];
+  for (unsigned k = 1; k <= 32; k++) {
+    if (k <= poly.s) {
+      v[k] = poly.m[k - 1] << (32 - k);
+      continue;
+    }
+    v[k] = v[k - poly.s] ^ (v[k - poly.s] >> poly.s);
+    for (unsigned i = 1; i < poly.s; i++) {
+      if ((poly.a >> (poly.s - 1 - i)) & 1) v[k] ^= v[k - i];
+    }
+  }
+  return v;
+}
+
+// uniform in (0, 1) from the top 53 bits, the same on every platform
+double Uniform(std::mt19937_64 &rng) {
+  return (static_cast<double>(rng() >> 11) + 0.5) / 9007199254740992.0;
+}
+} // namespace
+
+double SampledCard::Nominal() const {
+  switch (dist) {
+  case Distribution::UNIFORM: return 0.5 * (a + b);
+  case Distribution::LOGUNIFORM: return std::sqrt(a * b);
+  case Distribution::NORMAL: return a;
+  }
+  return a;
+}
+
+double SampledCard::Quantile(double u) const {
+  switch (dist) {
+  case Distribution::UNIFORM: return a + (b - a) * u;
+  case Distribution::LOGUNIFORM: return std::exp(std::log(a) + (std::log(b / a)) * u);
+  case Distribution::NORMAL: return a + b * InverseNormal(u);
+  }
+  return a;
+}
+
+SamplingDesign SamplingDesign::FromDeck(const Deck &deck) {
+  if (!deck.DoesSuitExist("sampling") || !deck.DoesCardExist("sampling", "n")) {
+    fatal("Sampling needs a <sampling> suit with at least an 'n' card");
+  }
+  SamplingDesign design;
+  const auto n = deck.GetCard("sampling", "n").Get<double>();
+  if (!(n >= 1.0) || n != std::floor(n) || n > kTwo32) {
+    std::stringstream msg;
+    msg << "Sampling size sampling/n = " << n << " must be a positive integer";
+    fatal(msg);
+  }
+  design.n = static_cast<std::size_t>(n);
+  if (deck.DoesCardExist("sampling", "design")) {
+    design.design = deck.GetCard("sampling", "design").Get<std::string>();
+  }
+  if (deck.DoesCardExist("sampling", "seed")) {
+    const auto seed = deck.GetCard("sampling", "seed").Get<double>();
+    if (!(seed >= 0.0) || seed != std::floor(seed) || seed >= kTwo64) {
+      std::stringstream msg;
+      msg << "Sampling seed sampling/seed = " << seed
+          << " must be a non-negative integer below 2^64";
+      fatal(msg);
+    }
+    design.seed = static_cast<std::uint64_t>(seed);
+  }
+  return design;
+}
+
+std::vector<double> DesignPoints(const SamplingDesign &design, std::size_t dims) {
+  const auto n = design.n;
+  std::vector<double> points(n * dims);
+  std::mt19937_64 rng(design.seed);
+  if (design.design == "lhs") {
+    // one point in each of the n strata of every coordinate, strata paired at random
+    std::vector<std::size_t> perm(n);
+    for (std::size_t d = 0; d < dims; d++) {
+      std::iota(perm.begin(), perm.end(), 0);
+      for (std::size_t i = n; i > 1; i--) {
+        std::swap(perm[i - 1], perm[rng() % i]);
+      }
+      for (std::size_t i = 0; i < n; i++) {
+        points[i * dims + d] = (static_cast<double>(perm[i]) + Uniform(rng)) / n;
+      }
+    }
+  } else if (design.design == "sobol") {
+    if (dims > kMaxSobolDims) {
+      std::stringstream msg;
+      msg << "Sobol sampling supports up to " << kMaxSobolDims << " sampled cards, not "
+          << dims;
+      fatal(msg);
+    }
+    // Gray code order; a random digital shift per coordinate keeps the points off 0
+    // and preserves their stratification
+    for (std::size_t d = 0; d < dims; d++) {
+      const auto v = DirectionNumbers(d);
+      const auto shift = static_cast<std::uint32_t>(rng() >> 32);
+      std::uint32_t x = 0;
+      for (std::size_t i = 0; i < n; i++) {
+        if (i > 0) {
+          unsigned c = 1;
+          for (auto value = i - 1; value & 1; value >>= 1) c++;
+          x ^= v[c];
+        }
+        points[i * dims + d] = (static_cast<double>(x ^ shift) + 0.5) / kTwo32;
+      }
+    }
+  } else if (design.design == "random") {
+    for (auto &point : points) point = Uniform(rng);
+  } else {
+    std::stringstream msg;
+    msg << "Unknown sampling design '" << design.design << "' (lhs, sobol or random)";
+    fatal(msg);
+  }
+  return points;
+}
+
+double InverseNormal(double p) {
+  // Acklam's rational approximation followed by one Halley step
+  constexpr double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                          -2.759285104469687e+02, 1.383577518672690e+02,
+                          -3.066479806614716e+01, 2.506628277459239e+00};
+  constexpr double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                          -1.556989798598866e+02, 6.680131188771972e+01,
+                          -1.328068155288572e+01};
+  constexpr double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                          -2.400758277161838e+00, -2.549732539343734e+00,
+                          4.374664141464968e+00,  2.938163982698783e+00};
+  constexpr double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                          2.445134137142996e+00, 3.754408661907416e+00};
+  constexpr double p_low = 0.02425;
+  constexpr double kSqrt2Pi = 2.50662827463100050242;
+  if (!(p > 0.0 && p < 1.0)) {
+    std::stringstream msg;
+    msg << "InverseNormal probability " << p << " is not in (0, 1)";
+    fatal(msg);
+  }
+  double x;
+  if (p < p_low || p > 1.0 - p_low) {
+    const double q = std::sqrt(-2.0 * std::log(std::min(p, 1.0 - p)));
+    x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+        ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    if (p > 0.5) x = -x;
+  } else {
+    const double q = p - 0.5;
+    const double r = q * q;
+    x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+        (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+  }
+  const double e = 0.5 * std::erfc(-x / std::sqrt(2.0)) - p;
+  const double u = e * kSqrt2Pi * std::exp(0.5 * x * x);
+  return x - u / (1.0 + 0.5 * x * u);
+}
+
+} // namespace Rummy
@@ -0,0 +1,64 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_SAMPLING_HPP_
+#define RUMMY_SAMPLING_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Rummy {
+
+class Deck;
+
+enum class Distribution : std::uint8_t { UNIFORM, LOGUNIFORM, NORMAL };
+
+// A card declared with a sampling distribution, e.g. "rho ~ uniform(0.9, 1.1)". The
+// base deck holds the nominal value (the midpoint, geometric midpoint or mean).
+struct SampledCard {
+  std::string suit;
+  std::string name;
+  Distribution dist = Distribution::UNIFORM;
+  double a = 0.0; // lower bound, or mean for NORMAL
+  double b = 0.0; // upper bound, or standard deviation for NORMAL
+  int line_num = -1;
+
+  double Nominal() const;
+  // value at probability u in (0, 1)
+  double Quantile(double u) const;
+};
+
+// How ensemble members are drawn: design is "lhs" (Latin hypercube), "sobol"
+// (randomly shifted Sobol points, up to 21 sampled cards) or "random". Decks declare
+// it in a <sampling> suit with design, n and seed cards.
+struct SamplingDesign {
+  std::string design = "lhs";
+  std::size_t n = 0;
+  std::uint64_t seed = 0;
+
+  static SamplingDesign FromDeck(const Deck &deck);
+};
+
+// n points of the design in the unit hypercube of the given dimension, row major.
+// Every coordinate is in (0, 1), and the points depend only on the design and seed.
+std::vector<double> DesignPoints(const SamplingDesign &design, std::size_t dims);
+
+// Inverse of the standard normal CDF
+double InverseNormal(double p);
+
+} // namespace Rummy
+
+#endif // RUMMY_SAMPLING_HPP_
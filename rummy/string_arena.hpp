@@ -0,0 +1,74 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_STRING_ARENA_HPP_
+#define RUMMY_STRING_ARENA_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Rummy {
+
+// Per-deck store for strings that do not fit in a pips::Value (STRING_MAX - 1
+// characters). Strings are interned, so equal strings share one copy and one id, and
+// the compiler only ever sees a short reference such as "\x1f12". Entries are never
+// removed, so views and shared pointers into the arena stay valid. A copy shares the
+// immutable entries and keeps their ids. Intern is not synchronized.
+class StringArena {
+ public:
+  static constexpr char kReferenceMark = '\x1f';
+
+  std::uint32_t Intern(std::string_view str) {
+    auto it = ids.find(str);
+    if (it != ids.end()) return it->second;
+    const auto id = static_cast<std::uint32_t>(strings.size());
+    strings.push_back(std::make_shared<const std::string>(str));
+    ids.emplace(std::string_view(*strings.back()), id);
+    bytes += str.size();
+    return id;
+  }
+  std::shared_ptr<const std::string> Get(std::uint32_t id) const { return strings.at(id); }
+
+  static std::string Reference(std::uint32_t id) {
+    return std::string(1, kReferenceMark) + std::to_string(id);
+  }
+  // id of a reference produced by Reference, if str is one
+  std::optional<std::uint32_t> ParseReference(const char *str) const {
+    if (str == nullptr || str[0] != kReferenceMark) return std::nullopt;
+    char *end = nullptr;
+    const auto id = std::strtoul(str + 1, &end, 10);
+    if (end == str + 1 || *end != '\0' || id >= strings.size()) return std::nullopt;
+    return static_cast<std::uint32_t>(id);
+  }
+
+  std::size_t size() const { return strings.size(); }
+  std::size_t NumBytes() const { return bytes; }
+
+ private:
+  std::vector<std::shared_ptr<const std::string>> strings;
+  std::unordered_map<std::string_view, std::uint32_t> ids; // views into strings
+  std::size_t bytes = 0;
+};
+
+} // namespace Rummy
+
+#endif // RUMMY_STRING_ARENA_HPP_
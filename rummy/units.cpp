@@ -0,0 +1,577 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rummy_utils.hpp"
+#include "units.hpp"
+
+namespace Rummy {
+
+namespace {
+constexpr int L = 0, M = 1, T = 2, K = 3;
+
+UnitValue Unit(double factor, int l, int m, int t, int k = 0) {
+  UnitValue unit;
+  unit.factor = factor;
+  unit.dim.exp = {l, m, t, k};
+  return unit;
+}
+
+const std::map<std::string, UnitValue, std::less<>> &UnitTable() {
+  static const std::map<std::string, UnitValue, std::less<>> table = {
+      // length
+      {"m", Unit(1.0, 1, 0, 0)},
+      {"cm", Unit(1.0e-2, 1, 0, 0)},
+      {"mm", Unit(1.0e-3, 1, 0, 0)},
+      {"um", Unit(1.0e-6, 1, 0, 0)},
+      {"nm", Unit(1.0e-9, 1, 0, 0)},
+      {"km", Unit(1.0e3, 1, 0, 0)},
+      {"angstrom", Unit(1.0e-10, 1, 0, 0)},
+      {"Rsun", Unit(6.957e8, 1, 0, 0)},
+      {"AU", Unit(1.495978707e11, 1, 0, 0)},
+      {"au", Unit(1.495978707e11, 1, 0, 0)},
+      {"ly", Unit(9.4607304725808e15, 1, 0, 0)},
+      {"pc", Unit(3.0856775814913673e16, 1, 0, 0)},
+      {"kpc", Unit(3.0856775814913673e19, 1, 0, 0)},
+      {"Mpc", Unit(3.0856775814913673e22, 1, 0, 0)},
+      // mass
+      {"kg", Unit(1.0, 0, 1, 0)},
+      {"g", Unit(1.0e-3, 0, 1, 0)},
+      {"amu", Unit(1.66053906660e-27, 0, 1, 0)},
+      {"Mearth", Unit(5.9722e24, 0, 1, 0)},
+      {"Msun", Unit(1.98841e30, 0, 1, 0)},
+      // time
+      {"s", Unit(1.0, 0, 0, 1)},
+      {"ms", Unit(1.0e-3, 0, 0, 1)},
+      {"us", Unit(1.0e-6, 0, 0, 1)},
+      {"ns", Unit(1.0e-9, 0, 0, 1)},
+      {"min", Unit(60.0, 0, 0, 1)},
+      {"hr", Unit(3600.0, 0, 0, 1)},
+      {"day", Unit(86400.0, 0, 0, 1)},
+      {"yr", Unit(3.15576e7, 0, 0, 1)},
+      {"kyr", Unit(3.15576e10, 0, 0, 1)},
+      {"Myr", Unit(3.15576e13, 0, 0, 1)},
+      {"Gyr", Unit(3.15576e16, 0, 0, 1)},
+      {"Hz", Unit(1.0, 0, 0, -1)},
+      // temperature
+      {"K", Unit(1.0, 0, 0, 0, 1)},
+      // energy, force, pressure and power
+      {"J", Unit(1.0, 2, 1, -2)},
+      {"erg", Unit(1.0e-7, 2, 1, -2)},
+      {"eV", Unit(1.602176634e-19, 2, 1, -2)},
+      {"keV", Unit(1.602176634e-16, 2, 1, -2)},
+      {"MeV", Unit(1.602176634e-13, 2, 1, -2)},
+      {"GeV", Unit(1.602176634e-10, 2, 1, -2)},
+      {"N", Unit(1.0, 1, 1, -2)},
+      {"dyn", Unit(1.0e-5, 1, 1, -2)},
+      {"Pa", Unit(1.0, -1, 1, -2)},
+      {"Ba", Unit(0.1, -1, 1, -2)},
+      {"bar", Unit(1.0e5, -1, 1, -2)},
+      {"atm", Unit(101325.0, -1, 1, -2)},
+      {"W", Unit(1.0, 2, 1, -3)},
+  };
+  return table;
+}
+
+bool IsIdentStart(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+bool IsIdentChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+// Read a name and an optional integer power at pos; pos is only advanced on success
+std::optional<UnitValue> ReadUnit(std::string_view str, std::size_t &pos,
+                                  const std::string &system) {
+  std::size_t end = pos;
+  if (end >= str.size() || !IsIdentStart(str[end])) return std::nullopt;
+  while (end < str.size() && IsIdentChar(str[end])) end++;
+  auto it = UnitTable().find(str.substr(pos, end - pos));
+  if (it == UnitTable().end()) return std::nullopt;
+  UnitValue unit = it->second;
+  // convert each unit on its own so e.g. g/cm^3 is exactly 1 in cgs
+  unit.factor *= SystemFactor(unit.dim, system);
+  int power = 1;
+  std::size_t after = end;
+  if (str.compare(after, 1, "^") == 0) {
+    after += 1;
+  } else if (str.compare(after, 2, "**") == 0) {
+    after += 2;
+  }
+  if (after != end) {
+    std::size_t digits = after + (str.compare(after, 1, "-") == 0 ? 1 : 0);
+    std::size_t last = digits;
+    while (last < str.size() && std::isdigit(static_cast<unsigned char>(str[last]))) last++;
+    if (last > digits) {
+      power = std::stoi(std::string(str.substr(after, last - after)));
+      end = last;
+    }
+  }
+  unit.factor = std::pow(unit.factor, power);
+  for (auto &e : unit.dim.exp) e *= power;
+  pos = end;
+  return unit;
+}
+
+// Read a unit expression such as g/cm^3 at pos; pos is only advanced on success
+std::optional<UnitValue> ReadUnits(std::string_view str, std::size_t &pos,
+                                   const std::string &system) {
+  std::size_t end = pos;
+  auto units = ReadUnit(str, end, system);
+  if (!units) return std::nullopt;
+  while (end < str.size() && (str[end] == '*' || str[end] == '/') &&
+         str.compare(end, 2, "**") != 0) {
+    const bool divide = (str[end] == '/');
+    std::size_t next = end + 1;
+    auto unit = ReadUnit(str, next, system);
+    if (!unit) break;
+    units->factor = divide ? units->factor / unit->factor
+                              : units->factor * unit->factor;
+    for (int i = 0; i < 4; i++) {
+      units->dim.exp[i] += divide ? -unit->dim.exp[i] : unit->dim.exp[i];
+    }
+    end = next;
+  }
+  pos = end;
+  return units;
+}
+
+enum class TokenType { NUMBER, STRING, NAME, OP, END };
+struct Token {
+  TokenType type;
+  std::string_view text; // in the source expression; operators point to static text
+  double number = 0.0;
+  std::optional<Dimension> dim; // annotated numbers
+};
+
+// Rewrites annotated literals while splitting the expression into tokens
+std::pmr::vector<Token> Tokenize(std::string_view expr, const std::string &system,
+                                 std::pmr::string &out, bool &annotated,
+                                 std::pmr::memory_resource *resource) {
+  static constexpr std::array<std::string_view, 23> ops = {
+      "**", "//", "<=", ">=", "==", "!=", "&&", "||", "+", "-", "*", "/",
+      "%",  "(",  ")",  "[",  "]",  ",",  "?",  ":",  "<", ">", "!"};
+  std::pmr::vector<Token> tokens(resource);
+  std::size_t i = 0;
+  while (i < expr.size()) {
+    const char c = expr[i];
+    if (c == ' ') {
+      out += c;
+      i++;
+    } else if (c == '"') {
+      auto close = expr.find('"', i + 1);
+      if (close == std::string_view::npos) close = expr.size() - 1;
+      out += expr.substr(i, close - i + 1);
+      tokens.push_back({TokenType::STRING, expr.substr(i, close - i + 1)});
+      i = close + 1;
+    } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+               (c == '.' && i + 1 < expr.size() &&
+                std::isdigit(static_cast<unsigned char>(expr[i + 1])))) {
+      std::size_t end = i;
+      while (end < expr.size() &&
+             (std::isdigit(static_cast<unsigned char>(expr[end])) || expr[end] == '.')) {
+        end++;
+      }
+      if (end < expr.size() && (expr[end] == 'e' || expr[end] == 'E')) {
+        std::size_t exp_end = end + 1;
+        if (exp_end < expr.size() && (expr[exp_end] == '+' || expr[exp_end] == '-')) exp_end++;
+        if (exp_end < expr.size() && std::isdigit(static_cast<unsigned char>(expr[exp_end]))) {
+          while (exp_end < expr.size() &&
+                 std::isdigit(static_cast<unsigned char>(expr[exp_end]))) {
+            exp_end++;
+          }
+          end = exp_end;
+        }
+      }
+      Token token{TokenType::NUMBER, expr.substr(i, end - i)};
+      ParseNumber(token.text.data(), token.text.data() + token.text.size(), token.number);
+      std::size_t unit_pos = end;
+      while (unit_pos < expr.size() && expr[unit_pos] == ' ') unit_pos++;
+      auto units = ReadUnits(expr, unit_pos, system);
+      if (units) {
+        token.number *= units->factor;
+        token.dim = units->dim;
+        // the converted value replaces the literal and its units in the output only
+        char converted[32];
+        const int n = std::snprintf(converted, sizeof(converted), "%.*g",
+                                    std::numeric_limits<double>::max_digits10,
+                                    token.number);
+        out.append(converted, n);
+        end = unit_pos;
+        annotated = true;
+      } else {
+        token.dim = Dimension();
+        out += token.text;
+      }
+      tokens.push_back(token);
+      i = end;
+    } else if (IsIdentStart(c)) {
+      std::size_t end = i;
+      while (end < expr.size() && (IsIdentChar(expr[end]) || expr[end] == '.')) end++;
+      // element references such as a[2] are part of the name
+      if (end < expr.size() && expr[end] == '[') {
+        auto close = expr.find(']', end);
+        if (close != std::string_view::npos) {
+          auto index = expr.substr(end + 1, close - end - 1);
+          if (!index.empty() &&
+              index.find_first_not_of("0123456789") == std::string_view::npos) {
+            end = close + 1;
+          }
+        }
+      }
+      tokens.push_back({TokenType::NAME, expr.substr(i, end - i)});
+      out += expr.substr(i, end - i);
+      i = end;
+    } else {
+      std::string_view op = expr.substr(i, 1);
+      for (const auto candidate : ops) {
+        if (expr.compare(i, candidate.size(), candidate) == 0) {
+          op = candidate;
+          break;
+        }
+      }
+      tokens.push_back({TokenType::OP, op});
+      out += op;
+      i += op.size();
+    }
+  }
+  tokens.push_back({TokenType::END, {}});
+  return tokens;
+}
+
+// A value in the dimension checker: its dimension if known and its value if constant
+struct Quantity {
+  std::optional<Dimension> dim;
+  std::optional<double> value;
+};
+
+// Recursive descent over the tokens computing dimensions only. Unsupported syntax
+// stops the check without an error; the compiler reports real syntax errors.
+class DimensionChecker {
+ public:
+  DimensionChecker(
+      const std::pmr::vector<Token> &tokens, std::string_view expr,
+      const std::string &system,
+      const std::function<std::optional<Dimension>(std::string_view)> &lookup,
+      int line_num)
+      : tokens(tokens), expr(expr), system(system), lookup(lookup), line_num(line_num) {}
+
+  // dims is left empty when the check stops
+  void Check(std::pmr::vector<std::optional<Dimension>> &dims) {
+    const bool list = Peek("[");
+    if (list) pos++;
+    while (!failed) {
+      dims.push_back(Ternary().dim);
+      if (Peek(",")) {
+        pos++;
+        continue;
+      }
+      break;
+    }
+    if (list && Peek("]")) pos++;
+    if (failed || tokens[pos].type != TokenType::END) dims.clear();
+  }
+
+ private:
+  bool Peek(const char *op) const {
+    return tokens[pos].type == TokenType::OP && tokens[pos].text == op;
+  }
+  bool PeekName(const char *name) const {
+    return tokens[pos].type == TokenType::NAME && tokens[pos].text == name;
+  }
+  Quantity Fail() {
+    failed = true;
+    return {};
+  }
+  void Mismatch(const Dimension &a, const Dimension &b, std::string_view op) {
+    std::stringstream msg;
+    msg << "Dimension mismatch in '" << expr << "' at line " << line_num << ": ["
+        << FormatUnits(a, system) << "] " << op << " [" << FormatUnits(b, system) << "]";
+    fatal(msg);
+  }
+  // both sides of +, - and comparisons must agree
+  std::optional<Dimension> Same(const Quantity &a, const Quantity &b,
+                                std::string_view op) {
+    if (a.dim && b.dim) {
+      if (*a.dim != *b.dim) Mismatch(*a.dim, *b.dim, op);
+      return a.dim;
+    }
+    return a.dim ? a.dim : b.dim;
+  }
+  void RequireDimensionless(const Quantity &q, std::string_view what) {
+    if (q.dim && !q.dim->dimensionless()) {
+      std::stringstream msg;
+      msg << "Argument of " << what << " must be dimensionless in '" << expr << "' at line "
+          << line_num << ", got [" << FormatUnits(*q.dim, system) << "]";
+      fatal(msg);
+    }
+  }
+  static Quantity Dimensionless() { return {Dimension(), std::nullopt}; }
+
+  Quantity Ternary() {
+    auto cond = Logical();
+    if (failed || !Peek("?")) return cond;
+    pos++;
+    auto a = Ternary();
+    if (failed || !Peek(":")) return Fail();
+    pos++;
+    auto b = Ternary();
+    return {Same(a, b, ":"), std::nullopt};
+  }
+  Quantity Logical() {
+    auto lhs = Comparison();
+    while (!failed && (Peek("&&") || Peek("||") || PeekName("and") || PeekName("or"))) {
+      pos++;
+      Comparison();
+      lhs = Dimensionless();
+    }
+    return lhs;
+  }
+  Quantity Comparison() {
+    auto lhs = Additive();
+    for (const char *op : {"<", ">", "<=", ">=", "==", "!="}) {
+      if (!failed && Peek(op)) {
+        pos++;
+        auto rhs = Additive();
+        Same(lhs, rhs, op);
+        return Dimensionless();
+      }
+    }
+    return lhs;
+  }
+  Quantity Additive() {
+    auto lhs = Term();
+    while (!failed && (Peek("+") || Peek("-"))) {
+      const auto op = tokens[pos++].text;
+      auto rhs = Term();
+      lhs = {Same(lhs, rhs, op), std::nullopt};
+    }
+    return lhs;
+  }
+  Quantity Term() {
+    auto lhs = Unary();
+    while (!failed && (Peek("*") || Peek("/") || Peek("//") || Peek("%"))) {
+      const auto op = tokens[pos++].text;
+      auto rhs = Unary();
+      if (op == "%") {
+        lhs = {Same(lhs, rhs, op), std::nullopt};
+      } else if (lhs.dim && rhs.dim) {
+        Dimension dim = *lhs.dim;
+        for (int i = 0; i < 4; i++) {
+          dim.exp[i] += (op == "*") ? rhs.dim->exp[i] : -rhs.dim->exp[i];
+        }
+        lhs = {dim, std::nullopt};
+      } else {
+        lhs = {};
+      }
+    }
+    return lhs;
+  }
+  Quantity Unary() {
+    if (Peek("-") || Peek("+")) {
+      const bool negate = Peek("-");
+      pos++;
+      auto q = Unary();
+      if (q.value && negate) q.value = -*q.value;
+      return q;
+    }
+    if (Peek("!") || PeekName("not")) {
+      pos++;
+      Unary();
+      return Dimensionless();
+    }
+    return Power();
+  }
+  Quantity Power() {
+    auto base = Primary();
+    if (failed || !Peek("**")) return base;
+    pos++;
+    auto exponent = Unary();
+    return Pow(base, exponent);
+  }
+  Quantity Pow(const Quantity &base, const Quantity &exponent) {
+    RequireDimensionless(exponent, "an exponent");
+    if (!base.dim) return {};
+    if (base.dim->dimensionless()) return Dimensionless();
+    if (!exponent.value) return {};
+    Dimension dim;
+    for (int i = 0; i < 4; i++) {
+      const double e = base.dim->exp[i] * *exponent.value;
+      if (e != std::round(e)) return {};
+      dim.exp[i] = static_cast<int>(std::round(e));
+    }
+    return {dim, std::nullopt};
+  }
+  std::vector<Quantity> Arguments() {
+    std::vector<Quantity> args;
+    pos++; // (
+    if (Peek(")")) {
+      pos++;
+      return args;
+    }
+    while (!failed) {
+      args.push_back(Ternary());
+      if (Peek(",")) {
+        pos++;
+      } else if (Peek(")")) {
+        pos++;
+        break;
+      } else {
+        Fail();
+      }
+    }
+    return args;
+  }
+  Quantity Call(std::string_view name) {
+    static constexpr std::array<std::string_view, 13> transcendental = {
+        "sin",  "cos",  "tan",  "asin", "acos", "atan", "sinh",
+        "cosh", "tanh", "exp",  "log",  "log10", "log2"};
+    auto args = Arguments();
+    if (failed) return {};
+    if (std::find(transcendental.begin(), transcendental.end(), name) !=
+        transcendental.end()) {
+      for (const auto &arg : args) RequireDimensionless(arg, name);
+      return Dimensionless();
+    }
+    if ((name == "sqrt" || name == "cbrt") && args.size() == 1) {
+      return Pow(args[0], {Dimension(), (name == "sqrt") ? 0.5 : 1.0 / 3.0});
+    }
+    if (name == "pow" && args.size() == 2) return Pow(args[0], args[1]);
+    if ((name == "abs" || name == "floor" || name == "ceil" || name == "round") &&
+        args.size() == 1) {
+      return {args[0].dim, std::nullopt};
+    }
+    if ((name == "min" || name == "max" || name == "atan2") && !args.empty()) {
+      Quantity result = args[0];
+      for (std::size_t i = 1; i < args.size(); i++) {
+        result = {Same(result, args[i], ","), std::nullopt};
+      }
+      if (name == "atan2") return Dimensionless();
+      return result;
+    }
+    return {};
+  }
+  Quantity Primary() {
+    const auto &token = tokens[pos];
+    if (token.type == TokenType::NUMBER) {
+      pos++;
+      return {token.dim, token.dim->dimensionless() ? std::optional<double>(token.number)
+                                                    : std::nullopt};
+    }
+    if (token.type == TokenType::STRING) {
+      pos++;
+      return {};
+    }
+    if (token.type == TokenType::NAME) {
+      pos++;
+      if (Peek("(")) return Call(token.text);
+      if (token.text == "true" || token.text == "false" || token.text == "pi") {
+        return Dimensionless();
+      }
+      return {lookup(token.text), std::nullopt};
+    }
+    if (Peek("(")) {
+      pos++;
+      auto q = Ternary();
+      if (!Peek(")")) return Fail();
+      pos++;
+      return q;
+    }
+    return Fail();
+  }
+
+  const std::pmr::vector<Token> &tokens;
+  std::string_view expr;
+  const std::string &system;
+  const std::function<std::optional<Dimension>(std::string_view)> &lookup;
+  int line_num;
+  std::size_t pos = 0;
+  bool failed = false;
+};
+} // namespace
+
+std::optional<UnitValue> ParseUnits(const std::string &units, const std::string &system) {
+  std::size_t pos = 0;
+  auto value = ReadUnits(units, pos, system);
+  if (!value || pos != units.size()) return std::nullopt;
+  return value;
+}
+
+bool HasUnitAnnotation(std::string_view expr) {
+  for (std::size_t i = 0; i < expr.size(); i++) {
+    if (!std::isdigit(static_cast<unsigned char>(expr[i])) ||
+        (i > 0 && (IsIdentChar(expr[i - 1]) || expr[i - 1] == '.'))) {
+      continue;
+    }
+    std::size_t end = i;
+    while (end < expr.size() &&
+           (std::isdigit(static_cast<unsigned char>(expr[end])) || expr[end] == '.')) {
+      end++;
+    }
+    if (end + 1 < expr.size() && (expr[end] == 'e' || expr[end] == 'E') &&
+        (std::isdigit(static_cast<unsigned char>(expr[end + 1])) || expr[end + 1] == '-' ||
+         expr[end + 1] == '+')) {
+      end += 2;
+      while (end < expr.size() && std::isdigit(static_cast<unsigned char>(expr[end]))) end++;
+    }
+    while (end < expr.size() && expr[end] == ' ') end++;
+    if (ReadUnits(expr, end, "si")) return true;
+    i = end;
+  }
+  return false;
+}
+
+bool IsUnitSystem(const std::string &system) { return system == "si" || system == "cgs"; }
+
+double SystemFactor(const Dimension &dim, const std::string &system) {
+  if (system == "cgs") {
+    return std::pow(1.0e2, dim.exp[L]) * std::pow(1.0e3, dim.exp[M]);
+  }
+  return 1.0;
+}
+
+std::string FormatUnits(const Dimension &dim, const std::string &system) {
+  const std::array<const char *, 4> si = {"m", "kg", "s", "K"};
+  const std::array<const char *, 4> cgs = {"cm", "g", "s", "K"};
+  const auto &names = (system == "cgs") ? cgs : si;
+  std::string out;
+  for (int i : {M, L, T, K}) {
+    if (dim.exp[i] == 0) continue;
+    if (!out.empty()) out += " ";
+    out += names[i];
+    if (dim.exp[i] != 1) out += "^" + std::to_string(dim.exp[i]);
+  }
+  return out.empty() ? "1" : out;
+}
+
+UnitExpression ConvertUnits(
+    std::string_view expr, const std::string &system,
+    const std::function<std::optional<Dimension>(std::string_view)> &lookup, int line_num,
+    std::pmr::memory_resource *resource) {
+  UnitExpression result(resource);
+  auto tokens = Tokenize(expr, system, result.expr, result.annotated, resource);
+  DimensionChecker(tokens, expr, system, lookup, line_num).Check(result.dims);
+  return result;
+}
+
+} // namespace Rummy
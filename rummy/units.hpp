@@ -0,0 +1,78 @@
+//========================================================================================
+// (C) (or copyright) 2025-2026. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001 for Los
+// Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+// for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+// in the program are reserved by Triad National Security, LLC, and the U.S. Department
+// of Energy/National Nuclear Security Administration. The Government is granted for
+// itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+// license in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do so.
+//========================================================================================
+
+
+// This file was created in part with generative AI
+
+#ifndef RUMMY_UNITS_HPP_
+#define RUMMY_UNITS_HPP_
+
+#include <array>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Rummy {
+
+// Exponents of length, mass, time and temperature
+struct Dimension {
+  std::array<int, 4> exp = {0, 0, 0, 0};
+  bool dimensionless() const { return exp == std::array<int, 4>{0, 0, 0, 0}; }
+  bool operator==(const Dimension &other) const { return exp == other.exp; }
+  bool operator!=(const Dimension &other) const { return exp != other.exp; }
+};
+
+// A unit expression such as "g/cm^3": conversion factor and dimension
+struct UnitValue {
+  double factor = 1.0; // into the system it was parsed for
+  Dimension dim;
+};
+
+// Parse a unit expression made of known unit names joined by '*' or '/', each with an
+// optional integer power (^n or **n), with the factor into the given system ("si" or
+// "cgs"). Returns nothing for unknown units.
+std::optional<UnitValue> ParseUnits(const std::string &units,
+                                    const std::string &system = "si");
+// Factor converting a value from SI into the given system ("si" or "cgs")
+double SystemFactor(const Dimension &dim, const std::string &system);
+// Units of a dimension in the given system, e.g. "g cm^-3"
+std::string FormatUnits(const Dimension &dim, const std::string &system);
+bool IsUnitSystem(const std::string &system);
+// Cheap test for a unit annotated literal anywhere in expr
+bool HasUnitAnnotation(std::string_view expr);
+
+// Result of rewriting one card expression. dims holds the dimension of each top level
+// element (one for a scalar, one per element of a list), or nothing when unknown.
+struct UnitExpression {
+  explicit UnitExpression(std::pmr::memory_resource *resource)
+      : expr(resource), dims(resource) {}
+  std::pmr::string expr;
+  bool annotated = false;
+  std::pmr::vector<std::optional<Dimension>> dims;
+};
+
+// Replace unit annotated literals ("1.0 km", "3 MeV") with plain numbers in the target
+// system and check that added, subtracted and compared terms have the same dimension.
+// lookup returns the dimension of a referenced card, if known. Mismatches are fatal.
+// The result and the tokens are allocated from resource.
+UnitExpression ConvertUnits(
+    std::string_view expr, const std::string &system,
+    const std::function<std::optional<Dimension>(std::string_view)> &lookup, int line_num,
+    std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+} // namespace Rummy
+
+#endif // RUMMY_UNITS_HPP_
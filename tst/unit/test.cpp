@@ -18,14 +18,35 @@
 #include <catch2/matchers/catch_matchers_string.hpp>
 
 #include "deck.hpp"
+#include "deck_index.hpp"
+#include "ensemble.hpp"
+#include "evaluator.hpp"
+#include "fd_streambuf.hpp"
+#include "inspector.hpp"
+#include "prepared.hpp"
+#include <array>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <memory_resource>
+#include <new>
 #include <sstream>
+#include <thread>
 #include <unistd.h>
 
 #define FLOAT_REQUIRE(a, b) REQUIRE_THAT(a, Catch::Matchers::WithinAbs(b, 1e-16))
 #define FLOAT_REQUIRE_TOL(a, b, tol) REQUIRE_THAT(a, Catch::Matchers::WithinAbs(b, tol))
 
+// heap allocations made by this thread, counted by the replaced operator new
+thread_local std::size_t num_allocations = 0;
+void *operator new(std::size_t size) {
+  num_allocations++;
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
 TEST_CASE("Deck") {
   GIVEN("A simple deck") {
     Rummy::Deck deck;
@@ -1121,3 +1142,1590 @@ TEST_CASE("Deck - Include Statement") {
     fs::remove_all(tmp);
   }
 }
+
+TEST_CASE("Ensemble - Delta-encoded members") {
+  GIVEN("A base deck and two members that differ in a few cards") {
+    Rummy::Deck base;
+    std::stringstream ss;
+    ss << "<gas>\n"
+       << "rho = 1.0   # density\n"
+       << "name = \"hydrogen\"\n"
+       << "<gas/eos>\n"
+       << "gamma = 1.4\n"
+       << "<mesh>\n"
+       << "nx = 64\n";
+    base.Build(ss);
+
+    Rummy::Ensemble ensemble(base);
+    Rummy::Deck member0 = base;
+    member0.UpdateCard("gas", "rho", 2.0);
+    member0.UpdateCard("gas", "name", std::string("helium"));
+    ensemble.AddMember(member0);
+    ensemble.AddMember({Rummy::Card("gas/eos", "gamma", 5.0 / 3.0, ""),
+                        Rummy::Card("mesh", "refine", true, "")});
+
+    THEN("Only the changed cards are stored") {
+      REQUIRE(ensemble.size() == 2);
+      REQUIRE(ensemble.DeltaSize() == 4);
+      REQUIRE(ensemble[0].NumChanges() == 2);
+      REQUIRE(ensemble[1].NumChanges() == 2);
+    }
+    THEN("Member views overlay the delta on the base deck") {
+      auto m0 = ensemble[0];
+      FLOAT_REQUIRE(m0.GetCardValue<double>("gas", "rho"), 2.0);
+      REQUIRE(m0.GetCardValue<std::string>("gas", "name") == "helium");
+      FLOAT_REQUIRE(m0.GetCardValue<double>("gas/eos", "gamma"), 1.4);
+      REQUIRE(m0.GetCard("gas", "rho").comment == "density");
+      auto m1 = ensemble[1];
+      FLOAT_REQUIRE(m1.GetCardValue<double>("gas", "rho"), 1.0);
+      FLOAT_REQUIRE(m1.GetCardValue<double>("gas/eos", "gamma"), 5.0 / 3.0);
+      REQUIRE(m1.GetCardValue<bool>("mesh", "refine"));
+      REQUIRE(!m0.DoesCardExist("mesh", "refine"));
+    }
+    THEN("A member materializes into a full deck") {
+      auto deck = ensemble[1].Materialize();
+      FLOAT_REQUIRE(deck.GetCardValue<double>("gas/eos", "gamma"), 5.0 / 3.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("mesh", "nx"), 64.0);
+      REQUIRE(deck.GetCardValue<bool>("mesh", "refine"));
+      auto changed = ensemble[0].Materialize();
+      REQUIRE(changed.NumPendingChanges() == 0);
+      changed.UpdateCard("mesh", "nx", 128);
+      std::stringstream delta;
+      changed.WriteDelta(delta);
+      REQUIRE_THAT(delta.str(), Catch::Matchers::ContainsSubstring("nx = 128"));
+      REQUIRE(delta.str().find("helium") == std::string::npos);
+    }
+    WHEN("The ensemble is written to and read back from a single file") {
+      std::stringstream file;
+      ensemble.Write(file);
+      Rummy::Ensemble restored;
+      restored.Read(file);
+      THEN("Every member is reproduced exactly") {
+        REQUIRE(restored.size() == 2);
+        REQUIRE(restored.DeltaSize() == 4);
+        FLOAT_REQUIRE(restored[0].GetCardValue<double>("gas", "rho"), 2.0);
+        REQUIRE(restored[0].GetCardValue<std::string>("gas", "name") == "helium");
+        FLOAT_REQUIRE(restored[1].GetCardValue<double>("gas/eos", "gamma"), 5.0 / 3.0);
+        FLOAT_REQUIRE(restored[1].GetCardValue<double>("mesh", "nx"), 64.0);
+      }
+    }
+  }
+}
+
+TEST_CASE("DeckIndex - Columnar queries over a directory of decks") {
+  GIVEN("A directory with three run decks") {
+    namespace fs = std::filesystem;
+    auto tmp = fs::temp_directory_path() / "rummy_index_test";
+    fs::remove_all(tmp);
+    fs::create_directories(tmp / "run0");
+    fs::create_directories(tmp / "run1");
+    fs::create_directories(tmp / "run2");
+    auto write_deck = [&](const std::string &dir, double gamma, int nx, const char *solver) {
+      std::ofstream f(tmp / dir / "deck.par");
+      f << "<gas/eos>\n"
+        << "gamma = " << gamma << "\n"
+        << "<parthenon/mesh>\n"
+        << "nx1 = " << nx << "\n"
+        << "<hydro>\n"
+        << "solver = \"" << solver << "\"\n";
+    };
+    write_deck("run0", 1.4, 512, "hllc");
+    write_deck("run1", 1.67, 512, "hlle");
+    write_deck("run2", 1.3, 256, "hllc");
+
+    Rummy::DeckIndex index;
+    REQUIRE(index.AddDirectory(tmp.string()) == 3);
+
+    THEN("Every resolved card becomes a column") {
+      REQUIRE(index.NumRows() == 3);
+      REQUIRE(index.HasColumn("gas/eos/gamma"));
+      REQUIRE(index.HasColumn("parthenon/mesh/nx1"));
+      REQUIRE(index.HasColumn("hydro/solver"));
+    }
+    THEN("Numeric and string filters combine") {
+      auto rows = index.Query({"gas/eos/gamma < 1.5", "parthenon/mesh/nx1 == 512"});
+      REQUIRE(rows.size() == 1);
+      REQUIRE_THAT(index.GetPaths()[rows[0]], Catch::Matchers::ContainsSubstring("run0"));
+      rows = index.Query({"hydro/solver == \"hllc\""});
+      REQUIRE(rows.size() == 2);
+      REQUIRE(index.Query({"missing/card > 0"}).empty());
+    }
+    THEN("Projection returns the selected cards") {
+      auto rows = index.Query({"parthenon/mesh/nx1 = 256"});
+      auto table = index.Project(rows, {"hydro/solver", "gas/eos/gamma"});
+      REQUIRE(table.size() == 1);
+      REQUIRE(table[0][0] == "hllc");
+      FLOAT_REQUIRE(std::stod(table[0][1]), 1.3);
+    }
+    WHEN("The index is saved, a new deck appears, and the index is updated") {
+      std::stringstream file;
+      index.Write(file);
+      Rummy::DeckIndex restored;
+      restored.Read(file);
+      fs::create_directories(tmp / "run3");
+      write_deck("run3", 1.1, 512, "hllc");
+      THEN("Only the new deck is indexed") {
+        REQUIRE(restored.AddDirectory(tmp.string()) == 1);
+        REQUIRE(restored.NumRows() == 4);
+        REQUIRE(restored.Query({"gas/eos/gamma < 1.5", "parthenon/mesh/nx1 == 512"})
+                    .size() == 2);
+      }
+    }
+    WHEN("A row without a string card is saved and read back") {
+      Rummy::Deck bare;
+      std::stringstream ss("<gas/eos>\ngamma = 1.2\n");
+      bare.Build(ss);
+      index.AddDeck("bare", bare);
+      std::stringstream file;
+      index.Write(file);
+      Rummy::DeckIndex restored;
+      restored.Read(file);
+      THEN("The checks on the file accept the missing value") {
+        REQUIRE(restored.NumRows() == 4);
+        REQUIRE_FALSE(restored.Get(3, "hydro/solver").has_value());
+        REQUIRE(restored.Query({"hydro/solver == \"hllc\""}).size() == 2);
+        REQUIRE(restored.Query({"gas/eos/gamma < 1.25"}).size() == 1);
+      }
+    }
+    fs::remove_all(tmp);
+  }
+}
+
+TEST_CASE("Deck - Change journal and restart deltas") {
+  GIVEN("A built deck that is changed at run time") {
+    const std::string base_text = "<hydro>\n"
+                                  "cfl = 0.8   # courant number\n"
+                                  "solver = \"hllc\"\n"
+                                  "<mesh>\n"
+                                  "nx = 1, 2, 3\n";
+    Rummy::Deck deck;
+    std::stringstream ss(base_text);
+    deck.Build(ss);
+    REQUIRE(deck.GetJournal().empty());
+
+    deck.SetCycle(10);
+    deck.UpdateCard("hydro", "cfl", 0.4);
+    deck.UpdateCard("hydro", "cfl", 0.3);
+    deck.UpdateVector("mesh", "nx", {4, 2, 3});
+    deck.SetCycle(12);
+    deck.GetOrAddCardValue("hydro", "dt_max", 1.0e-3);
+    deck.RecompileCard("hydro.solver = \"hlle\"");
+    deck.UpdateDeck();
+
+    THEN("Every change is journaled with its cycle") {
+      const auto &journal = deck.GetJournal();
+      REQUIRE(journal.size() == 5);
+      REQUIRE(journal[0].name == "cfl");
+      FLOAT_REQUIRE(journal[0].old_value.as.number, 0.8);
+      FLOAT_REQUIRE(journal[0].new_value.as.number, 0.4);
+      REQUIRE(journal[0].cycle == 10);
+      REQUIRE(journal[2].name == "nx[0]");
+      REQUIRE(journal[3].old_value.type == pips::ValueType::NIL);
+      REQUIRE(journal[4].cycle == 12);
+    }
+    WHEN("A delta is written and replayed on top of the base deck") {
+      std::stringstream delta;
+      deck.WriteDelta(delta);
+      REQUIRE(deck.NumPendingChanges() == 0);
+
+      Rummy::Deck restart;
+      std::stringstream base(base_text);
+      restart.Build(base);
+      restart.ReplayDelta(delta);
+      THEN("The runtime deck is reproduced exactly") {
+        FLOAT_REQUIRE(restart.GetCardValue<double>("hydro", "cfl"), 0.3);
+        REQUIRE(restart.GetCard("hydro", "cfl").comment == "courant number");
+        REQUIRE(restart.GetCardValue<std::string>("hydro", "solver") == "hlle");
+        FLOAT_REQUIRE(restart.GetCardValue<double>("hydro", "dt_max"), 1.0e-3);
+        auto nx = restart.GetVector<double>("mesh", "nx");
+        REQUIRE(nx.size() == 3);
+        FLOAT_REQUIRE(nx[0], 4.0);
+        REQUIRE(restart.GetCycle() == 12);
+      }
+      THEN("The delta only holds the changed cards") {
+        std::string text = delta.str();
+        REQUIRE_THAT(text, Catch::Matchers::ContainsSubstring("cfl = "));
+        REQUIRE_THAT(text, Catch::Matchers::ContainsSubstring("nx[0] = 4"));
+        REQUIRE(text.find("nx[1]") == std::string::npos);
+      }
+      THEN("The next delta starts from the checkpoint") {
+        deck.UpdateCard("hydro", "cfl", 0.2);
+        std::stringstream next;
+        deck.WriteDelta(next);
+        REQUIRE(next.str().find("solver") == std::string::npos);
+        REQUIRE_THAT(next.str(), Catch::Matchers::ContainsSubstring("cfl = "));
+      }
+      THEN("The checkpointed changes are dropped from the journal") {
+        REQUIRE(deck.GetJournal().empty());
+        Rummy::Deck copy(deck);
+        REQUIRE(copy.GetJournal().empty());
+      }
+    }
+    WHEN("A changed card is removed before the delta is written") {
+      deck.RemoveCard("hydro", "cfl");
+      std::stringstream delta;
+      deck.WriteDelta(delta);
+
+      Rummy::Deck restart;
+      std::stringstream base(base_text);
+      restart.Build(base);
+      restart.ReplayDelta(delta);
+      THEN("The removal is replayed") {
+        REQUIRE_THAT(delta.str(), Catch::Matchers::ContainsSubstring("# removed: cfl"));
+        REQUIRE_FALSE(restart.DoesCardExist("hydro", "cfl"));
+        REQUIRE(restart.GetCardValue<std::string>("hydro", "solver") == "hlle");
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Suit inheritance") {
+  GIVEN("Output blocks that inherit from a first block") {
+    std::string text = R"(
+<parthenon/output1>
+file_type = "hdf5"
+dt = 0.1
+variables = ["density", "pressure"]
+<parthenon/output2 : parthenon/output1>
+dt = 2 * dt # twice as often
+<parthenon/output3 : parthenon/output2>
+file_type = "rst"
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Only the overrides are stored in the child") {
+      REQUIRE(deck.GetParentSuit("parthenon/output2") == "parthenon/output1");
+      REQUIRE(deck.GetSuit("parthenon/output2").size() == 1);
+      REQUIRE(deck.GetSuit("parthenon/output3").size() == 1);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output2", "dt"), 0.2);
+    }
+    THEN("Lookups fall through to the parent") {
+      REQUIRE(deck.GetCardValue<std::string>("parthenon/output2", "file_type") == "hdf5");
+      FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output3", "dt"), 0.2);
+      REQUIRE(deck.GetCardValue<std::string>("parthenon/output3", "file_type") == "rst");
+      REQUIRE(deck.IsCardVector("parthenon/output3", "variables"));
+      auto vars = deck.GetVector<std::string>("parthenon/output3", "variables");
+      REQUIRE(vars.size() == 2);
+      REQUIRE(vars[1] == "pressure");
+    }
+    THEN("The full view lists every card") {
+      REQUIRE(deck.FindSuit("parthenon/output2").size() == 4);
+      std::stringstream out;
+      deck.WriteDeck(out);
+      REQUIRE(out.str().find("<parthenon/output3>") != std::string::npos);
+      Rummy::Deck copy;
+      copy.Build(out);
+      REQUIRE(copy.GetCardValue<std::string>("parthenon/output3", "variables[0]") ==
+              "density");
+    }
+    WHEN("An inherited card is updated in the child") {
+      deck.UpdateCard("parthenon/output2", "file_type", std::string("rst"));
+      THEN("The child gets its own copy and the parent is unchanged") {
+        REQUIRE(deck.GetSuit("parthenon/output2").size() == 2);
+        REQUIRE(deck.GetCardValue<std::string>("parthenon/output1", "file_type") == "hdf5");
+        REQUIRE(deck.GetCardValue<std::string>("parthenon/output2", "file_type") == "rst");
+      }
+      THEN("The override survives a restart from the base and a delta") {
+        std::stringstream delta;
+        deck.WriteDelta(delta);
+        Rummy::Deck restarted;
+        std::stringstream base(text);
+        restarted.Build(base);
+        restarted.ReplayDelta(delta);
+        REQUIRE(restarted.GetCardValue<std::string>("parthenon/output2", "file_type") ==
+                "rst");
+        REQUIRE(restarted.GetCardValue<std::string>("parthenon/output1", "file_type") ==
+                "hdf5");
+      }
+      THEN("An ensemble member materializes the override") {
+        Rummy::Deck base_deck;
+        std::stringstream base(text);
+        base_deck.Build(base);
+        Rummy::Ensemble ensemble(base_deck);
+        ensemble.AddMember(deck);
+        auto member = ensemble[0].Materialize();
+        REQUIRE(member.GetCardValue<std::string>("parthenon/output2", "file_type") == "rst");
+        REQUIRE(member.GetCardValue<std::string>("parthenon/output1", "file_type") ==
+                "hdf5");
+      }
+    }
+    WHEN("A parent card is updated") {
+      deck.UpdateCard("parthenon/output1", "file_type", std::string("h5"));
+      deck.UpdateDeck();
+      THEN("Children without an override see the new value") {
+        REQUIRE(deck.GetCardValue<std::string>("parthenon/output2", "file_type") == "h5");
+        REQUIRE(deck.GetCardValue<std::string>("parthenon/output3", "file_type") == "rst");
+        REQUIRE(deck.GetSuit("parthenon/output2").size() == 1);
+      }
+    }
+    WHEN("An inherited card is recompiled") {
+      deck.RecompileCard("parthenon.output3.dt = 0.5");
+      deck.UpdateDeck();
+      THEN("UpdateDeck publishes it as the child's own copy") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output3", "dt"), 0.5);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output2", "dt"), 0.2);
+        REQUIRE(deck.GetSuit("parthenon/output3").size() == 2);
+      }
+    }
+    WHEN("A card inherited through two levels is updated in the first block") {
+      deck.UpdateCard("parthenon/output1", "variables[0]", std::string("velocity"));
+      deck.RecompileCard("parthenon.output3.file_type = parthenon.output3.variables[0]");
+      deck.UpdateDeck();
+      THEN("The grandchild's compiler copy follows") {
+        REQUIRE(deck.GetCardValue<std::string>("parthenon/output3", "file_type") ==
+                "velocity");
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Loops and templates") {
+  GIVEN("A deck that generates suits with a loop and a template") {
+    std::string text = R"(
+nspecies = 3
+template output(n, step):
+<parthenon/output{n}>
+dt = {step} * 0.1 # output {n}
+end
+for i in 0..nspecies:
+<species{i}>
+mass = 2.0 * ({i} + 1)
+for j in 1..3:
+charge{j} = {i} * {j}
+end
+end
+expand output(1, 1)
+expand output(2, 10)
+expand = 4
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Every loop instance becomes a suit") {
+      REQUIRE(deck.DoesSuitExist("species0"));
+      REQUIRE(deck.DoesSuitExist("species2"));
+      REQUIRE(!deck.DoesSuitExist("species3"));
+      FLOAT_REQUIRE(deck.GetCardValue<double>("species2", "mass"), 6.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("species2", "charge2"), 4.0);
+      REQUIRE(!deck.DoesCardExist("species2", "charge3"));
+    }
+    THEN("Templates expand with their arguments") {
+      FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output1", "dt"), 0.1);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output2", "dt"), 1.0);
+      REQUIRE(deck.GetCard("parthenon/output2", "dt").comment == "output 2");
+      FLOAT_REQUIRE(deck.GetCardValue<double>("parthenon/output2", "expand"), 4.0);
+    }
+    THEN("No helper values leak into the deck") {
+      REQUIRE(deck.GetSuit("/").size() == 1);
+    }
+  }
+}
+
+TEST_CASE("Deck - Conditional sections") {
+  GIVEN("A deck with blocks for several physics options") {
+    std::string text = R"(
+<physics>
+conduction = true
+viscosity = false
+nu = 0.0
+<conductivity if physics.conduction>
+kappa = 1.0e-3
+<../model>
+type = "spitzer"
+<viscosity if physics.viscosity>
+nu = 2.0
+<../model>
+type = "constant"
+<hydro>
+if physics.viscosity:
+cfl = 0.3
+else:
+cfl = 0.8
+if physics.nu == 0.0:
+riemann = "hllc"
+end
+end
+gamma = 5/3
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Enabled suits and their children are compiled") {
+      FLOAT_REQUIRE(deck.GetCardValue<double>("conductivity", "kappa"), 1.0e-3);
+      REQUIRE(deck.GetCardValue<std::string>("conductivity/model", "type") == "spitzer");
+    }
+    THEN("Disabled suits and their children are not stored") {
+      REQUIRE(!deck.DoesSuitExist("viscosity"));
+      REQUIRE(!deck.DoesSuitExist("viscosity/model"));
+    }
+    THEN("Only the selected branch of an if block is compiled") {
+      FLOAT_REQUIRE(deck.GetCardValue<double>("hydro", "cfl"), 0.8);
+      REQUIRE(deck.GetCardValue<std::string>("hydro", "riemann") == "hllc");
+      FLOAT_REQUIRE(deck.GetCardValue<double>("hydro", "gamma"), 5.0 / 3.0);
+      REQUIRE(deck.GetSuit("hydro").size() == 3);
+    }
+  }
+  GIVEN("Blocks inside a disabled suit that read the suit's own cards") {
+    std::string text = R"(
+<physics>
+radiation = false
+<radiation if physics.radiation>
+ngroups = 4
+for g in 0..radiation.ngroups:
+<../group{g}>
+energy = {g}
+end
+if radiation.ngroups > 2:
+multigroup = true
+end
+template group(g):
+energy = {g}
+end
+<hydro>
+template group(g):
+energy = 2 * {g}
+end
+expand group(3)
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Their headers are never evaluated and their templates never defined") {
+      REQUIRE(!deck.DoesSuitExist("radiation"));
+      REQUIRE(!deck.DoesSuitExist("radiation/group0"));
+      FLOAT_REQUIRE(deck.GetCardValue<double>("hydro", "energy"), 6.0);
+    }
+  }
+}
+
+TEST_CASE("Card - 64 bit integers") {
+  GIVEN("Cards above the 32 bit range") {
+    std::string text = R"(
+<mesh>
+nzones = 2**40
+seed = 3000000007
+ncycles = -2**33
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Integer values are read and formatted exactly") {
+      REQUIRE(deck.GetCardValue<std::int64_t>("mesh", "nzones") == (std::int64_t(1) << 40));
+      REQUIRE(deck.GetCardValue<std::uint32_t>("mesh", "seed") == 3000000007u);
+      REQUIRE(deck.GetCard("mesh", "seed").GetString() == "3000000007");
+      REQUIRE(deck.GetCard("mesh", "ncycles").GetString() == "-8589934592");
+    }
+    THEN("Written decks keep the exact value") {
+      std::stringstream out;
+      deck.WriteDeck(out);
+      REQUIRE_THAT(out.str(), Catch::Matchers::ContainsSubstring("nzones = 1099511627776"));
+      Rummy::Deck copy;
+      copy.Build(out);
+      REQUIRE(copy.GetCardValue<std::int64_t>("mesh", "ncycles") == -(std::int64_t(1) << 33));
+    }
+  }
+}
+
+TEST_CASE("Deck - Strings longer than STRING_MAX") {
+  GIVEN("Cards with long paths and descriptions") {
+    const std::string dir(3 * STRING_MAX, 'd');
+    std::string text = "<io>\n"
+                       "base = \"/scratch/" + dir + "\"\n"
+                       "restart = base + \"/restart.rhdf\"\n"
+                       "copy = \"/scratch/" + dir + "\"\n"
+                       "short = \"out\"\n"
+                       "files = [\"/scratch/" + dir + "\", \"short\"]\n";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("The full text is kept") {
+      REQUIRE(deck.GetCardValue<std::string>("io", "base") == "/scratch/" + dir);
+      REQUIRE(deck.GetCardValue<std::string>("io", "restart") ==
+              "/scratch/" + dir + "/restart.rhdf");
+      REQUIRE(deck.GetVector<std::string>("io", "files")[0] == "/scratch/" + dir);
+      REQUIRE(deck.GetCardValue<std::string>("io", "short") == "out");
+    }
+    THEN("Equal strings are interned once and views need no copy") {
+      REQUIRE(deck.GetStringArena().size() == 2);
+      auto base = deck.GetCard("io", "base").GetStringView();
+      auto copy = deck.GetCard("io", "copy").GetStringView();
+      REQUIRE(base.data() == copy.data());
+      REQUIRE(deck.GetCardValue<std::string_view>("io", "short") == "out");
+    }
+    THEN("Long strings survive a write and an update") {
+      deck.UpdateCard("io", "short", std::string("/archive/") + dir);
+      std::stringstream out;
+      deck.WriteDeck(out);
+      Rummy::Deck copy;
+      copy.Build(out);
+      REQUIRE(copy.GetCardValue<std::string>("io", "restart") ==
+              "/scratch/" + dir + "/restart.rhdf");
+      REQUIRE(copy.GetCardValue<std::string>("io", "short") == "/archive/" + dir);
+    }
+    THEN("Copies intern into their own arena") {
+      const auto before = deck.GetStringArena().size();
+      Rummy::Deck copy = deck;
+      REQUIRE(&copy.GetStringArena() == &deck.GetStringArena());
+      copy.UpdateCard("io", "short", std::string("/archive/") + dir);
+      REQUIRE(&copy.GetStringArena() != &deck.GetStringArena());
+      REQUIRE(deck.GetStringArena().size() == before);
+      REQUIRE(copy.GetStringArena().size() == before + 1);
+      REQUIRE(copy.GetCardValue<std::string>("io", "base") == "/scratch/" + dir);
+      REQUIRE(deck.GetCardValue<std::string>("io", "short") == "out");
+    }
+    THEN("Copies updated on separate threads do not share writes") {
+      std::vector<Rummy::Deck> copies(4, deck);
+      std::vector<std::thread> threads;
+      for (std::size_t i = 0; i < copies.size(); i++) {
+        threads.emplace_back([&, i]() {
+          copies[i].UpdateCard("io", "short", dir + std::to_string(i));
+        });
+      }
+      for (auto &thread : threads) thread.join();
+      for (std::size_t i = 0; i < copies.size(); i++) {
+        REQUIRE(copies[i].GetCardValue<std::string>("io", "short") ==
+                dir + std::to_string(i));
+      }
+    }
+    THEN("Long strings survive a restart delta") {
+      deck.Checkpoint();
+      deck.UpdateCard("io", "short", std::string("/archive/") + dir);
+      std::stringstream delta;
+      deck.WriteDelta(delta);
+      Rummy::Deck restarted;
+      std::stringstream base(text);
+      restarted.Build(base);
+      restarted.ReplayDelta(delta);
+      REQUIRE(restarted.GetCardValue<std::string>("io", "short") == "/archive/" + dir);
+    }
+    THEN("A recompiled string built from a long string is interned") {
+      deck.RecompileCard("io.short = io.base + \"/x\"");
+      deck.UpdateDeck();
+      REQUIRE(deck.GetCardValue<std::string>("io", "short") == "/scratch/" + dir + "/x");
+      deck.RecompileCard("io.short = \"in\" + \"put\"");
+      deck.UpdateDeck();
+      REQUIRE(deck.GetCardValue<std::string>("io", "short") == "input");
+      std::stringstream out;
+      deck.WriteDeck(out);
+      REQUIRE(out.str().find('\x1f') == std::string::npos);
+    }
+  }
+}
+
+TEST_CASE("Deck - Unit annotated literals") {
+  GIVEN("A deck in cgs units") {
+    std::string text = R"(
+<units>
+system = "cgs"
+<problem>
+radius = 1.5 km
+rho = 2.0 g/cm^3
+energy = 3 MeV
+t_end = 2 yr
+mass = rho * radius**3
+sizes = [1 m, 10 cm]
+gamma = 5/3
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    THEN("Literals are folded into plain numbers in the target system") {
+      FLOAT_REQUIRE(deck.GetCardValue<double>("problem", "radius"), 1.5e5);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("problem", "rho"), 2.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("problem", "energy"), 3 * 1.602176634e-6);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("problem", "t_end"), 6.31152e7);
+      FLOAT_REQUIRE(deck.GetVector<double>("problem", "sizes")[0], 100.0);
+    }
+    THEN("Dimensions are tracked through expressions") {
+      REQUIRE(deck.GetCardUnits("problem", "radius") == "cm");
+      REQUIRE(deck.GetCardUnits("problem", "rho") == "g cm^-3");
+      REQUIRE(deck.GetCardUnits("problem", "energy") == "g cm^2 s^-2");
+      REQUIRE(deck.GetCardUnits("problem", "mass") == "g");
+      REQUIRE(deck.GetCardUnits("problem", "sizes[1]") == "cm");
+      REQUIRE(deck.GetCardUnits("problem", "gamma") == "1");
+    }
+  }
+  GIVEN("A deck without units") {
+    std::string text = "<mesh>\nnx = 64\nx1max = 1.0e3\n";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+    THEN("Nothing is tracked") { REQUIRE(deck.GetCardUnits("mesh", "nx").empty()); }
+  }
+}
+
+TEST_CASE("Deck - Jacobian of derived cards") {
+  GIVEN("Derived cards that depend on a few inputs") {
+    std::string text = R"(
+scale = 2.0
+<gas/eos>
+cv = 1.5
+<gas>
+rho = 3.0
+hcond = 0.5
+kappa = hcond / (rho * gas.eos.cv)
+energy = rho * gas.eos.cv * scale**2
+floor = max(kappa, 1.0e-10) + sqrt(rho)
+name = "air"
+)";
+    Rummy::Deck deck;
+    std::stringstream ss(text);
+    deck.Build(ss);
+
+    WHEN("The Jacobian is taken with respect to rho and cv") {
+      auto jac = deck.Jacobian({"gas/rho", "gas/eos/cv"});
+      THEN("Derivatives match the analytic ones") {
+        const double kappa = 0.5 / (3.0 * 1.5);
+        FLOAT_REQUIRE(jac["gas/kappa"]["gas/rho"], -kappa / 3.0);
+        FLOAT_REQUIRE(jac["gas/kappa"]["gas/eos/cv"], -kappa / 1.5);
+        FLOAT_REQUIRE(jac["gas/energy"]["gas/rho"], 1.5 * 4.0);
+        FLOAT_REQUIRE(jac["gas/floor"]["gas/rho"], -kappa / 3.0 + 0.5 / std::sqrt(3.0));
+      }
+      THEN("Only nonzero entries are stored") {
+        REQUIRE(jac.count("gas/hcond") == 0);
+        REQUIRE(jac.count("scale") == 0);
+        REQUIRE(jac["gas/energy"].size() == 2);
+      }
+    }
+    WHEN("A global is an input") {
+      auto jac = deck.Jacobian({"scale"});
+      THEN("Cards in suits see it") {
+        FLOAT_REQUIRE(jac["gas/energy"]["scale"], 3.0 * 1.5 * 2.0 * 2.0);
+        REQUIRE(jac.size() == 1);
+      }
+    }
+  }
+  GIVEN("A card that cannot be replayed and a card that reads it") {
+    std::stringstream ss("<gas>\nrho = 3.0\nsigned = sign(rho) * rho\n"
+                         "twice = 2 * signed\nenergy = 2 * rho\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    WHEN("The Jacobian lists the cards it cannot differentiate") {
+      std::vector<std::string> unknown;
+      auto jac = deck.Jacobian({"gas/rho"}, unknown);
+      THEN("They are reported instead of a zero derivative") {
+        REQUIRE(unknown == std::vector<std::string>{"gas/signed", "gas/twice"});
+        REQUIRE(jac.count("gas/signed") == 0);
+        REQUIRE(jac.count("gas/twice") == 0);
+        FLOAT_REQUIRE(jac["gas/energy"]["gas/rho"], 2.0);
+      }
+    }
+  }
+  GIVEN("Vector operations, slices and booleans over an input") {
+    std::stringstream ss("<gas>\nrho = 3.0\non = true\nu = rho, 2 * rho\n"
+                         "w = u[::1]\nv = 0.0, 0.0, 0.0\nv[1:3] = u[0:2]\n"
+                         "total = w[1] + v[2]\ny = on ? rho : 0.0\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    WHEN("The Jacobian is taken") {
+      std::vector<std::string> unknown;
+      auto jac = deck.Jacobian({"gas/rho"}, unknown);
+      THEN("Elements filled by slices carry derivatives to the cards that read them") {
+        REQUIRE(unknown.empty());
+        FLOAT_REQUIRE(jac["gas/w[1]"]["gas/rho"], 2.0);
+        FLOAT_REQUIRE(jac["gas/v[2]"]["gas/rho"], 2.0);
+        FLOAT_REQUIRE(jac["gas/total"]["gas/rho"], 4.0);
+        FLOAT_REQUIRE(jac["gas/y"]["gas/rho"], 1.0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Large literal vectors") {
+  GIVEN("A deck with a long literal table and a mixed vector") {
+    std::stringstream text;
+    text << "<table>\ntbl = ";
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+      text << (i ? ", " : "") << 0.25 * i - 100.0;
+    }
+    text << "\nscale = 2\n";
+    text << "mixed = [1.5e3, -2, +3, scale * 4, \"a, b\", true, .5, inf_val]\n";
+    text << "inf_val = 1\n";
+    Rummy::Deck deck;
+    std::stringstream ss("inf_val = 7\n" + text.str());
+    deck.Build(ss);
+
+    THEN("Every literal is stored") {
+      REQUIRE(deck.GetSuit("table").count("tbl[0]") == 1);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "tbl[0]"), -100.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "tbl[4999]"), 0.25 * 4999 - 100.0);
+      REQUIRE(deck.GetSuit("table").count("tbl[5000]") == 0);
+    }
+    THEN("Non literal elements are still evaluated") {
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[0]"), 1500.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[1]"), -2.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[2]"), 3.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[3]"), 8.0);
+      REQUIRE(deck.GetCardValue<std::string>("table", "mixed[4]") == "a, b");
+      REQUIRE(deck.GetCardValue<bool>("table", "mixed[5]"));
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[6]"), 0.5);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("table", "mixed[7]"), 7.0);
+    }
+  }
+}
+
+TEST_CASE("Deck - Strided and negative slices") {
+  GIVEN("A deck that slices a vector with steps and negative bounds") {
+    std::stringstream ss;
+    ss << "<levels>\n"
+       << "a = [0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10]\n"
+       << "evens = a[::2]\n"
+       << "tail = a[-3:]\n"
+       << "down = a[10:0:-1]\n"
+       << "back[:] = 2 * a[::-3]\n"
+       << "x = 1\n"
+       << "pick = [x > 0 ? 1 : 2, 3]\n";
+    Rummy::Deck deck;
+    deck.Build(ss);
+
+    THEN("Deck expressions follow Python slice semantics") {
+      REQUIRE(deck.GetVector<int>("levels", "evens") == std::vector<int>{0, 2, 4, 6, 8, 10});
+      REQUIRE(deck.GetVector<int>("levels", "tail") == std::vector<int>{8, 9, 10});
+      REQUIRE(deck.GetVector<int>("levels", "down") ==
+              std::vector<int>{10, 9, 8, 7, 6, 5, 4, 3, 2, 1});
+      REQUIRE(deck.GetVector<int>("levels", "back") == std::vector<int>{20, 14, 8, 2});
+      REQUIRE(deck.GetVector<int>("levels", "pick") == std::vector<int>{1, 3});
+    }
+    WHEN("A host code takes views of the vector") {
+      auto strided = deck.GetVectorView("levels", "a", "1::3");
+      auto reversed = deck.GetVectorView("levels", "a", "[::-1]");
+      auto empty = deck.GetVectorView("levels", "a", "5:2");
+      THEN("The views select the right elements") {
+        REQUIRE(strided.size() == 4);
+        REQUIRE(strided.Index(3) == 10);
+        REQUIRE(strided.Get<int>(2) == 7);
+        REQUIRE(reversed.size() == 11);
+        REQUIRE(reversed.Get<int>(0) == 10);
+        REQUIRE(reversed[10].name == "a[0]");
+        REQUIRE(empty.empty());
+      }
+      THEN("Updates are seen through a view") {
+        deck.UpdateCard("levels", "a[4]", 40.0);
+        REQUIRE(strided.Get<double>(1) == 40.0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Build helpers - Temporaries stay in the statement arena") {
+  GIVEN("An arena on a fixed buffer that cannot fall back to the heap") {
+    std::array<std::byte, 4096> buffer;
+    std::pmr::monotonic_buffer_resource scratch(buffer.data(), buffer.size(),
+                                                std::pmr::null_memory_resource());
+    // any allocation past the buffer throws std::bad_alloc
+    WHEN("A sliced statement is stripped and expanded") {
+      std::pmr::string value("  2.0 * a[::2] + b[1:4] * \"x y\"  ", &scratch);
+      Rummy::RemoveWhitespacePreserveQuotes(value, 1);
+      auto length = [](std::string_view) { return 6L; };
+      auto expanded = Rummy::SplitString(value, 1, -1, length, &scratch);
+      THEN("Every temporary came from the arena") {
+        REQUIRE(value == "2.0*a[::2]+b[1:4]*\"x y\"");
+        REQUIRE(expanded.size() == 3);
+        REQUIRE(expanded[2] == "2.0*a[4]+b[3]*\"x y\"");
+        REQUIRE(expanded.get_allocator().resource() == &scratch);
+      }
+    }
+    WHEN("A literal list is scanned and a statement is assembled") {
+      auto elements = Rummy::ScanList("1.5,-2,\"s\",c*2", 1, &scratch);
+      auto expr = Rummy::Concat(&scratch, {"var ", "tbl[3]", " = ", elements[3].text});
+      THEN("Every temporary came from the arena") {
+        REQUIRE(elements.size() == 4);
+        REQUIRE(elements[1].number == -2.0);
+        REQUIRE(expr == "var tbl[3] = c*2");
+      }
+    }
+  }
+  GIVEN("Two decks that differ only in where the spaces of each statement are") {
+    // the lines have the same length, so scanning them costs the same; only
+    // temporaries cut from the statement itself could tell them apart
+    const std::string pad(20, ' ');
+    std::string indented = "<" + pad + "gas>\n";
+    std::string spread = "<gas" + pad + ">\n";
+    for (const std::string name : {"x1", "x2", "x3"}) {
+      indented += pad + pad + name + " = 1.0\n" + pad + pad + "s" + name +
+                  " = \"abc\"\n" + pad + pad + "v" + name + " = [1.0, " + name + "]\n" +
+                  pad + pad + "d" + name + " = 2*" + name + "\n";
+      spread += name + pad + " =" + pad + " 1.0\n" + "s" + name + pad + " =" + pad +
+                " \"abc\"\n" + "v" + name + pad + " =" + pad + " [1.0, " + name + "]\n" +
+                "d" + name + pad + " =" + pad + " 2*" + name + "\n";
+    }
+    auto count = [](const std::string &text) {
+      std::stringstream ss(text);
+      Rummy::Deck deck;
+      const auto before = num_allocations;
+      deck.Build(ss);
+      return num_allocations - before;
+    };
+    WHEN("Both are built") {
+      const auto compact = count(indented);
+      const auto padded = count(spread);
+      THEN("They make the same number of heap allocations") {
+        REQUIRE(compact > 0);
+        REQUIRE(padded == compact);
+      }
+    }
+  }
+  GIVEN("Decks of short and of long literal lines") {
+    // a card costs the same however long its line is: the statement, its
+    // comment and the number text are only ever viewed, never copied
+    const std::string digits(40, '0');
+    const std::string remark(60, 'c');
+    auto deck_text = [&](int n, bool long_lines) {
+      std::string text = "<gas>\n";
+      for (int i = 0; i < n; i++) {
+        const std::string name = "x" + std::to_string(i);
+        text += long_lines ? name + " = 1." + digits + "  # " + remark + "\n"
+                           : name + " = 1.0\n";
+      }
+      return text;
+    };
+    auto count = [](const std::string &text) {
+      std::stringstream ss(text);
+      Rummy::Deck deck;
+      deck.SetMetadata(Rummy::CardMetadata::NONE);
+      const auto before = num_allocations;
+      deck.Build(ss);
+      return num_allocations - before;
+    };
+    auto per_card = [&](bool long_lines) {
+      const int n = 64;
+      return (count(deck_text(2 * n, long_lines)) - count(deck_text(n, long_lines))) / n;
+    };
+    WHEN("Each is built at two sizes") {
+      const auto short_cost = per_card(false);
+      const auto long_cost = per_card(true);
+      THEN("Each extra card makes the same small number of heap allocations") {
+        REQUIRE(short_cost > 0);
+        // only the card's own table entries and records remain per card
+        REQUIRE(short_cost <= 8);
+        REQUIRE(long_cost == short_cost);
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Lean metadata modes") {
+  GIVEN("A commented deck built with each metadata mode") {
+    const std::string text = "zeta = 1.0  # first card\n"
+                             "<gas>\n"
+                             "rho = 2.0 * zeta  # density\n"
+                             "alpha = 3  # second card\n";
+    auto build = [&](Rummy::CardMetadata mode) {
+      Rummy::Deck deck;
+      deck.SetMetadata(mode);
+      std::stringstream ss(text);
+      deck.Build(ss);
+      return deck;
+    };
+    auto full = build(Rummy::CardMetadata::FULL);
+    auto cold = build(Rummy::CardMetadata::COLD);
+    auto none = build(Rummy::CardMetadata::NONE);
+
+    THEN("Values are the same in every mode") {
+      FLOAT_REQUIRE(cold.GetCardValue<double>("gas", "rho"), 2.0);
+      FLOAT_REQUIRE(none.GetCardValue<double>("gas", "rho"), 2.0);
+    }
+    THEN("Lean cards carry no comment or location") {
+      REQUIRE(full.GetCard("gas", "rho").GetComment() == "density");
+      REQUIRE(cold.GetCard("gas", "rho").GetComment().empty());
+      REQUIRE(cold.GetCard("gas", "rho").loc == -1);
+      REQUIRE(none.GetCard("gas", "rho").GetComment().empty());
+    }
+    THEN("The cold side table still answers diagnostics") {
+      auto meta = cold.GetCardMeta("gas", "rho");
+      REQUIRE(meta.comment == "density");
+      REQUIRE(meta.loc == full.GetCard("gas", "rho").loc);
+      REQUIRE(none.GetCardMeta("gas", "rho").comment.empty());
+      REQUIRE(cold.FindSuitInOrder("gas")[0].name == "rho");
+    }
+    THEN("WriteDeck output of a cold deck matches the full deck") {
+      std::stringstream full_out, cold_out, none_out;
+      full.WriteDeck(full_out);
+      cold.WriteDeck(cold_out);
+      none.WriteDeck(none_out);
+      REQUIRE(cold_out.str() == full_out.str());
+      REQUIRE(none_out.str().find('#') == std::string::npos);
+    }
+    THEN("Copies share the side table and runtime comments win") {
+      Rummy::Deck copy = cold;
+      copy.UpdateCard("gas", "alpha", 4.0, "updated");
+      REQUIRE(copy.GetCardMeta("gas", "alpha").comment == "updated");
+      REQUIRE(copy.GetCardMeta("gas", "rho").comment == "density");
+    }
+  }
+}
+
+TEST_CASE("Deck - Change subscriptions") {
+  GIVEN("A deck with subscribers on a card, a suit and a glob") {
+    std::stringstream ss("dt = 0.1\n<gas>\nrho = 1.0\nx = [1, 2, 3]\n<gas/eos>\ncv = 2.0\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    std::vector<std::vector<std::string>> card_calls, suit_calls, glob_calls;
+    auto record = [](std::vector<std::vector<std::string>> &calls) {
+      return [&calls](const std::vector<Rummy::JournalEntry> &changes) {
+        std::vector<std::string> paths;
+        for (const auto &c : changes) {
+          paths.push_back(c.suit + "/" + c.name);
+        }
+        calls.push_back(paths);
+      };
+    };
+    deck.Subscribe("gas/x", record(card_calls));
+    const auto suit_id = deck.Subscribe("gas/", record(suit_calls));
+    deck.Subscribe("*cv", record(glob_calls));
+
+    WHEN("A vector is updated") {
+      deck.UpdateVector<double>("gas", "x", {4, 5, 6});
+      THEN("Subscribers are called once with every element") {
+        REQUIRE(card_calls.size() == 1);
+        REQUIRE(card_calls[0].size() == 3);
+        REQUIRE(suit_calls.size() == 1);
+        REQUIRE(glob_calls.empty());
+      }
+    }
+    WHEN("Several writes happen in one batch") {
+      deck.BeginBatch();
+      deck.UpdateCard("gas", "rho", 2.0);
+      deck.UpdateCard("gas", "rho", 3.0);
+      deck.UpdateCard("gas/eos", "cv", 5.0);
+      deck.UpdateCard("/", "dt", 0.2);
+      deck.UpdateCard("/", "dt", 0.1);
+      REQUIRE(suit_calls.empty());
+      deck.EndBatch();
+      THEN("Changes are coalesced per card and delivered once") {
+        REQUIRE(suit_calls.size() == 1);
+        REQUIRE(suit_calls[0] == std::vector<std::string>{"gas/rho", "gas/eos/cv"});
+        REQUIRE(glob_calls.size() == 1);
+        REQUIRE(card_calls.empty());
+      }
+    }
+    WHEN("A recompiled card is pushed with UpdateDeck") {
+      deck.RecompileCard("gas.rho = 7.0");
+      deck.UpdateDeck();
+      deck.Unsubscribe(suit_id);
+      deck.UpdateCard("gas", "rho", 8.0);
+      THEN("Only subscribed changes are delivered") {
+        REQUIRE(suit_calls.size() == 1);
+        REQUIRE(suit_calls[0] == std::vector<std::string>{"gas/rho"});
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Transactions") {
+  GIVEN("A deck with cards derived from others") {
+    std::stringstream ss("<gas/eos>\n"
+                         "gamma = 1.4\n"
+                         "cv = 1.0 / (gamma - 1.0)\n"
+                         "<gas>\n"
+                         "rho = 1.0\n"
+                         "e = rho * gas.eos.cv * 2.0\n"
+                         "other = 5.0\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    int calls = 0;
+    std::size_t changes = 0;
+    deck.Subscribe("gas/", [&](const std::vector<Rummy::JournalEntry> &c) {
+      calls++;
+      changes += c.size();
+    });
+
+    WHEN("Related cards are set together") {
+      auto tx = deck.Begin();
+      tx.Set("gas/eos", "gamma", 1.5).Set("gas", "rho", 2.0);
+      REQUIRE(tx.Commit());
+      THEN("Dependents are re-evaluated once and published together") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas/eos", "cv"), 2.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 8.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "other"), 5.0);
+        REQUIRE(calls == 1);
+        REQUIRE(changes == 4);
+      }
+    }
+    WHEN("A derived card is redefined as a literal") {
+      std::stringstream more("<gas>\ne = 7.0\nmix = [gas.rho, 3.0, \"air\"]\n");
+      deck.Build(more);
+      auto tx = deck.Begin();
+      tx.Set("gas", "rho", 2.0);
+      REQUIRE(tx.Commit());
+      THEN("Only the elements that are expressions follow their inputs") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 7.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "mix[0]"), 2.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "mix[1]"), 3.0);
+        REQUIRE(deck.GetCardValue<std::string>("gas", "mix[2]") == "air");
+      }
+    }
+    WHEN("A card is recompiled") {
+      auto tx = deck.Begin();
+      tx.Recompile("gas.eos.cv = 3.0 * gamma");
+      REQUIRE(tx.Commit());
+      THEN("The new expression is used now and by later transactions") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas/eos", "cv"), 3.0 * 1.4);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 1.0 * (3.0 * 1.4) * 2.0);
+        auto tx2 = deck.Begin();
+        tx2.Set("gas/eos", "gamma", 2.0);
+        REQUIRE(tx2.Commit());
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 12.0);
+      }
+    }
+    WHEN("A change would make a dependent non-finite") {
+      auto tx = deck.Begin();
+      tx.Set("gas", "rho", 3.0).Set("gas/eos", "gamma", 1.0);
+      THEN("Nothing is applied") {
+        REQUIRE_FALSE(tx.Commit());
+        REQUIRE_THAT(tx.Error(), Catch::Matchers::ContainsSubstring("gas/eos/cv"));
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "rho"), 1.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas/eos", "gamma"), 1.4);
+        REQUIRE(calls == 0);
+        REQUIRE(deck.NumPendingChanges() == 0);
+      }
+    }
+    WHEN("A transaction writes a missing card or is rolled back") {
+      auto tx = deck.Begin();
+      tx.Set("gas", "missing", 1.0);
+      REQUIRE_FALSE(tx.Commit());
+      auto tx2 = deck.Begin();
+      tx2.Set("gas", "rho", 9.0);
+      tx2.Rollback();
+      REQUIRE(tx2.Commit());
+      THEN("The deck is unchanged") {
+        REQUIRE_THAT(tx.Error(), Catch::Matchers::ContainsSubstring("gas/missing"));
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "rho"), 1.0);
+      }
+    }
+  }
+  GIVEN("A deck that has committed a transaction and is then assigned another") {
+    Rummy::Deck a;
+    std::stringstream sa("x = 1.0\ny = 2*x\n");
+    a.Build(sa);
+    auto tx = a.Begin();
+    tx.Set("/", "x", 2.0);
+    REQUIRE(tx.Commit());
+    Rummy::Deck b;
+    std::stringstream sb("x = 1.0\nz = 3*x\ny = 5.0\n");
+    b.Build(sb);
+    a = b;
+    WHEN("A transaction runs on the assigned deck") {
+      auto tx2 = a.Begin();
+      tx2.Set("/", "x", 10.0);
+      REQUIRE(tx2.Commit());
+      THEN("The dependencies of the new deck are used") {
+        FLOAT_REQUIRE(a.GetCardValue<double>("/", "z"), 30.0);
+        FLOAT_REQUIRE(a.GetCardValue<double>("/", "y"), 5.0);
+      }
+    }
+  }
+  GIVEN("A deck with boolean and string cards derived from others") {
+    std::stringstream ss("gamma = 1.4\n"
+                         "flag = true\n"
+                         "x = flag ? 1 : 2\n"
+                         "use_visc = gamma > 1.5\n"
+                         "visc = use_visc ? 0.1 : 0.0\n"
+                         "tag = \"a\"\n"
+                         "label = tag + \"b\"\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    WHEN("Their inputs change in a transaction") {
+      auto tx = deck.Begin();
+      tx.Set("/", "flag", false).Set("/", "gamma", 1.6);
+      REQUIRE(tx.Commit());
+      THEN("Booleans read as 1 and 0 and boolean dependents are re-evaluated") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("/", "x"), 2.0);
+        REQUIRE(deck.GetCard("/", "use_visc").isBool());
+        REQUIRE(deck.GetCardValue<bool>("/", "use_visc"));
+        FLOAT_REQUIRE(deck.GetCardValue<double>("/", "visc"), 0.1);
+      }
+    }
+    WHEN("The input of a string card changes") {
+      auto tx = deck.Begin();
+      tx.Set("/", "tag", std::string("c"));
+      THEN("The transaction fails instead of leaving the string stale") {
+        REQUIRE_FALSE(tx.Commit());
+        REQUIRE_THAT(tx.Error(), Catch::Matchers::ContainsSubstring("label"));
+        REQUIRE(deck.GetCardValue<std::string>("/", "tag") == "a");
+      }
+    }
+    WHEN("A derived card is removed and one of its inputs changes") {
+      deck.RemoveCard("/", "x");
+      deck.RemoveCard("/", "label");
+      auto tx = deck.Begin();
+      tx.Set("/", "flag", false).Set("/", "tag", std::string("c"));
+      REQUIRE(tx.Commit());
+      THEN("The removed cards are no longer evaluated") {
+        REQUIRE_FALSE(deck.DoesCardExist("/", "x"));
+        REQUIRE(deck.GetCardValue<std::string>("/", "tag") == "c");
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Host variable bindings") {
+  GIVEN("A deck with cards bound to host variables") {
+    std::stringstream ss("<gas>\nrho = 1.5\nnzones = 64\nname = \"air\"\ne = 2 * rho\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    double rho = 0.0, e = 0.0;
+    int nzones = 0;
+    std::string name;
+    deck.BindTo("gas", "rho", &rho);
+    deck.BindTo("gas", "nzones", &nzones);
+    deck.BindTo("gas", "name", &name);
+    deck.BindTo("gas", "e", &e);
+
+    THEN("Host variables are filled at bind time") {
+      REQUIRE(rho == 1.5);
+      REQUIRE(nzones == 64);
+      REQUIRE(name == "air");
+    }
+    WHEN("Cards change through the runtime APIs") {
+      deck.UpdateCard("gas", "nzones", 128);
+      deck.UpdateCard("gas", "name", std::string("helium"));
+      auto tx = deck.Begin();
+      tx.Set("gas", "rho", 3.0);
+      REQUIRE(tx.Commit());
+      THEN("Host variables follow") {
+        REQUIRE(nzones == 128);
+        REQUIRE(name == "helium");
+        REQUIRE(rho == 3.0);
+        REQUIRE(e == 6.0);
+      }
+    }
+    WHEN("A bound card is recompiled") {
+      deck.RecompileCard("gas.rho = 4.0");
+      THEN("The host variable is written without UpdateDeck") {
+        REQUIRE(rho == 4.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "rho"), 4.0);
+      }
+    }
+    WHEN("A variable is unbound") {
+      deck.Unbind(&rho);
+      deck.UpdateCard("gas", "rho", 5.0);
+      THEN("It is no longer written") { REQUIRE(rho == 1.5); }
+    }
+  }
+}
+
+TEST_CASE("Deck - Concurrent evaluation") {
+  GIVEN("A deck and a pool of evaluators over its snapshot") {
+    std::stringstream ss("scale = 2.0\n<gas>\ngamma = 1.4\ncv = 3.0\non = true\n"
+                         "<gas/eos>\ngamma = 5.0/3.0\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    Rummy::EvaluatorPool pool(deck);
+
+    WHEN("Several threads evaluate expressions at once") {
+      constexpr int nthreads = 4;
+      std::array<double, nthreads> cv_terms{}, gamma_terms{};
+      std::vector<std::thread> workers;
+      for (int t = 0; t < nthreads; t++) {
+        workers.emplace_back([&pool, &cv_terms, &gamma_terms, t]() {
+          auto evaluator = pool.Acquire();
+          for (int i = 0; i < 1000; i++) {
+            cv_terms[t] = evaluator->Evaluate("cv * (gamma - 1.0) * scale", "gas");
+            gamma_terms[t] = evaluator->Evaluate("gas.on ? gamma : 0.0", "gas/eos");
+          }
+        });
+      }
+      for (auto &worker : workers) worker.join();
+      THEN("Every thread sees the same values and the evaluators are returned") {
+        for (int t = 0; t < nthreads; t++) {
+          FLOAT_REQUIRE(cv_terms[t], 3.0 * (1.4 - 1.0) * 2.0);
+          FLOAT_REQUIRE(gamma_terms[t], 5.0 / 3.0);
+        }
+        // evaluators are reused, so a fast thread may have handed its own on
+        REQUIRE(pool.NumIdle() >= 1);
+        REQUIRE(pool.NumIdle() <= nthreads);
+      }
+    }
+    WHEN("The deck changes after the snapshot") {
+      deck.UpdateCard("gas", "cv", 4.0);
+      auto before = pool.Acquire();
+      pool.Refresh(deck);
+      auto after = pool.Acquire();
+      THEN("Only evaluators acquired after a refresh see the change") {
+        FLOAT_REQUIRE(before->Evaluate("cv", "gas"), 3.0);
+        FLOAT_REQUIRE(after->Evaluate("cv", "gas"), 4.0);
+        FLOAT_REQUIRE(deck.Snapshot()->Find("gas.cv").value(), 4.0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Parallel scanning") {
+  GIVEN("A deck with comments, quotes and continuations on many lines") {
+    std::stringstream src;
+    src << "# generated deck\nscale = 2.0 # global\n";
+    for (int i = 0; i < 40; i++) {
+      src << "<suit" << i << ">\n";
+      src << "a = " << i << " * scale # card " << i << "\n";
+      src << "\n  # a comment line between cards\n";
+      src << "b = a + &  # first part\n\n    1.0 & # second part\n  + 2.0\n";
+      src << "s = \"x # not a comment\"\t\r\n";
+      src << "c = b\n";
+    }
+    const std::string text = src.str();
+
+    std::stringstream seq_ss(text), par_ss(text), narrow_ss(text);
+    Rummy::Deck sequential, parallel, narrow;
+    sequential.SetScanChunkSize(0);
+    parallel.SetScanChunkSize(64, 8);
+    // windows of 8 bytes, shorter than most lines
+    narrow.SetScanChunkSize(4, 2);
+    sequential.Build(seq_ss);
+    parallel.Build(par_ss);
+    narrow.Build(narrow_ss);
+
+    THEN("The result matches the sequential scan, including lines and comments") {
+      std::stringstream seq_out, par_out, narrow_out;
+      sequential.WriteDeck(seq_out);
+      parallel.WriteDeck(par_out);
+      narrow.WriteDeck(narrow_out);
+      REQUIRE(seq_out.str() == par_out.str());
+      REQUIRE(seq_out.str() == narrow_out.str());
+      REQUIRE(narrow.GetCardMeta("suit3", "c").loc == 2 + 3 * 10 + 10);
+      for (int i = 0; i < 40; i++) {
+        const auto suit = "suit" + std::to_string(i);
+        for (const auto *name : {"a", "b", "s", "c"}) {
+          const auto seq_meta = sequential.GetCardMeta(suit, name);
+          const auto par_meta = parallel.GetCardMeta(suit, name);
+          REQUIRE(seq_meta.loc == par_meta.loc);
+          REQUIRE(seq_meta.comment == par_meta.comment);
+        }
+        FLOAT_REQUIRE(parallel.GetCardValue<double>(suit, "b"), i * 2.0 + 3.0);
+        REQUIRE(parallel.GetCardValue<std::string>(suit, "s") == "x # not a comment");
+      }
+      REQUIRE(parallel.GetCardMeta("suit3", "b").comment == "first part second part");
+      REQUIRE(parallel.GetCardMeta("suit3", "c").loc == 2 + 3 * 10 + 10);
+    }
+  }
+}
+
+TEST_CASE("Deck - Streaming builds") {
+  GIVEN("A deck written into a pipe by a generator") {
+    namespace fs = std::filesystem;
+    auto tmp = fs::temp_directory_path() / "rummy_stream_test";
+    fs::create_directories(tmp);
+    {
+      std::ofstream f(tmp / "eos.in");
+      f << "<gas/eos>\ngamma = 1.4 # ratio\n";
+    }
+    std::stringstream src;
+    src << "<gas>\nrho = 1.0 & # density\n  + 0.5\n";
+    src << "label = \"" << std::string(300, 'x') << "\"\n";
+    src << "e = rho / 0.4\n";
+    src << "include \"" << (tmp / "eos.in").string() << "\"\n";
+    const std::string text = src.str();
+
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::thread generator([&text, fd = fds[1]]() {
+      // small writes, as a generator would produce them
+      for (std::size_t pos = 0; pos < text.size(); pos += 7) {
+        const auto count = std::min<std::size_t>(7, text.size() - pos);
+        REQUIRE(write(fd, text.data() + pos, count) > 0);
+      }
+      close(fd);
+    });
+    Rummy::Deck deck;
+    deck.BuildStreaming(fds[0]);
+    generator.join();
+    close(fds[0]);
+
+    THEN("It matches a build from the whole input") {
+      std::stringstream whole(text);
+      Rummy::Deck reference;
+      reference.Build(whole);
+      std::stringstream out, ref_out;
+      deck.WriteDeck(out);
+      reference.WriteDeck(ref_out);
+      REQUIRE(out.str() == ref_out.str());
+      FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 1.5 / 0.4);
+      REQUIRE(deck.GetCardMeta("gas", "rho").comment == "density");
+      REQUIRE(deck.GetCardMeta("gas/eos", "gamma").loc == 2);
+      REQUIRE(deck.GetCardValue<std::string>("gas", "label") == std::string(300, 'x'));
+    }
+    fs::remove_all(tmp);
+  }
+  GIVEN("A file descriptor read through a small buffer") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    const std::string text = "first line\na much longer second line\n";
+    REQUIRE(write(fds[1], text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+    close(fds[1]);
+    Rummy::FdStreamBuf buf(fds[0], 5);
+    std::istream is(&buf);
+    std::string first, second, third;
+    std::getline(is, first);
+    std::getline(is, second);
+    const bool more = static_cast<bool>(std::getline(is, third));
+    close(fds[0]);
+    THEN("Lines longer than the buffer are read whole") {
+      REQUIRE(first == "first line");
+      REQUIRE(second == "a much longer second line");
+      REQUIRE_FALSE(more);
+    }
+  }
+}
+
+TEST_CASE("Deck - Live inspection") {
+  GIVEN("A deck published to an inspector") {
+    std::stringstream ss("nzones = 64\n<gas>\nrho = 1.5\nname = \"air\"\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    namespace fs = std::filesystem;
+    const auto socket_path = (fs::temp_directory_path() / "rummy_inspect.sock").string();
+    Rummy::Inspector inspector(socket_path);
+    REQUIRE(inspector.Publish(deck));
+    auto query = [&](const std::string &request) {
+      std::stringstream os;
+      inspector.Query(request, os);
+      return os.str();
+    };
+
+    THEN("Requests are answered from the snapshot") {
+      REQUIRE(query("get gas/rho") == "1.50000000000000000e+00\n");
+      REQUIRE(query("get nzones") == "64\n");
+      REQUIRE(query("suit gas") == "name = \"air\"\nrho = 1.50000000000000000e+00\n");
+      REQUIRE_THAT(query("dump"), Catch::Matchers::ContainsSubstring("<gas>\nname"));
+      REQUIRE(query("hash").size() == 17);
+      REQUIRE_THAT(query("stats"), Catch::Matchers::ContainsSubstring("cards 3\n"));
+      REQUIRE_THAT(query("get gas/none"), Catch::Matchers::ContainsSubstring("error:"));
+      REQUIRE_THAT(query("bogus"), Catch::Matchers::ContainsSubstring("unknown request"));
+    }
+    WHEN("The deck changes") {
+      const auto old_hash = query("hash");
+      deck.UpdateCard("gas", "rho", 2.0);
+      THEN("Queries see the change only once it is published") {
+        REQUIRE(query("hash") == old_hash);
+        REQUIRE(inspector.Publish(deck));
+        REQUIRE(query("hash") != old_hash);
+        REQUIRE(query("get gas/rho") == deck.GetCard("gas", "rho").GetString() + "\n");
+      }
+    }
+    WHEN("The snapshot would exceed the memory budget") {
+      Rummy::Inspector small(socket_path, 64);
+      THEN("It is refused") {
+        REQUIRE_FALSE(small.Publish(deck));
+        std::stringstream os;
+        small.Query("stats", os);
+        REQUIRE_THAT(os.str(), Catch::Matchers::ContainsSubstring("nothing"));
+      }
+    }
+    WHEN("A client attaches over the socket") {
+      inspector.Start();
+      const auto reply = Rummy::InspectorRequest(socket_path, "get gas/name");
+      const auto stats = Rummy::InspectorRequest(socket_path, "stats");
+      const auto perms = fs::status(socket_path).permissions();
+      inspector.Stop();
+      THEN("It gets the same answers and the socket is removed on Stop") {
+        REQUIRE(reply == "\"air\"\n");
+        const auto others = fs::perms::group_all | fs::perms::others_all;
+        REQUIRE((perms & others) == fs::perms::none);
+        REQUIRE_THAT(stats, Catch::Matchers::ContainsSubstring("version 1\n"));
+        REQUIRE_FALSE(fs::exists(socket_path));
+      }
+    }
+  }
+}
+
+TEST_CASE("Ensemble - Sampling designs") {
+  GIVEN("A pips statement that uses the bitwise not") {
+    std::stringstream ss("mask = 3\nprint(~mask)\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+    THEN("It is run, not read as a sampling declaration") {
+      REQUIRE(deck.GetSampledCards().empty());
+      FLOAT_REQUIRE(deck.GetCardValue<double>("/", "mask"), 3.0);
+    }
+  }
+  GIVEN("A deck with sampled cards and a sampling design") {
+    auto build = [](const std::string &design) {
+      std::stringstream ss("<sampling>\ndesign = \"" + design +
+                           "\"\nn = 64\nseed = 7\n"
+                           "<gas>\nrho ~ uniform(0.9, 1.1)\ncv ~ normal(2.0, 0.1)\n"
+                           "kappa ~ loguniform(1.0e-3, 1.0e-1)\ne = rho * cv\n");
+      Rummy::Deck deck;
+      deck.Build(ss);
+      return deck;
+    };
+
+    THEN("The base deck holds the nominal values") {
+      auto deck = build("lhs");
+      FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "rho"), 1.0);
+      FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "cv"), 2.0);
+      REQUIRE(std::abs(deck.GetCardValue<double>("gas", "kappa") - 1.0e-2) < 1e-15);
+      REQUIRE(deck.GetSampledCards().size() == 3);
+      REQUIRE(deck.GetSampledCards()[1].dist == Rummy::Distribution::NORMAL);
+    }
+    for (const auto *design : {"lhs", "sobol"}) {
+      WHEN(std::string("Members are drawn with ") + design) {
+        auto deck = build(design);
+        auto serial = Rummy::Ensemble::Sample(deck, 1);
+        auto parallel = Rummy::Ensemble::Sample(deck, 4);
+        THEN("Each stratum is hit once, derived cards follow, threads do not matter") {
+          REQUIRE(serial.size() == 64);
+          std::vector<int> strata(64, 0);
+          for (std::size_t i = 0; i < serial.size(); i++) {
+            const double rho = serial[i].GetCardValue<double>("gas", "rho");
+            const double cv = serial[i].GetCardValue<double>("gas", "cv");
+            strata[static_cast<int>((rho - 0.9) / 0.2 * 64)]++;
+            FLOAT_REQUIRE(serial[i].GetCardValue<double>("gas", "e"), rho * cv);
+            REQUIRE(rho == parallel[i].GetCardValue<double>("gas", "rho"));
+            REQUIRE(cv == parallel[i].GetCardValue<double>("gas", "cv"));
+            REQUIRE(serial[i].NumChanges() == parallel[i].NumChanges());
+          }
+          REQUIRE(std::count(strata.begin(), strata.end(), 1) == 64);
+        }
+      }
+    }
+    WHEN("The seed changes") {
+      auto deck = build("sobol");
+      Rummy::SamplingDesign design = Rummy::SamplingDesign::FromDeck(deck);
+      auto a = Rummy::Ensemble::Sample(deck, design);
+      design.seed = 8;
+      auto b = Rummy::Ensemble::Sample(deck, design);
+      THEN("The members change too") {
+        REQUIRE(a[0].GetCardValue<double>("gas", "rho") !=
+                b[0].GetCardValue<double>("gas", "rho"));
+      }
+    }
+  }
+  GIVEN("The inverse normal CDF") {
+    THEN("It matches known quantiles") {
+      REQUIRE(std::abs(Rummy::InverseNormal(0.5)) < 1e-15);
+      REQUIRE(std::abs(Rummy::InverseNormal(0.975) - 1.959963984540054) < 1e-12);
+      REQUIRE(std::abs(Rummy::InverseNormal(1e-6) + 4.753424308822899) < 1e-10);
+    }
+  }
+}
+
+TEST_CASE("Deck - Prepared decks") {
+  GIVEN("A template deck prepared with parameters") {
+    std::stringstream ss("nx = 64\ndx = 1.0 / nx\nlabel = \"base\"\n"
+                         "<gas>\nrho = 1.0\ncv = 2.0\ne = rho * cv\n");
+    auto prepared = Rummy::Prepare(ss, {"rho", "nx", "label"});
+    REQUIRE(prepared.GetParams()[0] == std::make_pair(std::string("gas"),
+                                                      std::string("rho")));
+
+    WHEN("It is instantiated with new values") {
+      auto deck = prepared.Instantiate({{"rho", 2.0}, {"nx", 256}, {"label", "run"}});
+      THEN("The parameters and the cards derived from them change") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "rho"), 2.0);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 4.0);
+        REQUIRE(deck.GetCardValue<int>("/", "nx") == 256);
+        FLOAT_REQUIRE(deck.GetCardValue<double>("/", "dx"), 1.0 / 256);
+        REQUIRE(deck.GetCardValue<std::string>("/", "label") == "run");
+        REQUIRE(deck.GetJournal().empty());
+      }
+      THEN("The prepared base is unchanged") {
+        Rummy::Deck base = prepared.GetBase();
+        FLOAT_REQUIRE(base.GetCardValue<double>("gas", "e"), 2.0);
+        FLOAT_REQUIRE(base.GetCardValue<double>("/", "dx"), 1.0 / 64);
+      }
+      THEN("Instances are independent and keep working as decks") {
+        auto other = prepared.Instantiate({{"gas/rho", 3.0}});
+        FLOAT_REQUIRE(other.GetCardValue<double>("gas", "e"), 6.0);
+        FLOAT_REQUIRE(other.GetCardValue<double>("/", "dx"), 1.0 / 64);
+        auto tx = deck.Begin();
+        tx.Set("gas", "cv", 3.0);
+        REQUIRE(tx.Commit());
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 6.0);
+      }
+    }
+    WHEN("No values are given") {
+      auto deck = prepared.Instantiate();
+      THEN("The defaults are used") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("gas", "e"), 2.0);
+      }
+    }
+  }
+  GIVEN("A template whose loop bound is derived from a parameter") {
+    std::stringstream ss("n = 2\nm = n + 1\nscale = 1.0\n"
+                         "for i in 0..m:\nv[{i}] = scale * {i}\nend\n");
+    auto prepared = Rummy::Prepare(ss, {"n", "scale"});
+    WHEN("It is instantiated without changing the bound") {
+      auto deck = prepared.Instantiate({{"n", 2}, {"scale", 2.0}});
+      THEN("The instance keeps the expanded loop") {
+        FLOAT_REQUIRE(deck.GetCardValue<double>("/", "v[2]"), 4.0);
+        REQUIRE_FALSE(deck.DoesCardExist("/", "v[3]"));
+      }
+    }
+  }
+}
+
+TEST_CASE("Deck - Cached expressions") {
+  GIVEN("A built deck") {
+    std::stringstream ss("scale = 2.0\n<mesh>\nnx1 = 64\nrefine = true\n"
+                         "<hydro>\ncfl = 0.8\n");
+    Rummy::Deck deck;
+    deck.Build(ss);
+
+    THEN("Expressions evaluate against the current card values") {
+      REQUIRE(deck.Eval<int>("2*mesh.nx1 + 1") == 129);
+      FLOAT_REQUIRE(deck.Eval("0.5*cfl", "hydro"), 0.4);
+      FLOAT_REQUIRE(deck.Eval("scale*cfl", "hydro"), 1.6);
+      REQUIRE(deck.Eval<bool>("refine && nx1 > 32", "mesh"));
+      deck.UpdateCard("mesh", "nx1", 16);
+      REQUIRE(deck.Eval<int>("2*mesh.nx1 + 1") == 33);
+      REQUIRE_FALSE(deck.Eval<bool>("refine && nx1 > 32", "mesh"));
+    }
+    WHEN("An expression is compiled") {
+      auto compiled = deck.Compile("cfl * scale", "hydro");
+      THEN("It follows later changes without recompiling") {
+        FLOAT_REQUIRE(compiled.Evaluate(), 1.6);
+        deck.UpdateCard("hydro", "cfl", 0.5);
+        FLOAT_REQUIRE(compiled.Evaluate(), 1.0);
+        REQUIRE(compiled.Source() == "cfl * scale");
+      }
+      THEN("A card added to the suit shadows the global for new evaluations") {
+        deck.AddCard("hydro", "scale", 2.5);
+        FLOAT_REQUIRE(compiled.Evaluate(), 1.6);
+        FLOAT_REQUIRE(deck.Eval("cfl * scale", "hydro"), 2.0);
+      }
+    }
+    WHEN("The same text is evaluated in different suits, alternately") {
+      const std::string expr = "scale * 2";
+      const std::string mesh = "mesh";
+      const std::string hydro = "hydro";
+      deck.AddCard("hydro", "scale", 2.5);
+      deck.Eval(expr, mesh);
+      deck.Eval(expr, hydro);
+      const auto before = num_allocations;
+      double sum = 0.0;
+      for (int i = 0; i < 100; i++) {
+        sum += deck.Eval(expr, mesh) + deck.Eval(expr, hydro);
+      }
+      const auto allocations = num_allocations - before;
+      THEN("Each suit resolves the names once and evaluation does not allocate") {
+        FLOAT_REQUIRE(sum, 100 * (4.0 + 5.0));
+        REQUIRE(allocations == 0);
+      }
+    }
+    WHEN("The cache is smaller than the expressions in use") {
+      deck.SetExpressionCacheSize(2);
+      for (int i = 0; i < 10; i++) {
+        REQUIRE(deck.Eval<int>("mesh.nx1 + " + std::to_string(i)) == 64 + i);
+      }
+      THEN("Evicted expressions are compiled again") {
+        REQUIRE(deck.Eval<int>("mesh.nx1 + 0") == 64);
+        REQUIRE(deck.Eval<int>("mesh.nx1 + 9") == 73);
+      }
+      THEN("Copies keep the cache size") {
+        Rummy::Deck copy(deck);
+        Rummy::Deck assigned;
+        assigned = deck;
+        REQUIRE(copy.GetExpressionCacheSize() == 2);
+        REQUIRE(assigned.GetExpressionCacheSize() == 2);
+      }
+    }
+  }
+}